@@ -1,24 +1,136 @@
 #include <QtGui/QApplication>
+#include <QDir>
 #include <QMessageBox>
+#include <QTextStream>
+#include <QTimer>
 #include <QTranslator>
 
 #include "mpwindow.h"
+#include "mpimagemanager.h"
+#include "mptilepack.h"
+#include "mptileseeder.h"
+#include "mpbenchmark.h"
+#include "mpdecodebenchmark.h"
 
 #define  LOCALE_DIR  "locale"
 #define  LOCALE_FILE "merkopolo-%1"
 
+#define  SEED_USAGE "Usage: merkopolo --seed --bbox WEST,SOUTH,EAST,NORTH --zoom MIN-MAX\n" \
+                    "                 [--source URL|DIR] [--name NAME] [--cache DIR] [--jobs N] [--max-size MB]\n" \
+                    "Source URL and directory have {z}, {x} and {y} placeholders.\n" \
+                    "The pack is sized for the area unless --max-size is given."
+
 
 /*! \mainpage Source Code Documentation
  */
 
 
+/*! Value of the command line option \a name, or \a defaultValue if absent.
+ */
+static QString option(const QStringList& args, const QString& name, const QString& defaultValue = QString())
+{
+    int i = args.indexOf(name);
+    return (i != -1 && i + 1 < args.size()) ? args.at(i + 1) : defaultValue;
+}
+
+/*! Seeds the tile pack of a source for an area, without user interface.
+  \see MPTileSeeder
+ */
+static int seed(QCoreApplication& a)
+{
+    QStringList args = a.arguments();
+    QTextStream err(stderr);
+
+    QStringList bbox = option(args, "--bbox").split(",");
+    QStringList zooms = option(args, "--zoom").split("-");
+    if (bbox.size() != 4 || zooms.isEmpty() || zooms.size() > 2) {
+        err << SEED_USAGE << endl;
+        return 1;
+    }
+    CoordBox box(Coord(bbox[0].toDouble(), bbox[1].toDouble()),
+                 Coord(bbox[2].toDouble(), bbox[3].toDouble()));
+    int minZoom = zooms.first().toInt();
+    int maxZoom = zooms.last().toInt();
+
+    QDir cacheDir(option(args, "--cache", MPImageManager::defaultCacheDir()));
+    cacheDir.mkpath(".");
+    QString fileName = cacheDir.filePath(MPImageManager::packFileName(option(args, "--name", SEED_DEFAULT_NAME)));
+    MPTilePack pack;
+    if (!pack.open(fileName)) {
+        err << QCoreApplication::tr("Could not open tile pack %1").arg(fileName) << endl;
+        return 1;
+    }
+
+    MPTileSeeder seeder(&pack);
+    seeder.setSource(option(args, "--source", SEED_DEFAULT_SOURCE));
+    seeder.setArea(box, minZoom, maxZoom);
+    seeder.setConnections(option(args, "--jobs", QString::number(SEED_CONNECTIONS)).toInt());
+    seeder.setProgressFile(fileName + SEED_PROGRESS_EXTENSION);
+
+    // Room for the tiles already stored and the whole area
+    qint64 maxSize = option(args, "--max-size").toLongLong() * 1024 * 1024;
+    if (maxSize <= 0)
+        maxSize = qMax(TILE_PACK_MAX_SIZE, pack.size() + seeder.estimatedSize());
+    pack.setMaxSize(maxSize);
+
+    QObject::connect(&seeder, SIGNAL(finished()), &a, SLOT(quit()));
+    QTimer::singleShot(0, &seeder, SLOT(start()));
+    a.exec();
+    if (seeder.evicted() > 0)
+        return 3;
+    return seeder.failed() > 0 ? 2 : 0;
+}
+
+/*! Runs the geometry microbenchmark, without user interface.
+  \see MPBenchmark::geometry()
+ */
+static int benchGeometry(QCoreApplication& a)
+{
+    QStringList args = a.arguments();
+    QTextStream out(stdout);
+    MPBenchmark::geometry(out, option(args, "--points", QString::number(BENCH_GEOMETRY_POINTS)).toInt(),
+                          option(args, "--runs", QString::number(BENCH_GEOMETRY_RUNS)).toInt());
+    return 0;
+}
+
+/*! Runs the tile decoding burst benchmark, without user interface.
+  \see MPDecodeBenchmark
+ */
+static int benchDecode(QCoreApplication& a)
+{
+    QStringList args = a.arguments();
+    QTextStream out(stdout);
+    MPDecodeBenchmark benchmark(&out);
+    benchmark.setTiles(option(args, "--tiles", QString::number(BENCH_DECODE_TILES)).toInt());
+    benchmark.setGuiThreadDecoding(args.contains("--gui-thread"));
+    QObject::connect(&benchmark, SIGNAL(finished()), &a, SLOT(quit()));
+    QTimer::singleShot(0, &benchmark, SLOT(start()));
+    return a.exec();
+}
+
+
 int main(int argc, char *argv[])
 {
-    QApplication a(argc, argv);
+    // Seeding and benchmarks run without any window
+    bool seeding = false, benchGeometryMode = false, benchDecodeMode = false;
+    for (int i=1; i<argc; ++i) {
+        seeding = seeding || QString(argv[i]) == "--seed";
+        benchGeometryMode = benchGeometryMode || QString(argv[i]) == "--bench-geometry";
+        benchDecodeMode = benchDecodeMode || QString(argv[i]) == "--bench-decode";
+    }
+
+    QApplication a(argc, argv, !seeding && !benchGeometryMode && !benchDecodeMode);
 
     QCoreApplication::setOrganizationName("Merkopolo");
     QCoreApplication::setApplicationName("Merkopolo");
 
+    if (seeding)
+        return seed(a);
+    if (benchGeometryMode)
+        return benchGeometry(a);
+    if (benchDecodeMode)
+        return benchDecode(a);
+
     /*
      * Start application !
      */
@@ -75,6 +75,8 @@ MERKOPOLO_SRC_DIR = $$PWD
 include($$MERKOPOLO_SRC_DIR/mpInteractions/mpInteractions.pri)
 include($$MERKOPOLO_SRC_DIR/mpWidgets/mpWidgets.pri)
 include($$MERKOPOLO_SRC_DIR/mpLayers/mpLayers.pri)
+include($$MERKOPOLO_SRC_DIR/mpRender/mpRender.pri)
+include($$MERKOPOLO_SRC_DIR/mpTiles/mpTiles.pri)
 
 TARGET = merkopolo
 INSTALLS += target
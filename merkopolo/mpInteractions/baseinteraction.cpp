@@ -1,8 +1,16 @@
 #include "baseinteraction.h"
 
 #include "Layer.h"
+#include "ImageMapLayer.h"
+#include "Node.h"
+#include "Way.h"
+#include "MerkaartorPreferences.h"
 
 #include "mpmapview.h"
+#include "mpdocument.h"
+#include "mpspatialindex.h"
+#include "mpsnapper.h"
+#include "mpgeometry.h"
 
 
 /*!
@@ -24,16 +32,33 @@
     This signal is emitted when the user is inactive for some time (IDLE_TIMEOUT)
 */
 
+/*! \fn void BaseInteraction::activity();
+    This signal is emitted when the user moves the map (panning or wheel).
+*/
+
+/*! \fn void BaseInteraction::panned(const QPointF& velocity);
+    This signal is emitted on each mouse move while panning, with the
+    smoothed mouse \a velocity in pixels per millisecond. It is emitted
+    with a null velocity when the mouse is released after panning.
+*/
+
 /*! Constructs BaseInteraction
   */
 BaseInteraction::BaseInteraction(MPMapView* theView) :
     FeatureSnapInteraction(theView),
-    m_snapEnabled(true)
+    m_snapEnabled(true),
+    m_snapSequence(0)
 {
     m_idletimer = new QTimer(this);
     m_idletimer->setInterval(IDLE_TIMEOUT);
     m_idletimer->setSingleShot(true);
     connect(m_idletimer, SIGNAL(timeout()), this, SLOT(onTimerTimeout()));
+    m_snaptimer = new QTimer(this);
+    m_snaptimer->setInterval(SNAP_FRAME_INTERVAL);
+    m_snaptimer->setSingleShot(true);
+    connect(m_snaptimer, SIGNAL(timeout()), this, SLOT(onSnapTimeout()));
+    m_snapper = new MPSnapper(this);
+    connect(m_snapper, SIGNAL(snapped(int,Feature*)), this, SLOT(onSnapped(int,Feature*)));
     setDontSelectVirtual(true);
 }
 
@@ -42,6 +67,8 @@ BaseInteraction::BaseInteraction(MPMapView* theView) :
 BaseInteraction::~BaseInteraction(void)
 {
     delete m_idletimer;
+    delete m_snaptimer;
+    delete m_snapper;
 }
 
 /*! Reinitializes the interaction state. Basically used
@@ -49,6 +76,11 @@ BaseInteraction::~BaseInteraction(void)
   */
 void BaseInteraction::reinitialize()
 {
+    // Features of pending snap results may not exist anymore
+    ++m_snapSequence;
+    m_snaptimer->stop();
+    m_snapper->cancel();
+    LastSnap = 0;
 }
 
 /*! Enables snap (hovering) of features.
@@ -65,6 +97,14 @@ bool BaseInteraction::isSnapEnabled()
     return m_snapEnabled;
 }
 
+/*! Smoothed mouse velocity while panning, in pixels per millisecond.
+  Null when not panning.
+  */
+QPointF BaseInteraction::panVelocity() const
+{
+    return m_panVelocity;
+}
+
 /*! Current interaction HTML documentation (to be displayed in help panel).
   */
 QString BaseInteraction::toHtml()
@@ -83,6 +123,10 @@ void BaseInteraction::mousePressEvent(QMouseEvent* event)
     // Do not fire idle() while panning or dragging
     if (Panning)
         m_idletimer->stop();
+
+    m_panVelocity = QPointF();
+    m_panPosition = event->pos();
+    m_panTimer.start();
 }
 
 /*! When a mouse button is released.
@@ -92,6 +136,10 @@ void BaseInteraction::mouseReleaseEvent(QMouseEvent* event)
     FeatureSnapInteraction::mouseReleaseEvent(event);
     if (!m_idletimer->isActive())
         resetIdleTimer();
+    if (!m_panVelocity.isNull()) {
+        m_panVelocity = QPointF();
+        emit panned(m_panVelocity);
+    }
 }
 
 /*! When the mouse is moved.
@@ -101,14 +149,40 @@ void BaseInteraction::mouseMoveEvent(QMouseEvent* event)
     snapMouseMoveEvent(event, LastSnap);
     if (!LastSnap)
         Interaction::mouseMoveEvent(event);
-    if (!(Panning))
+    if (!(Panning)) {
         resetIdleTimer();
+    }
+    else {
+        emit activity();
+        updatePanVelocity(event->pos());
+        emit panned(m_panVelocity);
+    }
+}
+
+/*! Updates the panning velocity with the mouse move to \a pos.
+
+  The velocity is smoothed exponentially (PAN_VELOCITY_SMOOTHING), and
+  restarts from the last move if the mouse stopped for PAN_VELOCITY_TIMEOUT
+  milliseconds.
+  */
+void BaseInteraction::updatePanVelocity(const QPoint& pos)
+{
+    qint64 elapsed = m_panTimer.restart();
+    if (elapsed <= 0)
+        return;
+    QPointF velocity = QPointF(pos - m_panPosition) / elapsed;
+    if (elapsed > PAN_VELOCITY_TIMEOUT || m_panVelocity.isNull())
+        m_panVelocity = velocity;
+    else
+        m_panVelocity = m_panVelocity * (1 - PAN_VELOCITY_SMOOTHING) + velocity * PAN_VELOCITY_SMOOTHING;
+    m_panPosition = pos;
 }
 
 /*! When the mouse wheel is rolled.
   */
 void BaseInteraction::wheelEvent(QWheelEvent* event)
 {
+    emit activity();
     Interaction::wheelEvent(event);
     resetIdleTimer();
 }
@@ -149,17 +223,131 @@ void BaseInteraction::onTimerTimeout()
 void BaseInteraction::paintEvent(QPaintEvent* anEvent, QPainter& thePainter)
 {
     Interaction::paintEvent(anEvent, thePainter);
-    if (LastSnap) {
+    if (Way* way = dynamic_cast<Way*>(LastSnap)) {
+        drawWayHover(thePainter, way);
+    }
+    else if (LastSnap) {
         LastSnap->drawHover(thePainter, view());
     }
 }
 
+/*! Draws the hover outline of \a aWay, clipped to the view and decimated
+  (see MPGeometry), so that hovering a long coastline or boundary only
+  draws its visible vertices. Replaces Feature::drawHover() for ways.
+  */
+void BaseInteraction::drawWayHover(QPainter& thePainter, Way* aWay)
+{
+    MPCoordBuffer coords;
+    coords.reserve(aWay->size());
+    for (int i=0; i<aWay->size(); ++i)
+        coords.append(view()->projection().project(aWay->getNode(i)));
+    MPGeometry::transform(coords, view()->transform(), coords);
+
+    QRectF clip = QRectF(view()->rect()).adjusted(-GEOMETRY_CLIP_MARGIN, -GEOMETRY_CLIP_MARGIN,
+                                                  GEOMETRY_CLIP_MARGIN, GEOMETRY_CLIP_MARGIN);
+    QPen pen(M_PREFS->getHoverColor());
+    pen.setWidthF(M_PREFS->getHoverWidth());
+    thePainter.save();
+    thePainter.setPen(pen);
+    thePainter.setBrush(Qt::NoBrush);
+    if (aWay->isClosed()) {
+        thePainter.drawPolygon(MPGeometry::clipPolygon(coords, clip));
+    }
+    else {
+        foreach (QPolygonF part, MPGeometry::clipPolyline(coords, clip))
+            thePainter.drawPolyline(part);
+    }
+    thePainter.restore();
+}
+
 /*! Detects snapped features on mouse move (if snapping is enabled).
+
+  Mouse moves are coalesced : only the latest cursor position is snapped,
+  at most once per frame (SNAP_FRAME_INTERVAL), by onSnapTimeout().
   */
 void BaseInteraction::updateSnap(QMouseEvent* event)
 {
     if (!isSnapEnabled())
         return;
 
-    FeatureSnapInteraction::updateSnap(event);
+    if (!dynamic_cast<MPDocument*>(view()->document())) {
+        FeatureSnapInteraction::updateSnap(event);
+        return;
+    }
+
+    m_snapPosition = event->pos();
+    ++m_snapSequence;
+    if (!m_snaptimer->isActive())
+        m_snaptimer->start();
+}
+
+/*! Snaps the latest cursor position.
+
+  Candidates are searched in the spatial index of each visible and
+  selectable layer, within SNAP_DISTANCE pixels around the cursor. The
+  nearest one is then searched by MPSnapper on a worker thread, from a
+  copy of the nodes and ways geometry (other features are not snapped),
+  using a linearization of the view projection around the cursor.
+  */
+void BaseInteraction::onSnapTimeout()
+{
+    MPDocument* doc = dynamic_cast<MPDocument*>(view()->document());
+    if (!doc || !isSnapEnabled())
+        return;
+
+    MPSnapRequest request;
+    request.sequence = m_snapSequence;
+    request.position = m_snapPosition;
+    request.distance = SNAP_DISTANCE;
+
+    // Screen to map affine, from the cursor and its neighbour pixels
+    Coord origin = XY_TO_COORD(m_snapPosition);
+    QPointF dx = XY_TO_COORD(m_snapPosition + QPoint(1, 0)) - origin;
+    QPointF dy = XY_TO_COORD(m_snapPosition + QPoint(0, 1)) - origin;
+    QTransform toMap(dx.x(), dx.y(), dy.x(), dy.y(),
+                     origin.x() - m_snapPosition.x()*dx.x() - m_snapPosition.y()*dy.x(),
+                     origin.y() - m_snapPosition.x()*dx.y() - m_snapPosition.y()*dy.y());
+    request.transform = toMap.inverted();
+
+    QPoint margin(SNAP_DISTANCE, SNAP_DISTANCE);
+    CoordBox box(XY_TO_COORD(m_snapPosition - margin), XY_TO_COORD(m_snapPosition + margin));
+    for (int i=0; i<doc->layerSize(); ++i) {
+        Layer* l = doc->getLayer(i);
+        if (!l->isVisible() || l->isReadonly() || dynamic_cast<ImageMapLayer*>(l))
+            continue;
+        foreach (Feature* f, doc->spatialIndex(l)->find(box)) {
+            if (f->isHidden() || f->isDeleted() || NoSnap.contains(f))
+                continue;
+            MPSnapCandidate candidate;
+            candidate.feature = f;
+            if (Node* n = dynamic_cast<Node*>(f)) {
+                candidate.coords << QPointF(n->position());
+            }
+            else if (Way* w = dynamic_cast<Way*>(f)) {
+                candidate.isWay = true;
+                candidate.coords.reserve(w->size());
+                for (int j=0; j<w->size(); ++j)
+                    candidate.coords << QPointF(w->getNode(j)->position());
+            }
+            if (!candidate.coords.isEmpty())
+                request.candidates << candidate;
+        }
+    }
+    m_snapper->request(request);
+}
+
+/*! The nearest \a feature of snap request \a sequence is found.
+
+  Dropped if the cursor moved since the request, otherwise
+  emits featureSnap() when the snapped feature changes.
+  */
+void BaseInteraction::onSnapped(int sequence, Feature* feature)
+{
+    if (sequence != m_snapSequence)
+        return;
+    if (feature != LastSnap) {
+        LastSnap = feature;
+        emit featureSnap(LastSnap);
+        view()->update();
+    }
 }
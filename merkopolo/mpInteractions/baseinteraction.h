@@ -2,15 +2,22 @@
 #define BASEINTERACTION_H_
 
 #include <QTimer>
+#include <QElapsedTimer>
+#include <QPointF>
 
 #include "Interaction.h"
 
 #define IDLE_TIMEOUT 750
+#define SNAP_DISTANCE 5
+#define PAN_VELOCITY_SMOOTHING 0.3
+#define PAN_VELOCITY_TIMEOUT 100
 
 class Layer;
 class Feature;
+class Way;
 
 class MPMapView;
+class MPSnapper;
 
 class BaseInteraction :	public FeatureSnapInteraction
 {
@@ -32,6 +39,7 @@ public:
 
     void setSnapEnabled(bool);
     virtual bool isSnapEnabled();
+    QPointF panVelocity() const;
     virtual void handleLoadLayerDone(Layer*){}
 
 public slots:
@@ -39,17 +47,37 @@ public slots:
 
 signals:
     void idle();
+    void activity();
+    void panned(const QPointF& velocity);
 
 public slots:
     void onTimerTimeout();
+    void onSnapTimeout();
+    void onSnapped(int sequence, Feature* feature);
 
 protected:
     void resetIdleTimer();
+    void updatePanVelocity(const QPoint& pos);
+    void drawWayHover(QPainter& thePainter, Way* aWay);
 
     /*! Store if snap is enabled */
     bool m_snapEnabled;
     /*! Simple timout timer to be easily reset */
     QTimer* m_idletimer;
+    /*! Smoothed panning velocity, in pixels per millisecond */
+    QPointF m_panVelocity;
+    /*! Last mouse position while panning */
+    QPoint m_panPosition;
+    /*! Time since the last mouse move while panning */
+    QElapsedTimer m_panTimer;
+    /*! Coalesces snap requests to one per frame */
+    QTimer* m_snaptimer;
+    /*! Searches snapped features on a worker thread */
+    MPSnapper* m_snapper;
+    /*! Latest cursor position to snap */
+    QPoint m_snapPosition;
+    /*! Incremented for each cursor position, to drop stale snap results */
+    int m_snapSequence;
 
 };
 
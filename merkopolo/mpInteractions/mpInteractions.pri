@@ -2,6 +2,8 @@ INCLUDEPATH += $$MERKOPOLO_SRC_DIR/mpInteractions
 DEPENDPATH += $$MERKOPOLO_SRC_DIR/mpInteractions
 
 HEADERS += baseinteraction.h \
+    mpsnapper.h \
     zoomregioninteraction.h
 SOURCES += baseinteraction.cpp \
+    mpsnapper.cpp \
     zoomregioninteraction.cpp
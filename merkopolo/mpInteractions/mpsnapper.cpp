@@ -0,0 +1,150 @@
+#include "mpsnapper.h"
+
+#include <QtConcurrentRun>
+#include <qmath.h>
+
+#include "mpgeometry.h"
+
+
+/*!
+  \class MPSnapper
+  \brief Searches the feature nearest to the cursor on a worker thread.
+
+  Only one search runs at a time : requests received meanwhile replace each
+  other, and only the latest is searched once the running one is done.
+
+  Searches only read a copy of the candidates geometry (MPSnapCandidate),
+  so features may be edited meanwhile. Results are delivered with the
+  sequence of their request, so that the caller can drop those made for
+  an old cursor position.
+*/
+
+/*! \fn void MPSnapper::snapped(int sequence, Feature* feature);
+    This signal is emitted when the search of request \a sequence is done.
+    \a feature is 0 if nothing is within snap distance.
+*/
+
+/*! Constructs MPSnapper
+  */
+MPSnapper::MPSnapper(QObject* parent) :
+    QObject(parent),
+    m_hasPending(false)
+{
+    m_watcher = new QFutureWatcher<MPSnapResult>(this);
+    connect(m_watcher, SIGNAL(finished()), this, SLOT(onFinished()));
+}
+
+/*! Destroys MPSnapper, waiting for the running search.
+  */
+MPSnapper::~MPSnapper()
+{
+    m_watcher->waitForFinished();
+}
+
+/*! Searches the nearest feature of \a aRequest, or postpones
+  it if a search is already running (latest wins).
+  */
+void MPSnapper::request(const MPSnapRequest& aRequest)
+{
+    if (isSearching()) {
+        m_pending = aRequest;
+        m_hasPending = true;
+        return;
+    }
+    start(aRequest);
+}
+
+/*! Checks whether a search is running.
+  */
+bool MPSnapper::isSearching() const
+{
+    return m_watcher->isRunning();
+}
+
+/*! Drops the postponed request and waits for the running search.
+  */
+void MPSnapper::cancel()
+{
+    m_hasPending = false;
+    m_watcher->waitForFinished();
+}
+
+/*! Starts the search of \a aRequest on the global thread pool.
+  */
+void MPSnapper::start(const MPSnapRequest& aRequest)
+{
+    m_watcher->setFuture(QtConcurrent::run(&MPSnapper::search, aRequest));
+}
+
+/*! The running search is done : emits snapped() and starts the postponed request, if any.
+  */
+void MPSnapper::onFinished()
+{
+    MPSnapResult result = m_watcher->result();
+    if (m_hasPending) {
+        m_hasPending = false;
+        start(m_pending);
+    }
+    emit snapped(result.sequence, result.feature);
+}
+
+/*! Finds the feature of \a aRequest nearest to the cursor. Runs on a worker thread.
+
+  Nodes are measured to their position, ways to their segments. Way vertices are mapped to the screen all at
+  once (MPGeometry::transform()).
+  */
+MPSnapResult MPSnapper::search(const MPSnapRequest& aRequest)
+{
+    MPSnapResult result;
+    result.sequence = aRequest.sequence;
+
+    qreal best = aRequest.distance;
+    MPCoordBuffer coords;
+    foreach (const MPSnapCandidate& candidate, aRequest.candidates) {
+        if (candidate.coords.isEmpty())
+            continue;
+        qreal distance = best;
+        if (!candidate.isWay) {
+            QPointF p = aRequest.transform.map(candidate.coords.first());
+            QPointF d = p - aRequest.position;
+            distance = qSqrt(d.x()*d.x() + d.y()*d.y());
+        }
+        else {
+            coords.clear();
+            coords.reserve(candidate.coords.size());
+            for (int i=0; i<candidate.coords.size(); ++i)
+                coords.append(candidate.coords.at(i));
+            MPGeometry::transform(coords, aRequest.transform, coords);
+
+            const double* x = coords.x.constData();
+            const double* y = coords.y.constData();
+            const qreal px = aRequest.position.x(), py = aRequest.position.y();
+            for (int i=1; i<coords.size(); ++i) {
+                // Segments whose box is farther than the best distance are not measured
+                if (qMin(x[i-1], x[i]) > px + distance || qMax(x[i-1], x[i]) < px - distance ||
+                    qMin(y[i-1], y[i]) > py + distance || qMax(y[i-1], y[i]) < py - distance)
+                    continue;
+                distance = qMin(distance, segmentDistance(aRequest.position, QPointF(x[i-1], y[i-1]), QPointF(x[i], y[i])));
+            }
+        }
+        if (distance < best) {
+            best = distance;
+            result.feature = candidate.feature;
+        }
+    }
+    return result;
+}
+
+/*! Distance from \a p to the segment [\a a, \a b].
+  */
+qreal MPSnapper::segmentDistance(const QPointF& p, const QPointF& a, const QPointF& b)
+{
+    QPointF ab = b - a;
+    QPointF ap = p - a;
+    qreal length = ab.x()*ab.x() + ab.y()*ab.y();
+    qreal t = 0;
+    if (length > 0)
+        t = qBound(qreal(0), (ap.x()*ab.x() + ap.y()*ab.y()) / length, qreal(1));
+    QPointF d = ap - t*ab;
+    return qSqrt(d.x()*d.x() + d.y()*d.y());
+}
@@ -0,0 +1,92 @@
+#ifndef MPSNAPPER_H
+#define MPSNAPPER_H
+
+#include <QObject>
+#include <QList>
+#include <QPointF>
+#include <QTransform>
+#include <QFutureWatcher>
+#include <QVector>
+
+#define SNAP_FRAME_INTERVAL 16
+
+class Feature;
+
+
+/*! Geometry of a feature near the cursor, copied in the GUI thread. */
+struct MPSnapCandidate
+{
+    MPSnapCandidate() : feature(0), isWay(false) {}
+
+    /*! Feature given back by the search, never read by the worker */
+    Feature* feature;
+    /*! Whether the coordinates are the nodes of a way, or a node position */
+    bool isWay;
+    /*! Longitudes and latitudes of the node or of the way nodes */
+    QVector<QPointF> coords;
+};
+
+
+/*! Read-only inputs of a snap search, prepared in the GUI thread. */
+struct MPSnapRequest
+{
+    MPSnapRequest() : sequence(0), distance(0) {}
+
+    /*! Cursor position this request was made for */
+    int sequence;
+    /*! Cursor position in screen coordinates */
+    QPointF position;
+    /*! Map to screen coordinates, linearized around the cursor */
+    QTransform transform;
+    /*! Features near the cursor, from the spatial indexes, except those which must not be snapped */
+    QList<MPSnapCandidate> candidates;
+    /*! Maximum snap distance in pixels */
+    qreal distance;
+};
+
+
+/*! Outcome of a snap search. */
+struct MPSnapResult
+{
+    MPSnapResult() : sequence(0), feature(0) {}
+
+    /*! Cursor position the search was made for */
+    int sequence;
+    /*! Nearest feature, or 0 if none within distance */
+    Feature* feature;
+};
+
+
+class MPSnapper : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit MPSnapper(QObject* parent = 0);
+    ~MPSnapper();
+
+    void request(const MPSnapRequest& aRequest);
+    bool isSearching() const;
+    void cancel();
+
+    static MPSnapResult search(const MPSnapRequest& aRequest);
+
+signals:
+    void snapped(int sequence, Feature* feature);
+
+protected slots:
+    void onFinished();
+
+protected:
+    void start(const MPSnapRequest& aRequest);
+    static qreal segmentDistance(const QPointF& p, const QPointF& a, const QPointF& b);
+
+    /*! Watches the search running on a worker thread */
+    QFutureWatcher<MPSnapResult>* m_watcher;
+    /*! Latest request received while a search was running */
+    MPSnapRequest m_pending;
+    /*! Whether m_pending has to be searched */
+    bool m_hasPending;
+};
+
+#endif // MPSNAPPER_H
@@ -1,6 +1,22 @@
 INCLUDEPATH += $$MERKOPOLO_SRC_DIR/mpLayers
 DEPENDPATH += $$MERKOPOLO_SRC_DIR/mpLayers
 HEADERS += mpfeaturepainter.h \
-    mpdocument.h
+    mpdocument.h \
+    mpspatialindex.h \
+    mpstylematcher.h \
+    mpcellstore.h \
+    mpfeaturesource.h \
+    mpimporter.h \
+    mpsnapshot.h \
+    mptagpool.h \
+    mplodcache.h
 SOURCES += mpfeaturepainter.cpp \
-    mpdocument.cpp
+    mpdocument.cpp \
+    mpspatialindex.cpp \
+    mpstylematcher.cpp \
+    mpcellstore.cpp \
+    mpfeaturesource.cpp \
+    mpimporter.cpp \
+    mpsnapshot.cpp \
+    mptagpool.cpp \
+    mplodcache.cpp
@@ -0,0 +1,306 @@
+#include "mpcellstore.h"
+
+#include <qmath.h>
+#include <QFile>
+#include <QObject>
+
+#include "Layer.h"
+#include "Node.h"
+#include "Way.h"
+
+#include "mptagpool.h"
+
+/*!
+  \class MPCellStore
+  \brief A local store of features, partitioned in a grid of cells.
+
+  The store is a directory with a small header file (CELL_STORE_HEADER)
+  and a file per non empty cell of CELL_SIZE degrees. A cell file is a
+  sequence of feature records (MPFeatureRecord), so that the features of
+  an area are read without parsing anything else.
+
+  A feature is written in every cell its bounding box intersects : loading
+  the cells of an area gives all the features shown there, and features
+  are deduplicated by id when loaded (see MPFeatureSource).
+
+  Records are buffered by cell, and appended to the cell files every
+  CELL_WRITE_BATCH records, or when flush() is called.
+
+  read() only reads files, it can be called from worker threads while
+  nothing is written.
+*/
+
+/*! Bounding box of the record coordinates.
+  */
+QRectF MPFeatureRecord::boundingBox() const
+{
+    if (coords.isEmpty())
+        return QRectF();
+    qreal x0 = coords[0].x(), x1 = x0, y0 = coords[0].y(), y1 = y0;
+    for (int i=1; i<coords.size(); ++i) {
+        x0 = qMin(x0, coords[i].x());
+        x1 = qMax(x1, coords[i].x());
+        y0 = qMin(y0, coords[i].y());
+        y1 = qMax(y1, coords[i].y());
+    }
+    return QRectF(QPointF(x0, y0), QPointF(x1, y1));
+}
+
+/*! Creates the feature of the record in \a aLayer, with the nodes
+  of a way. Tags are shared strings of \a aPool, if specified (see
+  MPTagPool::pooledValue()).
+
+  If \a aNodes is specified and the record has node identifiers, nodes
+  are shared by identifier : a node of \a aNodes is reused, and a new
+  node is added to it. Ways then keep their common nodes.
+  Returns 0 if the record has no coordinates.
+  */
+Feature* MPFeatureRecord::createFeature(Layer* aLayer, MPTagPool* aPool, QHash<qint64, Node*>* aNodes) const
+{
+    if (coords.isEmpty())
+        return 0;
+
+    bool shared = aNodes && nodeIds.size() == coords.size();
+    QVector<Node*> nodes(coords.size());
+    for (int i=0; i<coords.size(); ++i) {
+        nodes[i] = shared ? aNodes->value(nodeIds[i]) : 0;
+        if (!nodes[i]) {
+            nodes[i] = new Node(Coord(coords[i].x(), coords[i].y()));
+            aLayer->add(nodes[i]);
+            if (shared)
+                aNodes->insert(nodeIds[i], nodes[i]);
+        }
+    }
+
+    Feature* feature = 0;
+    if (type == NodeRecord) {
+        feature = nodes[0];
+    }
+    else {
+        Way* way = new Way();
+        for (int i=0; i<nodes.size(); ++i)
+            way->add(nodes[i]);
+        if (closed && way->size() > 2)
+            way->add(way->getNode(0));
+        aLayer->add(way);
+        feature = way;
+    }
+    for (int i=0; i<tags.size(); ++i) {
+        if (aPool)
+            feature->setTag(aPool->pooled(tags[i].first), aPool->pooledValue(tags[i].first, tags[i].second));
+        else
+            feature->setTag(tags[i].first, tags[i].second);
+    }
+    return feature;
+}
+
+/*! Writes \a record to the stream \a out.
+  */
+QDataStream& operator<<(QDataStream& out, const MPFeatureRecord& record)
+{
+    out << record.id << quint8(record.type) << record.closed << record.coords
+        << qint32(record.tags.size());
+    for (int i=0; i<record.tags.size(); ++i)
+        out << record.tags[i].first << record.tags[i].second;
+    return out;
+}
+
+/*! Reads \a record from the stream \a in.
+  */
+QDataStream& operator>>(QDataStream& in, MPFeatureRecord& record)
+{
+    quint8 type;
+    qint32 count;
+    in >> record.id >> type >> record.closed >> record.coords >> count;
+    record.type = MPFeatureRecord::Type(type);
+    record.tags.clear();
+    for (int i=0; i<count && in.status() == QDataStream::Ok; ++i) {
+        QPair<QString, QString> tag;
+        in >> tag.first >> tag.second;
+        record.tags << tag;
+    }
+    return in;
+}
+
+/*! Cells of \a cellSize degrees intersecting \a box (longitudes and latitudes).
+  Cells are numbered from longitude -180 and latitude -90.
+  */
+QList<QPoint> MPCellSource::gridCells(const CoordBox& box, qreal cellSize)
+{
+    QRectF r = QRectF(box.topLeft(), box.bottomRight()).normalized();
+    int x0 = qFloor((r.left() + 180) / cellSize);
+    int x1 = qFloor((r.right() + 180) / cellSize);
+    int y0 = qFloor((r.top() + 90) / cellSize);
+    int y1 = qFloor((r.bottom() + 90) / cellSize);
+    QList<QPoint> result;
+    for (int y=y0; y<=y1; ++y)
+        for (int x=x0; x<=x1; ++x)
+            result << QPoint(x, y);
+    return result;
+}
+
+/*! Hash of the cell coordinates, to key cells in QHash and QSet.
+  */
+uint qHash(const QPoint& cell)
+{
+    return uint(cell.x()) * 73856093u ^ uint(cell.y()) * 19349663u;
+}
+
+/*! Constructs a closed store.
+  */
+MPCellStore::MPCellStore() :
+    m_open(false),
+    m_cellSize(CELL_SIZE),
+    m_pendingCount(0)
+{
+}
+
+/*! Destroys the store, writing the pending records.
+  */
+MPCellStore::~MPCellStore()
+{
+    flush();
+}
+
+/*! Opens the store in the directory \a path. Returns false if
+  it is not a store, or of another version.
+  */
+bool MPCellStore::open(const QString& path)
+{
+    flush();
+    m_open = false;
+    m_dir = QDir(path);
+
+    QFile header(m_dir.filePath(CELL_STORE_HEADER));
+    if (!header.open(QIODevice::ReadOnly))
+        return false;
+    QDataStream in(&header);
+    quint32 magic, version;
+    double cellSize;
+    in >> magic >> version >> cellSize;
+    if (in.status() != QDataStream::Ok || magic != CELL_STORE_MAGIC ||
+        version != CELL_STORE_VERSION || cellSize <= 0)
+        return false;
+    m_cellSize = cellSize;
+    m_open = true;
+    return true;
+}
+
+/*! Creates an empty store in the directory \a path, removing
+  the cells of a previous store there.
+  */
+bool MPCellStore::create(const QString& path)
+{
+    flush();
+    m_open = false;
+    m_dir = QDir(path);
+    if (!m_dir.mkpath("."))
+        return false;
+    foreach (QString fileName, m_dir.entryList(QStringList() << "*.cell", QDir::Files))
+        m_dir.remove(fileName);
+
+    QFile header(m_dir.filePath(CELL_STORE_HEADER));
+    if (!header.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    QDataStream out(&header);
+    out << quint32(CELL_STORE_MAGIC) << quint32(CELL_STORE_VERSION) << double(CELL_SIZE);
+    m_cellSize = CELL_SIZE;
+    m_open = true;
+    return true;
+}
+
+/*! Checks whether the store is opened.
+  */
+bool MPCellStore::isOpen() const
+{
+    return m_open;
+}
+
+/*! A store has a single layer.
+  */
+QStringList MPCellStore::layerNames() const
+{
+    return QStringList() << QObject::tr("Data");
+}
+
+/*! Cells intersecting \a box (longitudes and latitudes).
+  */
+QList<QPoint> MPCellStore::cells(const CoordBox& box) const
+{
+    return gridCells(box, m_cellSize);
+}
+
+/*! Area of \a cell, in longitudes and latitudes.
+  */
+QRectF MPCellStore::cellBox(const QPoint& cell) const
+{
+    return QRectF(cell.x() * m_cellSize - 180, cell.y() * m_cellSize - 90, m_cellSize, m_cellSize);
+}
+
+/*! Checks whether \a cell holds features.
+  */
+bool MPCellStore::contains(const QPoint& cell) const
+{
+    return m_open && QFile::exists(cellFileName(cell));
+}
+
+/*! Reads the features of \a cell.
+  */
+QList<MPFeatureRecord> MPCellStore::read(const QPoint& cell) const
+{
+    QList<MPFeatureRecord> records;
+    QFile file(cellFileName(cell));
+    if (!m_open || !file.open(QIODevice::ReadOnly))
+        return records;
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_4_6);
+    while (!in.atEnd()) {
+        MPFeatureRecord record;
+        in >> record;
+        if (in.status() != QDataStream::Ok) {
+            qWarning("Truncated cell %s", qPrintable(file.fileName()));
+            break;
+        }
+        records << record;
+    }
+    return records;
+}
+
+/*! Adds \a record to the cells its bounding box intersects.
+  */
+void MPCellStore::write(const MPFeatureRecord& record)
+{
+    if (!m_open)
+        return;
+    QRectF box = record.boundingBox();
+    QList<QPoint> intersected = cells(CoordBox(Coord(box.left(), box.top()), Coord(box.right(), box.bottom())));
+    foreach (QPoint cell, intersected) {
+        QDataStream out(&m_pending[cell], QIODevice::WriteOnly | QIODevice::Append);
+        out.setVersion(QDataStream::Qt_4_6);
+        out << record;
+    }
+    if (++m_pendingCount >= CELL_WRITE_BATCH)
+        flush();
+}
+
+/*! Appends the pending records to the cell files.
+  */
+void MPCellStore::flush()
+{
+    QHashIterator<QPoint, QByteArray> it(m_pending);
+    while (it.hasNext()) {
+        it.next();
+        QFile file(cellFileName(it.key()));
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Append) || file.write(it.value()) != it.value().size())
+            qWarning("Could not write cell %s", qPrintable(file.fileName()));
+    }
+    m_pending.clear();
+    m_pendingCount = 0;
+}
+
+/*! File of \a cell in the store directory.
+  */
+QString MPCellStore::cellFileName(const QPoint& cell) const
+{
+    return m_dir.filePath(QString("%1_%2.cell").arg(cell.x()).arg(cell.y()));
+}
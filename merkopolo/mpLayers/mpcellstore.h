@@ -0,0 +1,123 @@
+#ifndef MPCELLSTORE_H
+#define MPCELLSTORE_H
+
+#include <QDataStream>
+#include <QDir>
+#include <QHash>
+#include <QList>
+#include <QPair>
+#include <QPoint>
+#include <QPointF>
+#include <QRectF>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include "Coord.h"
+
+#define CELL_STORE_MAGIC 0x434c504d  // "MPLC"
+#define CELL_STORE_VERSION 1
+#define CELL_STORE_HEADER "store"
+#define CELL_SIZE 0.05
+#define CELL_WRITE_BATCH 4096
+
+class Feature;
+class Layer;
+class Node;
+class MPTagPool;
+
+
+/*! A feature stored in a cell store, with its geometry and tags. */
+struct MPFeatureRecord
+{
+    /*! Kinds of stored features */
+    enum Type {
+        NodeRecord,  /*!< a point, tagged */
+        WayRecord    /*!< a way, with the coordinates of its nodes */
+    };
+
+    MPFeatureRecord() : id(0), type(NodeRecord), closed(false), layer(0) {}
+
+    QRectF boundingBox() const;
+    Feature* createFeature(Layer* aLayer, MPTagPool* aPool = 0, QHash<qint64, Node*>* aNodes = 0) const;
+
+    /*! Identifier, unique in the store */
+    qint64 id;
+    /*! Kind of feature */
+    Type type;
+    /*! Whether the way is closed (its last node is the first one) */
+    bool closed;
+    /*! Longitudes and latitudes of the node or of the way nodes */
+    QVector<QPointF> coords;
+    /*! Identifiers of the node or of the way nodes, parallel to coords,
+      or empty if unknown (not stored in cell stores) */
+    QVector<qint64> nodeIds;
+    /*! Tags, as key and value pairs */
+    QList< QPair<QString, QString> > tags;
+    /*! Index of the layer in its source (not stored in cell stores) */
+    int layer;
+};
+
+QDataStream& operator<<(QDataStream& out, const MPFeatureRecord& record);
+QDataStream& operator>>(QDataStream& in, MPFeatureRecord& record);
+uint qHash(const QPoint& cell);
+
+
+/*! Features partitioned in cells, which can be read separately. */
+class MPCellSource
+{
+public:
+    virtual ~MPCellSource() {}
+
+    /*! Checks whether the source is opened */
+    virtual bool isOpen() const = 0;
+    /*! Names of the layers of the features (see MPFeatureRecord::layer) */
+    virtual QStringList layerNames() const = 0;
+    /*! Area of the features (longitudes and latitudes), null if unknown */
+    virtual QRectF extent() const { return QRectF(); }
+    /*! Cells intersecting \a box (longitudes and latitudes) */
+    virtual QList<QPoint> cells(const CoordBox& box) const = 0;
+    /*! Checks whether \a cell holds features */
+    virtual bool contains(const QPoint& cell) const = 0;
+    /*! Reads the features of \a cell. Must be callable from worker threads */
+    virtual QList<MPFeatureRecord> read(const QPoint& cell) const = 0;
+
+    static QList<QPoint> gridCells(const CoordBox& box, qreal cellSize);
+};
+
+
+class MPCellStore : public MPCellSource
+{
+public:
+    MPCellStore();
+    ~MPCellStore();
+
+    bool open(const QString& path);
+    bool create(const QString& path);
+    bool isOpen() const;
+    QStringList layerNames() const;
+
+    QList<QPoint> cells(const CoordBox& box) const;
+    QRectF cellBox(const QPoint& cell) const;
+    bool contains(const QPoint& cell) const;
+    QList<MPFeatureRecord> read(const QPoint& cell) const;
+
+    void write(const MPFeatureRecord& record);
+    void flush();
+
+protected:
+    QString cellFileName(const QPoint& cell) const;
+
+    /*! Directory of the cell files */
+    QDir m_dir;
+    /*! Whether the store is opened */
+    bool m_open;
+    /*! Size of the cells, in degrees */
+    qreal m_cellSize;
+    /*! Records written but not flushed yet, by cell */
+    QHash<QPoint, QByteArray> m_pending;
+    /*! Number of records in m_pending */
+    int m_pendingCount;
+};
+
+#endif // MPCELLSTORE_H
@@ -2,22 +2,56 @@
 
 #include "MerkaartorPreferences.h"
 #include "IPaintStyle.h"
+#include "Layer.h"
+#include "Feature.h"
+#include "DrawingLayer.h"
+#include "Way.h"
+
+#include "mplodcache.h"
+#include "mpspatialindex.h"
 
 
 /*!
   \class MPDocument
   \brief A custom document to control instantiation of feature painters (MPFeaturePainter).
+
+  It also maintains a spatial index (MPSpatialIndex) of each layer, for
+  hit-testing and viewport queries. Code editing features must notify the
+  document with featureAdded(), featureRemoved() and featureChanged(),
+  for the nodes of the ways too : an index built from a layer holds them.
+
+  Tags of the features created by the application are pooled in the
+  document (see tagPool()).
+
+  Long ways are simplified for zoomed out views (see lod()). Simplified
+  ways are kept in an unnamed readonly layer of the document, which is
+  neither shown in the layer switcher nor snapped to.
  */
 
 /*! Constructs a document.
   This will instantiate as much painters as there are in map style.
   */
 MPDocument::MPDocument() :
-    Document()
+    Document(),
+    m_matcher(&m_tagPool)
 {
     for (int i=0; i<M_STYLE->painterSize(); ++i) {
         m_painters.append(MPFeaturePainter(*M_STYLE->getPainter(i)));
     }
+    m_matcher.compile(m_painters);
+
+    DrawingLayer* lodLayer = new DrawingLayer("");
+    lodLayer->setReadonly(true);
+    add(lodLayer);
+    m_lod = new MPLodCache(lodLayer);
+}
+
+/*! Destroys the document and its spatial indexes.
+  */
+MPDocument::~MPDocument()
+{
+    delete m_lod;
+    qDeleteAll(m_indexes);
 }
 
 /*! Replaces the painters with the specified ones. Used to refresh style.
@@ -30,6 +64,7 @@ void MPDocument::setPainters(QList<Painter> aPainters)
         MPFeaturePainter fp(aPainters[i]);
         m_painters.append(fp);
     }
+    m_matcher.compile(m_painters);
 }
 
 /*! Overriden method to get rid of private parts from parent class Document.
@@ -46,15 +81,98 @@ const Painter* MPDocument::getPainter(int i)
     return &m_painters[i];
 }
 
+/*! First painter matching the tags of the specified feature at
+  the specified zoom, or 0 if the feature is not styled.
+  \see MPStyleMatcher
+  */
+const Painter* MPDocument::findPainter(Feature* aFeature, qreal pixelPerM)
+{
+    return m_matcher.find(aFeature, pixelPerM);
+}
+
 /*! Overrides Document::moveLayer(Layer*, int) in order
-  to set the level of the specified layer.
+  to set the level of the specified layer (see zOrder()).
   */
 void MPDocument::moveLayer(Layer *aLayer, int pos)
 {
-    for(int i=0; i<aLayer->size(); ++i) {
-        Feature* f = aLayer->get(i);
-        // This tag is used in Way::updateMeta()
-        f->setTag("layer", QString("%1").arg(pos));
-    }
+    m_zOrders.insert(aLayer, pos);
     Document::moveLayer(aLayer, pos);
 }
+
+/*! Drawing level of the specified layer : its last position given
+  to moveLayer(), or 0 if it was never moved.
+
+  Layers are drawn by increasing level, then in document order. This is
+  the order the "layer" tag gave when it was set on every feature.
+  */
+int MPDocument::zOrder(Layer* aLayer) const
+{
+    return m_zOrders.value(aLayer, 0);
+}
+
+/*! Pool of the tag keys and values of the features.
+  \see MPFeatureRecord::createFeature()
+  */
+MPTagPool* MPDocument::tagPool()
+{
+    return &m_tagPool;
+}
+
+/*! Simplified versions of the long ways of the document.
+  */
+MPLodCache* MPDocument::lod()
+{
+    return m_lod;
+}
+
+/*! Layer of the simplified ways, which is not to be drawn as is.
+  */
+Layer* MPDocument::lodLayer() const
+{
+    return m_lod->layer();
+}
+
+/*! Spatial index of the specified layer. It is bulk loaded on first use,
+  and then kept up to date incrementally.
+  */
+MPSpatialIndex* MPDocument::spatialIndex(Layer* aLayer)
+{
+    MPSpatialIndex* index = m_indexes.value(aLayer);
+    if (!index) {
+        index = new MPSpatialIndex();
+        index->build(aLayer);
+        m_indexes.insert(aLayer, index);
+    }
+    return index;
+}
+
+/*! Notifies that a feature was added to one of the document layers.
+  */
+void MPDocument::featureAdded(Feature* aFeature)
+{
+    MPSpatialIndex* index = m_indexes.value(aFeature->layer());
+    if (index)
+        index->insert(aFeature);
+}
+
+/*! Notifies that a feature is about to be removed from its layer.
+  */
+void MPDocument::featureRemoved(Feature* aFeature)
+{
+    MPSpatialIndex* index = m_indexes.value(aFeature->layer());
+    if (index)
+        index->remove(aFeature);
+    if (Way* way = dynamic_cast<Way*>(aFeature))
+        m_lod->remove(way);
+}
+
+/*! Notifies that the geometry of a feature changed.
+  */
+void MPDocument::featureChanged(Feature* aFeature)
+{
+    MPSpatialIndex* index = m_indexes.value(aFeature->layer());
+    if (index)
+        index->update(aFeature);
+    if (Way* way = dynamic_cast<Way*>(aFeature))
+        m_lod->remove(way);
+}
@@ -1,22 +1,50 @@
 #ifndef MPDOCUMENT_H
 #define MPDOCUMENT_H
 
+#include <QHash>
+
 #include "Document.h"
 
 #include "mpfeaturepainter.h"
+#include "mpstylematcher.h"
+#include "mptagpool.h"
+
+class MPLodCache;
+class MPSpatialIndex;
 
 class MPDocument : public Document
 {
 public:
     MPDocument();
+    ~MPDocument();
     void setPainters(QList<Painter>);
     int getPaintersSize();
     const Painter* getPainter(int);
+    const Painter* findPainter(Feature*, qreal pixelPerM);
     void moveLayer(Layer*, int);
+    int zOrder(Layer*) const;
+    MPTagPool* tagPool();
+    MPLodCache* lod();
+    Layer* lodLayer() const;
+
+    MPSpatialIndex* spatialIndex(Layer*);
+    void featureAdded(Feature*);
+    void featureRemoved(Feature*);
+    void featureChanged(Feature*);
 
 protected:
     /*! Protected list of painters (like private list in parent class). */
     QList<MPFeaturePainter> m_painters;
+    /*! Tag keys and values of the features, shared by them (declared before m_matcher) */
+    MPTagPool m_tagPool;
+    /*! Compiled selectors of m_painters */
+    MPStyleMatcher m_matcher;
+    /*! Spatial index of each layer, built on first use */
+    QHash<Layer*, MPSpatialIndex*> m_indexes;
+    /*! Drawing level of the moved layers */
+    QHash<Layer*, int> m_zOrders;
+    /*! Simplified ways drawn when zoomed out, in their own hidden layer */
+    MPLodCache* m_lod;
 };
 
 #endif // MPDOCUMENT_H
@@ -0,0 +1,354 @@
+#include "mpfeaturesource.h"
+
+#include <qmath.h>
+#include <QtConcurrentRun>
+#include <QDesktopServices>
+#include <QDir>
+#include <QFileInfo>
+#include <QMultiMap>
+
+#include "DrawingLayer.h"
+#include "Node.h"
+#include "Way.h"
+
+#include "mpdocument.h"
+#include "mpsnapshot.h"
+
+/*!
+  \class MPFeatureSource
+  \brief Loads the features of a cell store or a snapshot around the viewport.
+
+  The features of the cells intersecting the viewport, plus
+  CELL_LOAD_MARGIN cells around, are loaded in the layers of the document
+  (a layer for a cell store, the saved layers for a snapshot).
+  Cells further than CELL_KEEP_MARGIN cells are evicted, so that the
+  memory stays bounded whatever the size of the store.
+
+  Cells are read from the store in a worker thread, one at a time and the
+  nearest to the viewport center first. Features are built in the GUI
+  thread, and shared by all the loaded cells they are stored in.
+
+  When more than CELL_MAX_LOADED cells would be needed (zoomed out too
+  much), nothing is loaded.
+
+  Cells of the viewport predicted while panning (see prefetch()) are
+  loaded once those of the viewport are, within CELL_MAX_LOADED cells.
+*/
+
+/*! \fn void MPFeatureSource::progress(int done, int total)
+  This signal is emitted when cells are queued or loaded: \a done
+  of the \a total cells requested by the last viewport are loaded.
+  */
+/*! \fn void MPFeatureSource::loaded()
+  This signal is emitted when features were added or removed.
+  */
+/*! \fn void MPFeatureSource::aboutToRemoveFeatures()
+  This signal is emitted before features are removed from the layer and
+  deleted : threads using them (rendering, snapping) must be stopped.
+  */
+
+/*! Distance between two cells, in cells.
+  */
+static int cellDistance(const QPoint& a, const QPoint& b)
+{
+    return qMax(qAbs(a.x() - b.x()), qAbs(a.y() - b.y()));
+}
+
+/*! Constructs a source of features for \a aDocument.
+  */
+MPFeatureSource::MPFeatureSource(MPDocument* aDocument, QObject* parent) :
+    QObject(parent),
+    m_document(aDocument),
+    m_store(0),
+    m_queueTotal(0)
+{
+    m_watcher = new QFutureWatcher< QList<MPFeatureRecord> >(this);
+    connect(m_watcher, SIGNAL(finished()), this, SLOT(onCellRead()));
+}
+
+/*! Destroys the source. Loaded features stay in the document.
+  */
+MPFeatureSource::~MPFeatureSource()
+{
+    m_watcher->waitForFinished();
+    delete m_store;
+}
+
+/*! Opens \a path, the directory of a cell store or a snapshot file
+  (see MPSnapshot), and adds the layers of its features to the document.
+  The source can only be opened once.
+  */
+bool MPFeatureSource::open(const QString& path)
+{
+    if (m_store)
+        return false;
+
+    if (QFileInfo(path).isDir()) {
+        MPCellStore* store = new MPCellStore();
+        if (store->open(path))
+            m_store = store;
+        else
+            delete store;
+    }
+    else {
+        MPSnapshot* snapshot = new MPSnapshot();
+        if (snapshot->open(path))
+            m_store = snapshot;
+        else
+            delete snapshot;
+    }
+    if (!m_store)
+        return false;
+
+    foreach (QString name, m_store->layerNames()) {
+        Layer* layer = new DrawingLayer(name);
+        m_document->add(layer);
+        m_layers << layer;
+    }
+    return true;
+}
+
+/*! Checks whether a store is opened.
+  */
+bool MPFeatureSource::isOpen() const
+{
+    return m_store && m_store->isOpen();
+}
+
+/*! Layers of the loaded features, empty if no store is opened.
+  */
+QList<Layer*> MPFeatureSource::layers() const
+{
+    return m_layers;
+}
+
+/*! Area of the features of the store, null if unknown.
+  */
+QRectF MPFeatureSource::extent() const
+{
+    return m_store ? m_store->extent() : QRectF();
+}
+
+/*! Number of loaded cells.
+  */
+int MPFeatureSource::loadedCells() const
+{
+    return m_cells.size();
+}
+
+/*! Number of cells still to load.
+  */
+int MPFeatureSource::pendingCells() const
+{
+    return m_queue.size() + (m_watcher->isRunning() ? 1 : 0);
+}
+
+/*! Default directory of the cell store, in the user data location.
+  */
+QString MPFeatureSource::defaultStorePath()
+{
+    return QDir(QDesktopServices::storageLocation(QDesktopServices::DataLocation)).filePath("cells");
+}
+
+/*! Largest width and height of a viewport whose cells, with
+  CELL_LOAD_MARGIN cells around, are at most CELL_MAX_LOADED : features
+  of larger viewports are not loaded (in degrees).
+  */
+qreal MPFeatureSource::maxViewportSize()
+{
+    // A viewport n cells wide may span n + 1 cells
+    int cells = qFloor(qSqrt(qreal(CELL_MAX_LOADED))) - 2 * CELL_LOAD_MARGIN - 1;
+    return qMax(1, cells) * CELL_SIZE;
+}
+
+/*! Sets the viewport, in longitudes and latitudes : evicts the cells
+  far from it, and loads the missing ones around it.
+  */
+void MPFeatureSource::setViewport(const CoordBox& box)
+{
+    if (!isOpen())
+        return;
+
+    QList<QPoint> visible = m_store->cells(box);
+    QRect area;
+    foreach (QPoint cell, visible)
+        area |= QRect(cell, cell);
+    QRect wanted = area.adjusted(-CELL_LOAD_MARGIN, -CELL_LOAD_MARGIN, CELL_LOAD_MARGIN, CELL_LOAD_MARGIN);
+    m_keep = area.adjusted(-CELL_KEEP_MARGIN, -CELL_KEEP_MARGIN, CELL_KEEP_MARGIN, CELL_KEEP_MARGIN);
+
+    bool changed = false;
+    foreach (QPoint cell, m_cells.keys()) {
+        if (!m_keep.contains(cell))
+            changed = evict(cell) || changed;
+    }
+
+    m_queue.clear();
+    m_prefetchQueue.clear();
+    if (wanted.width() * wanted.height() <= CELL_MAX_LOADED) {
+        QMultiMap<int, QPoint> queue;
+        for (int y=wanted.top(); y<=wanted.bottom(); ++y) {
+            for (int x=wanted.left(); x<=wanted.right(); ++x) {
+                QPoint cell(x, y);
+                if (m_cells.contains(cell) || (m_watcher->isRunning() && m_reading == cell))
+                    continue;
+                if (m_store->contains(cell))
+                    queue.insert(cellDistance(cell, area.center()), cell);
+            }
+        }
+        m_queue = queue.values();
+
+        // Cells kept in the margin may still exceed the budget
+        while (m_cells.size() + m_queue.size() > CELL_MAX_LOADED) {
+            QPoint farthest;
+            int distance = -1;
+            foreach (QPoint cell, m_cells.keys()) {
+                if (cellDistance(cell, area.center()) > distance) {
+                    distance = cellDistance(cell, area.center());
+                    farthest = cell;
+                }
+            }
+            if (distance <= CELL_LOAD_MARGIN)
+                break;
+            changed = evict(farthest) || changed;
+        }
+    }
+    m_queueTotal = m_queue.size();
+
+    if (changed)
+        emit loaded();
+    emit progress(0, m_queueTotal);
+    loadNext();
+}
+
+/*! Queues the cells of \a box, the viewport predicted in a near future,
+  after the cells of the viewport. They are kept until the prediction is
+  cleared, or the viewport is set.
+  */
+void MPFeatureSource::prefetch(const CoordBox& box)
+{
+    if (!isOpen())
+        return;
+
+    QList<QPoint> predicted = m_store->cells(box);
+    m_predicted = QRect();
+    m_prefetchQueue.clear();
+    if (predicted.size() > CELL_MAX_LOADED)
+        return;
+    foreach (QPoint cell, predicted)
+        m_predicted |= QRect(cell, cell);
+
+    QMultiMap<int, QPoint> queue;
+    foreach (QPoint cell, predicted) {
+        if (m_cells.contains(cell) || m_queue.contains(cell) || (m_watcher->isRunning() && m_reading == cell))
+            continue;
+        if (m_store->contains(cell))
+            queue.insert(cellDistance(cell, m_keep.center()), cell);
+    }
+    m_prefetchQueue = queue.values();
+    while (!m_prefetchQueue.isEmpty() && m_cells.size() + m_queue.size() + m_prefetchQueue.size() > CELL_MAX_LOADED)
+        m_prefetchQueue.removeLast();
+    loadNext();
+}
+
+/*! Removes the predicted viewport (panning stopped) : its cells not
+  loaded yet are not loaded anymore.
+  */
+void MPFeatureSource::clearPrediction()
+{
+    m_predicted = QRect();
+    m_prefetchQueue.clear();
+}
+
+/*! Starts reading the next queued cell, unless one is being read.
+  Cells of the predicted viewport come after the viewport ones.
+  */
+void MPFeatureSource::loadNext()
+{
+    if (m_watcher->isRunning() || (m_queue.isEmpty() && m_prefetchQueue.isEmpty()))
+        return;
+    m_reading = !m_queue.isEmpty() ? m_queue.takeFirst() : m_prefetchQueue.takeFirst();
+    m_watcher->setFuture(QtConcurrent::run(m_store, &MPCellSource::read, m_reading));
+}
+
+/*! When a cell is read : builds its features, unless the
+  viewport (or the predicted one) moved away meanwhile.
+  */
+void MPFeatureSource::onCellRead()
+{
+    QList<MPFeatureRecord> records = m_watcher->result();
+    if ((m_keep.contains(m_reading) || m_predicted.contains(m_reading)) && !m_cells.contains(m_reading)) {
+        QList<qint64>& ids = m_cells[m_reading];
+        foreach (const MPFeatureRecord& record, records) {
+            ids << record.id;
+            if (m_references[record.id]++ == 0)
+                build(record);
+        }
+        emit loaded();
+    }
+    emit progress(m_queueTotal - m_queue.size(), m_queueTotal);
+    loadNext();
+}
+
+/*! Adds the feature of \a record to the layer. The document is
+  notified of the feature and of its nodes.
+  */
+void MPFeatureSource::build(const MPFeatureRecord& record)
+{
+    Layer* layer = m_layers.value(record.layer);
+    Feature* feature = layer ? record.createFeature(layer, m_document->tagPool()) : 0;
+    if (!feature)
+        return;
+    if (Way* way = dynamic_cast<Way*>(feature)) {
+        for (int i=0; i<way->size(); ++i)
+            m_document->featureAdded(way->getNode(i));
+    }
+    m_document->featureAdded(feature);
+    m_features.insert(record.id, feature);
+}
+
+/*! Removes the features of \a cell which are not stored in another
+  loaded cell. Returns true if features were removed.
+  */
+bool MPFeatureSource::evict(const QPoint& cell)
+{
+    QList<qint64> removed;
+    foreach (qint64 id, m_cells.take(cell)) {
+        if (--m_references[id] == 0) {
+            m_references.remove(id);
+            removed << id;
+        }
+    }
+    if (removed.isEmpty())
+        return false;
+    emit aboutToRemoveFeatures();
+    foreach (qint64 id, removed)
+        removeFeature(id);
+    return true;
+}
+
+/*! Removes the feature \a id from the layer and deletes it,
+  with its nodes if it is a way. They are removed from the spatial
+  index first (see MPDocument::featureRemoved()).
+  */
+void MPFeatureSource::removeFeature(qint64 id)
+{
+    Feature* feature = m_features.take(id);
+    if (!feature)
+        return;
+
+    QList<Node*> nodes;
+    if (Way* way = dynamic_cast<Way*>(feature)) {
+        for (int i=0; i<way->size(); ++i)
+            if (!nodes.contains(way->getNode(i)))
+                nodes << way->getNode(i);
+    }
+    Layer* layer = feature->layer();
+    m_document->featureRemoved(feature);
+    layer->remove(feature);
+    delete feature;
+    foreach (Node* node, nodes) {
+        m_document->featureRemoved(node);
+        layer->remove(node);
+        delete node;
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef MPFEATURESOURCE_H
+#define MPFEATURESOURCE_H
+
+#include <QObject>
+#include <QFutureWatcher>
+#include <QHash>
+#include <QList>
+#include <QPoint>
+#include <QSet>
+
+#include "Coord.h"
+
+#include "mpcellstore.h"
+
+#define CELL_LOAD_MARGIN 1
+#define CELL_KEEP_MARGIN 3
+#define CELL_MAX_LOADED 64
+
+class Feature;
+class Layer;
+class MPDocument;
+
+
+class MPFeatureSource : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit MPFeatureSource(MPDocument* aDocument, QObject* parent = 0);
+    ~MPFeatureSource();
+
+    bool open(const QString& path);
+    bool isOpen() const;
+    QList<Layer*> layers() const;
+    QRectF extent() const;
+
+    void setViewport(const CoordBox& box);
+    void prefetch(const CoordBox& box);
+    void clearPrediction();
+    int loadedCells() const;
+    int pendingCells() const;
+
+    static QString defaultStorePath();
+    static qreal maxViewportSize();
+
+signals:
+    void progress(int done, int total);
+    void loaded();
+    void aboutToRemoveFeatures();
+
+protected slots:
+    void onCellRead();
+
+protected:
+    void loadNext();
+    void build(const MPFeatureRecord& record);
+    bool evict(const QPoint& cell);
+    void removeFeature(qint64 id);
+
+    /*! Document the features are added to */
+    MPDocument* m_document;
+    /*! Layers of the loaded features, owned by the document */
+    QList<Layer*> m_layers;
+    /*! Cell store or snapshot the features are read from, 0 if none */
+    MPCellSource* m_store;
+    /*! Reads cells in a worker thread */
+    QFutureWatcher< QList<MPFeatureRecord> >* m_watcher;
+    /*! Cell being read, if m_watcher is running */
+    QPoint m_reading;
+    /*! Cells wanted and not loaded yet, the nearest to the viewport center first */
+    QList<QPoint> m_queue;
+    /*! Number of cells to load since the last viewport change, for progress */
+    int m_queueTotal;
+    /*! Loaded cells, with the ids of their features */
+    QHash<QPoint, QList<qint64> > m_cells;
+    /*! Loaded features by id */
+    QHash<qint64, Feature*> m_features;
+    /*! Number of loaded cells each feature is stored in */
+    QHash<qint64, int> m_references;
+    /*! Cells in the viewport, with CELL_KEEP_MARGIN */
+    QRect m_keep;
+    /*! Cells of the predicted viewport, loaded after m_queue and kept too */
+    QRect m_predicted;
+    /*! Cells of the predicted viewport not loaded yet, the nearest first */
+    QList<QPoint> m_prefetchQueue;
+};
+
+#endif // MPFEATURESOURCE_H
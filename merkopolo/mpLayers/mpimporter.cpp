@@ -0,0 +1,585 @@
+#include "mpimporter.h"
+
+#include <QtAlgorithms>
+#include <QtConcurrentRun>
+#include <QFile>
+#include <QHash>
+#include <QMetaObject>
+#include <QSet>
+#include <QVariant>
+#include <QXmlStreamReader>
+
+#include <string.h>
+
+#include "Layer.h"
+#include "Node.h"
+#include "Way.h"
+
+#include "mpdocument.h"
+
+/*!
+  \class MPImporter
+  \brief Imports an OpenStreetMap (.osm) or GeoJSON file in a layer, without blocking.
+
+  The file is parsed in a worker thread, and features are sent to the GUI
+  thread by batches of IMPORT_BATCH_SIZE, as feature records
+  (MPFeatureRecord). A batch is added to the layer at once, so the view
+  never shows it partially.
+
+  The worker waits when IMPORT_BATCHES_AHEAD batches are not added yet,
+  and nothing but the current batch is kept : the memory stays close to
+  the size of the imported features. For OpenStreetMap files, node
+  coordinates are kept until the ways are read (MPNodeTable), and records
+  carry the node identifiers : the GUI thread creates a single node per
+  identifier, so ways keep their common nodes.
+
+  Relations are ignored, as well as GeoJSON multi-polygon holes.
+*/
+
+/*! \fn void MPImporter::progress(qint64 bytes, qint64 total)
+  This signal is emitted with each added batch : \a bytes of the
+  file, \a total bytes long, are processed.
+  */
+/*! \fn void MPImporter::imported()
+  This signal is emitted when features were added, at most every
+  IMPORT_REFRESH_INTERVAL milliseconds.
+  */
+/*! \fn void MPImporter::finished(const QString& error)
+  This signal is emitted when the import is done, with an \a error
+  message if the file could not be read entirely.
+  */
+
+
+/*! A pull parser of JSON values, reading a device by chunks. */
+class MPJsonReader
+{
+public:
+    explicit MPJsonReader(QIODevice* device) : m_device(device), m_pos(0), m_error(false) {}
+
+    /*! Whether the document is malformed */
+    bool hasError() const { return m_error; }
+
+    /*! Next non blank character, without consuming it (0 at end) */
+    char peek()
+    {
+        for (;;) {
+            if (m_pos >= m_buffer.size()) {
+                m_buffer = m_device->read(64*1024);
+                m_pos = 0;
+                if (m_buffer.isEmpty())
+                    return 0;
+            }
+            char c = m_buffer.at(m_pos);
+            if (c != ' ' && c != '\n' && c != '\r' && c != '\t')
+                return c;
+            ++m_pos;
+        }
+    }
+
+    /*! Consumes the next character, which must be \a c */
+    bool expect(char c)
+    {
+        if (peek() != c) {
+            m_error = true;
+            return false;
+        }
+        ++m_pos;
+        return true;
+    }
+
+    /*! Consumes \a c if it is the next character */
+    bool accept(char c)
+    {
+        if (peek() != c)
+            return false;
+        ++m_pos;
+        return true;
+    }
+
+    /*! Reads a value : objects are QVariantMap, arrays QVariantList */
+    QVariant readValue()
+    {
+        char c = peek();
+        if (c == '{') {
+            QVariantMap map;
+            ++m_pos;
+            if (accept('}'))
+                return map;
+            do {
+                QString key = readString();
+                if (!expect(':'))
+                    return QVariant();
+                map.insert(key, readValue());
+            } while (!m_error && accept(','));
+            expect('}');
+            return map;
+        }
+        if (c == '[') {
+            QVariantList list;
+            ++m_pos;
+            if (accept(']'))
+                return list;
+            do {
+                list << readValue();
+            } while (!m_error && accept(','));
+            expect(']');
+            return list;
+        }
+        if (c == '"')
+            return readString();
+        return readLiteral();
+    }
+
+    /*! Reads a string */
+    QString readString()
+    {
+        QString result;
+        QByteArray bytes;
+        if (!expect('"'))
+            return result;
+        for (;;) {
+            char c = next();
+            if (c == '"' || m_error)
+                break;
+            if (c != '\\') {
+                bytes += c;
+                continue;
+            }
+            result += QString::fromUtf8(bytes);
+            bytes.clear();
+            char e = next();
+            switch (e) {
+            case 'n': result += '\n'; break;
+            case 't': result += '\t'; break;
+            case 'r': result += '\r'; break;
+            case 'b': result += '\b'; break;
+            case 'f': result += '\f'; break;
+            case 'u': {
+                QByteArray hex;
+                for (int i=0; i<4; ++i)
+                    hex += next();
+                result += QChar(hex.toUShort(0, 16));
+                break;
+            }
+            default: result += QChar(e); break;
+            }
+        }
+        return result + QString::fromUtf8(bytes);
+    }
+
+protected:
+    /*! Consumes the next character, blank or not */
+    char next()
+    {
+        if (m_pos >= m_buffer.size()) {
+            m_buffer = m_device->read(64*1024);
+            m_pos = 0;
+            if (m_buffer.isEmpty()) {
+                m_error = true;
+                return 0;
+            }
+        }
+        return m_buffer.at(m_pos++);
+    }
+
+    /*! Reads a number, true, false or null */
+    QVariant readLiteral()
+    {
+        QByteArray token;
+        peek();
+        for (char c = peekRaw(); c && strchr("+-.0123456789eEtruefalsn", c); c = peekRaw()) {
+            token += c;
+            ++m_pos;
+        }
+        if (token == "true")
+            return true;
+        if (token == "false")
+            return false;
+        if (token == "null")
+            return QVariant();
+        bool ok;
+        double value = token.toDouble(&ok);
+        if (!ok)
+            m_error = true;
+        return value;
+    }
+
+    /*! Next character, blank or not, without consuming it (0 at end) */
+    char peekRaw()
+    {
+        if (m_pos >= m_buffer.size()) {
+            m_buffer = m_device->read(64*1024);
+            m_pos = 0;
+            if (m_buffer.isEmpty())
+                return 0;
+        }
+        return m_buffer.at(m_pos);
+    }
+
+    /*! Read device */
+    QIODevice* m_device;
+    /*! Current chunk */
+    QByteArray m_buffer;
+    /*! Position in m_buffer */
+    int m_pos;
+    /*! Whether the document is malformed */
+    bool m_error;
+};
+
+
+/*! Coordinates of the nodes of an OpenStreetMap file, by identifier.
+  Files are usually sorted by identifier : nodes are then appended to
+  arrays, and found by binary search, which takes much less memory than a
+  hash. Only the nodes out of order are kept in a hash. */
+class MPNodeTable
+{
+public:
+    /*! Adds the node \a id, at \a position */
+    void insert(qint64 id, const QPointF& position)
+    {
+        if (m_ids.isEmpty() || id > m_ids.last()) {
+            m_ids << id;
+            m_positions << position;
+        }
+        else {
+            m_unsorted.insert(id, position);
+        }
+    }
+
+    /*! Sets \a position to the one of the node \a id. Returns false if it is unknown */
+    bool find(qint64 id, QPointF& position) const
+    {
+        QVector<qint64>::const_iterator it = qBinaryFind(m_ids.constBegin(), m_ids.constEnd(), id);
+        if (it != m_ids.constEnd()) {
+            position = m_positions.at(it - m_ids.constBegin());
+            return true;
+        }
+        QHash<qint64, QPointF>::const_iterator h = m_unsorted.constFind(id);
+        if (h == m_unsorted.constEnd())
+            return false;
+        position = h.value();
+        return true;
+    }
+
+protected:
+    /*! Identifiers of the nodes read in order, increasing */
+    QVector<qint64> m_ids;
+    /*! Positions of the nodes of m_ids */
+    QVector<QPointF> m_positions;
+    /*! Positions of the nodes read out of order */
+    QHash<qint64, QPointF> m_unsorted;
+};
+
+
+/*! Constructs an importer adding features to \a aLayer of \a aDocument.
+  */
+MPImporter::MPImporter(MPDocument* aDocument, Layer* aLayer, QObject* parent) :
+    QObject(parent),
+    m_document(aDocument),
+    m_layer(aLayer),
+    m_total(0),
+    m_ahead(IMPORT_BATCHES_AHEAD),
+    m_cancelled(0)
+{
+    qRegisterMetaType< QList<MPFeatureRecord> >("QList<MPFeatureRecord>");
+    m_watcher = new QFutureWatcher<void>(this);
+    connect(m_watcher, SIGNAL(finished()), this, SLOT(onFinished()));
+}
+
+/*! Destroys the importer, cancelling the import.
+  */
+MPImporter::~MPImporter()
+{
+    cancel();
+}
+
+/*! Starts importing the specified file. Returns false if it
+  cannot be read, or if an import is running.
+  */
+bool MPImporter::start(const QString& fileName)
+{
+    QFile file(fileName);
+    if (isRunning() || !file.open(QIODevice::ReadOnly))
+        return false;
+    m_total = file.size();
+    m_cancelled.fetchAndStoreOrdered(0);
+    m_nodes.clear();
+    m_ahead.tryAcquire(m_ahead.available());
+    m_ahead.release(IMPORT_BATCHES_AHEAD);
+    m_error.clear();
+    m_refresh.start();
+    m_watcher->setFuture(QtConcurrent::run(this, &MPImporter::parse, fileName));
+    return true;
+}
+
+/*! Stops the import. Features already added stay in the layer.
+  */
+void MPImporter::cancel()
+{
+    m_cancelled.fetchAndStoreOrdered(1);
+    // Wake the worker if it waits for a batch to be added
+    m_ahead.release(IMPORT_BATCHES_AHEAD);
+    m_watcher->waitForFinished();
+}
+
+/*! Checks whether an import is running.
+  */
+bool MPImporter::isRunning() const
+{
+    return m_watcher->isRunning();
+}
+
+/*! Checks whether cancel() was called. Callable from the worker.
+  */
+bool MPImporter::isCancelled()
+{
+    return m_cancelled.fetchAndAddOrdered(0) != 0;
+}
+
+/*! Parses the file in the worker thread, according to its extension.
+  */
+void MPImporter::parse(const QString& fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        m_error = file.errorString();
+        return;
+    }
+    bool json = fileName.endsWith(".json", Qt::CaseInsensitive) || fileName.endsWith(".geojson", Qt::CaseInsensitive);
+    bool ok = json ? parseGeoJson(&file) : parseOsm(&file);
+    if (!ok && m_error.isEmpty())
+        m_error = tr("Could not read %1").arg(fileName);
+    sendBatch(&file);
+}
+
+/*! Parses an OpenStreetMap XML file. Ways are sent with the
+  coordinates and identifiers of their nodes, nodes only if tagged.
+  */
+bool MPImporter::parseOsm(QIODevice* device)
+{
+    QXmlStreamReader xml(device);
+    MPNodeTable nodes;
+    MPFeatureRecord record;
+    bool inFeature = false;
+
+    while (!xml.atEnd() && !isCancelled()) {
+        xml.readNext();
+        if (xml.isStartElement()) {
+            QStringRef name = xml.name();
+            QXmlStreamAttributes attributes = xml.attributes();
+            if (name == "node" || name == "way") {
+                record = MPFeatureRecord();
+                qint64 id = attributes.value("id").toString().toLongLong();
+                // Nodes and ways have separate ids
+                record.id = id * 2 + (name == "way" ? 1 : 0);
+                record.type = name == "way" ? MPFeatureRecord::WayRecord : MPFeatureRecord::NodeRecord;
+                if (name == "node") {
+                    QPointF position(attributes.value("lon").toString().toDouble(),
+                                     attributes.value("lat").toString().toDouble());
+                    nodes.insert(id, position);
+                    record.coords << position;
+                    record.nodeIds << id;
+                }
+                inFeature = true;
+            }
+            else if (name == "nd" && inFeature) {
+                qint64 ref = attributes.value("ref").toString().toLongLong();
+                QPointF position;
+                if (nodes.find(ref, position)) {
+                    record.coords << position;
+                    record.nodeIds << ref;
+                }
+            }
+            else if (name == "tag" && inFeature) {
+                record.tags << qMakePair(attributes.value("k").toString(), attributes.value("v").toString());
+            }
+        }
+        else if (xml.isEndElement() && inFeature && (xml.name() == "node" || xml.name() == "way")) {
+            inFeature = false;
+            if (record.type == MPFeatureRecord::WayRecord && record.coords.size() > 2 &&
+                record.coords.first() == record.coords.last()) {
+                record.coords.pop_back();
+                record.nodeIds.pop_back();
+                record.closed = true;
+            }
+            if (record.type == MPFeatureRecord::WayRecord ? record.coords.size() > 1 : !record.tags.isEmpty())
+                addRecord(record, device);
+        }
+    }
+    if (xml.hasError())
+        m_error = xml.errorString();
+    return !xml.hasError();
+}
+
+/*! Coordinates of a GeoJSON position list.
+  */
+static QVector<QPointF> jsonCoords(const QVariant& value)
+{
+    QVector<QPointF> coords;
+    foreach (QVariant position, value.toList()) {
+        QVariantList p = position.toList();
+        if (p.size() >= 2)
+            coords << QPointF(p[0].toDouble(), p[1].toDouble());
+    }
+    return coords;
+}
+
+/*! Parses a GeoJSON file : a feature collection, or a single feature.
+  Features of the collection are read one at a time.
+  */
+bool MPImporter::parseGeoJson(QIODevice* device)
+{
+    MPJsonReader json(device);
+    QVariantMap root;
+    qint64 count = 0;
+
+    if (!json.expect('{'))
+        return false;
+    if (!json.accept('}')) {
+        do {
+            QString key = json.readString();
+            if (!json.expect(':'))
+                return false;
+            if (key != "features") {
+                root.insert(key, json.readValue());
+                continue;
+            }
+            // The features array is streamed
+            if (!json.expect('['))
+                return false;
+            if (json.accept(']'))
+                continue;
+            do {
+                addGeoJsonFeature(json.readValue().toMap(), count, device);
+            } while (!json.hasError() && !isCancelled() && json.accept(','));
+            json.expect(']');
+        } while (!json.hasError() && !isCancelled() && json.accept(','));
+    }
+    if (isCancelled())
+        return true;
+    if (json.hasError() || !json.expect('}'))
+        return false;
+
+    if (root.value("type").toString() == "Feature")
+        addGeoJsonFeature(root, count, device);
+    return true;
+}
+
+/*! Adds the records of a GeoJSON \a feature. Multi geometries are split,
+  and polygons keep their outer ring. \a count numbers the records.
+  */
+void MPImporter::addGeoJsonFeature(const QVariantMap& feature, qint64& count, QIODevice* device)
+{
+    QVariantMap geometry = feature.value("geometry").toMap();
+    QString type = geometry.value("type").toString();
+    QVariant coordinates = geometry.value("coordinates");
+
+    QList< QPair<QString, QString> > tags;
+    QMapIterator<QString, QVariant> it(feature.value("properties").toMap());
+    while (it.hasNext()) {
+        it.next();
+        if (!it.value().isNull())
+            tags << qMakePair(it.key(), it.value().toString());
+    }
+
+    QVariantList parts;
+    if (type.startsWith("Multi")) {
+        parts = coordinates.toList();
+        type = type.mid(5);
+    }
+    else {
+        parts << coordinates;
+    }
+    foreach (QVariant part, parts) {
+        MPFeatureRecord record;
+        record.id = ++count;
+        record.tags = tags;
+        if (type == "Point") {
+            record.coords = jsonCoords(QVariantList() << part);
+        }
+        else if (type == "LineString" || type == "Polygon") {
+            record.type = MPFeatureRecord::WayRecord;
+            record.coords = jsonCoords(type == "Polygon" ? part.toList().value(0) : part);
+            if (type == "Polygon" && record.coords.size() > 2 && record.coords.first() == record.coords.last()) {
+                record.coords.pop_back();
+                record.closed = true;
+            }
+            if (record.coords.size() < 2)
+                continue;
+        }
+        if (!record.coords.isEmpty())
+            addRecord(record, device);
+    }
+}
+
+/*! Adds \a record to the current batch, which is sent when full.
+  */
+void MPImporter::addRecord(const MPFeatureRecord& record, QIODevice* device)
+{
+    m_batch << record;
+    if (m_batch.size() >= IMPORT_BATCH_SIZE)
+        sendBatch(device);
+}
+
+/*! Sends the current batch to the GUI thread, waiting if
+  IMPORT_BATCHES_AHEAD batches are not added yet.
+  */
+void MPImporter::sendBatch(QIODevice* device)
+{
+    if (m_batch.isEmpty() || isCancelled())
+        return;
+    m_ahead.acquire();
+    if (isCancelled())
+        return;
+    QMetaObject::invokeMethod(this, "onBatch", Qt::QueuedConnection,
+                              Q_ARG(QList<MPFeatureRecord>, m_batch), Q_ARG(qint64, device->pos()));
+    m_batch.clear();
+}
+
+/*! Adds the features of a batch to the layer, \a bytes of the file being processed.
+  Nodes already added by a previous record are reused.
+  */
+void MPImporter::onBatch(const QList<MPFeatureRecord>& records, qint64 bytes)
+{
+    if (isCancelled())
+        return;
+    m_ahead.release();
+    foreach (const MPFeatureRecord& record, records) {
+        QSet<qint64> added;
+        for (int i=0; i<record.nodeIds.size(); ++i)
+            if (!m_nodes.contains(record.nodeIds[i]))
+                added.insert(record.nodeIds[i]);
+        Feature* feature = record.createFeature(m_layer, m_document->tagPool(), &m_nodes);
+        if (!feature)
+            continue;
+        if (Way* way = dynamic_cast<Way*>(feature)) {
+            if (record.nodeIds.isEmpty()) {
+                for (int i=0; i<way->size(); ++i)
+                    m_document->featureAdded(way->getNode(i));
+            }
+            else {
+                foreach (qint64 id, added)
+                    m_document->featureAdded(m_nodes.value(id));
+            }
+            m_document->featureAdded(feature);
+        }
+        else if (record.nodeIds.isEmpty() || !added.isEmpty()) {
+            m_document->featureAdded(feature);
+        }
+    }
+    emit progress(bytes, m_total);
+    if (m_refresh.elapsed() >= IMPORT_REFRESH_INTERVAL) {
+        m_refresh.restart();
+        emit imported();
+    }
+}
+
+/*! When the worker is done. Batches it sent are queued before.
+  */
+void MPImporter::onFinished()
+{
+    m_nodes.clear();
+    emit progress(m_total, m_total);
+    emit imported();
+    emit finished(m_error);
+}
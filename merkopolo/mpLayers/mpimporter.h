@@ -0,0 +1,81 @@
+#ifndef MPIMPORTER_H
+#define MPIMPORTER_H
+
+#include <QObject>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QHash>
+#include <QList>
+#include <QMetaType>
+#include <QSemaphore>
+#include <QString>
+#include <QVariant>
+
+#include "mpcellstore.h"
+
+#define IMPORT_BATCH_SIZE 2000
+#define IMPORT_BATCHES_AHEAD 2
+#define IMPORT_REFRESH_INTERVAL 500
+
+class QIODevice;
+class Layer;
+class MPDocument;
+class Node;
+
+Q_DECLARE_METATYPE(QList<MPFeatureRecord>)
+
+
+class MPImporter : public QObject
+{
+    Q_OBJECT
+
+public:
+    MPImporter(MPDocument* aDocument, Layer* aLayer, QObject* parent = 0);
+    ~MPImporter();
+
+    bool start(const QString& fileName);
+    void cancel();
+    bool isRunning() const;
+
+signals:
+    void progress(qint64 bytes, qint64 total);
+    void imported();
+    void finished(const QString& error);
+
+protected slots:
+    void onBatch(const QList<MPFeatureRecord>& records, qint64 bytes);
+    void onFinished();
+
+protected:
+    bool isCancelled();
+    void parse(const QString& fileName);
+    bool parseOsm(QIODevice* device);
+    bool parseGeoJson(QIODevice* device);
+    void addGeoJsonFeature(const QVariantMap& feature, qint64& count, QIODevice* device);
+    void addRecord(const MPFeatureRecord& record, QIODevice* device);
+    void sendBatch(QIODevice* device);
+
+    /*! Document the features are added to */
+    MPDocument* m_document;
+    /*! Layer of the imported features, owned by the document */
+    Layer* m_layer;
+    /*! Runs parse() in a worker thread */
+    QFutureWatcher<void>* m_watcher;
+    /*! Size of the imported file */
+    qint64 m_total;
+    /*! Batches the worker may send before they are added (bounds memory) */
+    QSemaphore m_ahead;
+    /*! Set by cancel(), read by the worker */
+    QAtomicInt m_cancelled;
+    /*! Records parsed and not sent yet (worker) */
+    QList<MPFeatureRecord> m_batch;
+    /*! Parse error, set by the worker */
+    QString m_error;
+    /*! Nodes added by the import, by OpenStreetMap identifier (GUI thread) */
+    QHash<qint64, Node*> m_nodes;
+    /*! Since imported() was emitted last */
+    QElapsedTimer m_refresh;
+};
+
+#endif // MPIMPORTER_H
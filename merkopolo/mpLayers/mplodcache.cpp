@@ -0,0 +1,342 @@
+#include "mplodcache.h"
+
+#include <QtConcurrentRun>
+#include <QPair>
+#include <qmath.h>
+
+#include "Layer.h"
+#include "Node.h"
+#include "Way.h"
+
+/*!
+  \class MPLodCache
+  \brief Simplified versions of the long ways, drawn instead of them when zoomed out.
+
+  Ways of at least LOD_MIN_NODES nodes are simplified (Douglas-Peucker) at
+  levelCount() tolerances : LOD_BASE_TOLERANCE meters for level 1, and
+  LOD_LEVEL_FACTOR times more for each next level, which is computed from
+  the previous one, up to the scale of LOD_MAX_METERS_PER_PIXEL. A level
+  which keeps more than LOD_MIN_REDUCTION of the nodes of the previous one
+  is not stored, and no level is computed once a way is down to its
+  minimum nodes.
+
+  level() picks the level of a meters per pixel scale, so that the
+  simplification error stays below LOD_PIXEL_TOLERANCE pixels : a zoomed
+  out redraw then draws about as many vertices as a zoomed in one.
+
+  Levels are built lazily : proxy() queues the ways it does not know, and
+  they are simplified in a worker thread from a copy of their coordinates.
+  Simplified ways (proxies) are then created in the GUI thread in the cache
+  layer, with the tags of their way, and built() is emitted.
+
+  Proxies are deleted with their way (remove()) : like the way itself,
+  they must not be in use by rendering threads then.
+*/
+
+/*! \fn void MPLodCache::built()
+  This signal is emitted when simplified ways were added.
+  */
+
+/*! Distance in meters from \a p to the segment [\a a, \a b].
+  */
+static qreal segmentDistance(const QPointF& p, const QPointF& a, const QPointF& b)
+{
+    QPointF ab = b - a;
+    QPointF ap = p - a;
+    qreal length = ab.x()*ab.x() + ab.y()*ab.y();
+    qreal t = 0;
+    if (length > 0)
+        t = qBound(qreal(0), (ap.x()*ab.x() + ap.y()*ab.y()) / length, qreal(1));
+    QPointF d = ap - t*ab;
+    return qSqrt(d.x()*d.x() + d.y()*d.y());
+}
+
+/*! Douglas-Peucker simplification of the points \a indices of \a points
+  at \a tolerance. Returns the kept indices, with the first and last ones.
+  */
+static QVector<int> douglasPeucker(const QVector<QPointF>& points, const QVector<int>& indices, qreal tolerance)
+{
+    int count = indices.size();
+    QVector<bool> keep(count, false);
+    keep[0] = keep[count-1] = true;
+
+    QList< QPair<int, int> > ranges;
+    ranges << qMakePair(0, count-1);
+    while (!ranges.isEmpty()) {
+        QPair<int, int> range = ranges.takeLast();
+        const QPointF& a = points[indices[range.first]];
+        const QPointF& b = points[indices[range.second]];
+        qreal farthest = tolerance;
+        int split = -1;
+        for (int i=range.first+1; i<range.second; ++i) {
+            qreal distance = segmentDistance(points[indices[i]], a, b);
+            if (distance > farthest) {
+                farthest = distance;
+                split = i;
+            }
+        }
+        if (split != -1) {
+            keep[split] = true;
+            ranges << qMakePair(range.first, split) << qMakePair(split, range.second);
+        }
+    }
+
+    QVector<int> kept;
+    for (int i=0; i<count; ++i)
+        if (keep[i])
+            kept << indices[i];
+    return kept;
+}
+
+/*! Constructs a cache adding the simplified ways to \a aLayer.
+  */
+MPLodCache::MPLodCache(Layer* aLayer) :
+    QObject(),
+    m_layer(aLayer)
+{
+    m_watcher = new QFutureWatcher< QList<MPLodResult> >(this);
+    connect(m_watcher, SIGNAL(finished()), this, SLOT(onBuilt()));
+}
+
+/*! Destroys the cache, waiting for the running simplifications.
+  Simplified ways are deleted with their layer.
+  */
+MPLodCache::~MPLodCache()
+{
+    cancel();
+}
+
+/*! Layer of the simplified ways.
+  */
+Layer* MPLodCache::layer() const
+{
+    return m_layer;
+}
+
+/*! Simplified version of \a aWay to draw at \a aLevel (see level()), or
+  of the nearest lower level stored. Returns 0 if the way is to be drawn
+  as is, or is not simplified yet : it is then queued.
+  */
+Way* MPLodCache::proxy(Way* aWay, int aLevel)
+{
+    if (aLevel <= 0 || aWay->size() < LOD_MIN_NODES)
+        return 0;
+
+    QHash<Way*, QVector<Way*> >::const_iterator it = m_proxies.constFind(aWay);
+    if (it == m_proxies.constEnd()) {
+        if (!m_pending.contains(aWay)) {
+            MPLodInput input;
+            input.way = aWay;
+            input.coords.reserve(aWay->size());
+            for (int i=0; i<aWay->size(); ++i)
+                input.coords << QPointF(aWay->getNode(i)->position());
+            m_queue << input;
+            m_pending.insert(aWay);
+            buildNext();
+        }
+        return 0;
+    }
+    for (int l=qMin(aLevel, levelCount()); l>0; --l) {
+        if (it.value().at(l))
+            return it.value().at(l);
+    }
+    return 0;
+}
+
+/*! Deletes the simplified versions of \a aWay, which is about to be
+  deleted or was changed.
+  */
+void MPLodCache::remove(Way* aWay)
+{
+    if (m_pending.remove(aWay)) {
+        for (int i=0; i<m_queue.size(); ++i) {
+            if (m_queue[i].way == aWay) {
+                m_queue.removeAt(i);
+                break;
+            }
+        }
+    }
+    removeProxies(m_proxies.take(aWay));
+}
+
+/*! Deletes all the simplified ways, and forgets the queued ones.
+  */
+void MPLodCache::clear()
+{
+    cancel();
+    m_queue.clear();
+    m_pending.clear();
+    foreach (const QVector<Way*>& proxies, m_proxies)
+        removeProxies(proxies);
+    m_proxies.clear();
+}
+
+/*! Waits for the running simplification. Its results are dropped
+  if their ways were removed meanwhile.
+  */
+void MPLodCache::cancel()
+{
+    m_watcher->waitForFinished();
+}
+
+/*! Number of simplified ways.
+  */
+int MPLodCache::size() const
+{
+    return m_proxies.size();
+}
+
+/*! Number of levels : the coarsest one is drawn at LOD_MAX_METERS_PER_PIXEL.
+  */
+int MPLodCache::levelCount()
+{
+    static int count = 0;
+    if (!count) {
+        count = 1;
+        while (tolerance(count) < LOD_MAX_METERS_PER_PIXEL * LOD_PIXEL_TOLERANCE)
+            ++count;
+    }
+    return count;
+}
+
+/*! Level to draw at \a metersPerPixel : the highest one whose
+  tolerance is below LOD_PIXEL_TOLERANCE pixels, 0 for the ways as is.
+  */
+int MPLodCache::level(qreal metersPerPixel)
+{
+    for (int l=levelCount(); l>0; --l) {
+        if (tolerance(l) <= metersPerPixel * LOD_PIXEL_TOLERANCE)
+            return l;
+    }
+    return 0;
+}
+
+/*! Simplification tolerance of \a aLevel, in meters.
+  */
+qreal MPLodCache::tolerance(int aLevel)
+{
+    return LOD_BASE_TOLERANCE * qPow(LOD_LEVEL_FACTOR, aLevel - 1);
+}
+
+/*! Simplifies the way of \a input at each level. Coordinates are
+  measured in meters, in a local plane around the way.
+  */
+MPLodResult MPLodCache::simplify(const MPLodInput& input)
+{
+    MPLodResult result;
+    result.way = input.way;
+    int count = input.coords.size();
+    if (count < 3)
+        return result;
+
+    qreal latitude = 0;
+    foreach (QPointF p, input.coords)
+        latitude += p.y();
+    qreal kx = 111320 * qCos(latitude / count * M_PI / 180);
+    qreal ky = 110540;
+    QVector<QPointF> points(count);
+    QVector<int> current(count);
+    for (int i=0; i<count; ++i) {
+        points[i] = QPointF(input.coords[i].x() * kx, input.coords[i].y() * ky);
+        current[i] = i;
+    }
+
+    // Closed ways must keep at least three distinct nodes
+    bool closed = input.coords.first() == input.coords.last();
+    int minimum = closed ? 4 : 2;
+    for (int l=1; l<=levelCount(); ++l) {
+        if (current.size() <= minimum)
+            break;  // coarser levels would not draw fewer nodes
+        QVector<int> kept = douglasPeucker(points, current, tolerance(l));
+        if (kept.size() < minimum || kept.size() > current.size() * LOD_MIN_REDUCTION) {
+            result.levels << QVector<int>();
+            continue;
+        }
+        result.levels << kept;
+        current = kept;
+    }
+    return result;
+}
+
+/*! Simplifies \a inputs. Runs in a worker thread.
+  */
+QList<MPLodResult> MPLodCache::simplifyAll(const QList<MPLodInput>& inputs)
+{
+    QList<MPLodResult> results;
+    foreach (const MPLodInput& input, inputs)
+        results << simplify(input);
+    return results;
+}
+
+/*! Starts simplifying the queued ways, unless some are being simplified.
+  */
+void MPLodCache::buildNext()
+{
+    if (m_watcher->isRunning() || m_queue.isEmpty())
+        return;
+    QList<MPLodInput> inputs = m_queue;
+    m_queue.clear();
+    m_watcher->setFuture(QtConcurrent::run(&MPLodCache::simplifyAll, inputs));
+}
+
+/*! When ways are simplified : creates their proxies in the layer, with
+  nodes shared between the levels.
+  */
+void MPLodCache::onBuilt()
+{
+    QList<MPLodResult> results = m_watcher->result();
+    bool added = false;
+    foreach (const MPLodResult& result, results) {
+        Way* way = result.way;
+        if (!m_pending.remove(way))
+            continue;  // removed meanwhile
+
+        bool closed = way->size() > 1 && way->getNode(0) == way->getNode(way->size()-1);
+        QVector<Way*> proxies(levelCount() + 1, 0);
+        QHash<int, Node*> nodes;
+        for (int l=1; l<=result.levels.size(); ++l) {
+            const QVector<int>& kept = result.levels[l-1];
+            if (kept.isEmpty() || kept.last() >= way->size())
+                continue;
+            Way* proxy = new Way();
+            foreach (int i, kept) {
+                int key = (closed && i == way->size()-1) ? 0 : i;
+                Node*& node = nodes[key];
+                if (!node) {
+                    node = new Node(way->getNode(key)->position());
+                    m_layer->add(node);
+                }
+                proxy->add(node);
+            }
+            for (int i=0; i<way->tagSize(); ++i)
+                proxy->setTag(way->tagKey(i), way->tagValue(i));
+            m_layer->add(proxy);
+            proxies[l] = proxy;
+            added = true;
+        }
+        m_proxies.insert(way, proxies);
+    }
+    if (added)
+        emit built();
+    buildNext();
+}
+
+/*! Removes \a proxies from the layer and deletes them, with their nodes.
+  */
+void MPLodCache::removeProxies(const QVector<Way*>& proxies)
+{
+    QList<Node*> nodes;
+    foreach (Way* proxy, proxies) {
+        if (!proxy)
+            continue;
+        for (int i=0; i<proxy->size(); ++i)
+            if (!nodes.contains(proxy->getNode(i)))
+                nodes << proxy->getNode(i);
+        m_layer->remove(proxy);
+        delete proxy;
+    }
+    foreach (Node* node, nodes) {
+        m_layer->remove(node);
+        delete node;
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef MPLODCACHE_H
+#define MPLODCACHE_H
+
+#include <QObject>
+#include <QFutureWatcher>
+#include <QHash>
+#include <QList>
+#include <QPointF>
+#include <QSet>
+#include <QVector>
+
+#define LOD_MAX_METERS_PER_PIXEL 156543.0  // zoom level 0
+#define LOD_MIN_NODES 32
+#define LOD_BASE_TOLERANCE 2.0
+#define LOD_LEVEL_FACTOR 4.0
+#define LOD_PIXEL_TOLERANCE 0.5
+#define LOD_MIN_REDUCTION 0.75
+
+class Layer;
+class Way;
+
+
+/*! Geometry of a way to simplify, copied in the GUI thread. */
+struct MPLodInput
+{
+    /*! Simplified way (only a key for the worker) */
+    Way* way;
+    /*! Longitudes and latitudes of its nodes */
+    QVector<QPointF> coords;
+};
+
+/*! Simplified levels of a way, computed by a worker. */
+struct MPLodResult
+{
+    /*! Simplified way */
+    Way* way;
+    /*! Indices of the nodes kept at each level, empty if a level does not simplify enough */
+    QVector< QVector<int> > levels;
+};
+
+
+class MPLodCache : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit MPLodCache(Layer* aLayer);
+    ~MPLodCache();
+
+    Layer* layer() const;
+    Way* proxy(Way* aWay, int aLevel);
+    void remove(Way* aWay);
+    void clear();
+    void cancel();
+    int size() const;
+
+    static int levelCount();
+    static int level(qreal metersPerPixel);
+    static qreal tolerance(int aLevel);
+    static MPLodResult simplify(const MPLodInput& input);
+
+signals:
+    void built();
+
+protected slots:
+    void onBuilt();
+
+protected:
+    void buildNext();
+    void removeProxies(const QVector<Way*>& proxies);
+    static QList<MPLodResult> simplifyAll(const QList<MPLodInput>& inputs);
+
+    /*! Layer of the simplified ways, owned by the document */
+    Layer* m_layer;
+    /*! Simplified ways of each level (index 0 unused, 0 if not simplified), by original way */
+    QHash<Way*, QVector<Way*> > m_proxies;
+    /*! Ways waiting to be simplified */
+    QList<MPLodInput> m_queue;
+    /*! Ways queued or being simplified */
+    QSet<Way*> m_pending;
+    /*! Simplifies the queued ways in a worker thread */
+    QFutureWatcher< QList<MPLodResult> >* m_watcher;
+};
+
+#endif // MPLODCACHE_H
@@ -0,0 +1,451 @@
+#include "mpsnapshot.h"
+
+#include <string.h>
+
+#include <QFileInfo>
+#include <QHash>
+#include <QMap>
+#include <QObject>
+#include <QVector>
+
+#include "Layer.h"
+#include "Node.h"
+#include "Way.h"
+
+/*!
+  \class MPSnapshot
+  \brief A read-only, memory-mapped file of the features of some layers.
+
+  A snapshot is written once from the layers of an import (see write()),
+  and opened instead of parsing the imported file again : opening only
+  maps the file and checks its header, features are read cell by cell
+  when they come into view (see MPFeatureSource).
+
+  The file is a header (MPSnapshotHeader) followed by flat tables:
+  layers, features, non empty cells (sorted, with precomputed feature
+  references), coordinates as integers of 1e-7 degrees, tags as pairs of
+  string indices, and the interned strings as UTF-16. Tables are in the
+  byte order of the machine which wrote them : a snapshot of another byte
+  order, or of another SNAPSHOT_VERSION, is rejected by open() and the
+  source must be imported again.
+
+  Cells are the ones of a cell store (CELL_SIZE degrees), and a feature
+  is referenced by every cell its bounding box intersects. Features are
+  identified by their index in the file.
+
+  read() only reads the mapping, it can be called from worker threads.
+*/
+
+/*! Alignment of the tables in the file, in bytes.
+  */
+static const qint64 tableAlignment = 8;
+
+/*! Appends \a size bytes of \a data to \a file, aligned on
+  tableAlignment, and sets \a offset to where they start.
+  */
+static bool writeTable(QFile& file, const void* data, qint64 size, quint64& offset)
+{
+    static const char padding[tableAlignment] = {0};
+    qint64 pos = file.pos();
+    if (pos % tableAlignment) {
+        qint64 pad = tableAlignment - pos % tableAlignment;
+        if (file.write(padding, pad) != pad)
+            return false;
+        pos += pad;
+    }
+    offset = pos;
+    return size == 0 || file.write(static_cast<const char*>(data), size) == size;
+}
+
+/*! Checks whether a table of \a count items of \a size bytes at
+  \a offset is aligned and lies in a file of \a fileSize bytes.
+  */
+static bool tableFits(quint64 offset, quint64 count, quint64 size, quint64 fileSize)
+{
+    return offset % tableAlignment == 0 && offset <= fileSize &&
+           count <= (fileSize - offset) / size;
+}
+
+/*! Interned strings of a snapshot being written.
+  */
+struct MPSnapshotStrings
+{
+    /*! Index of \a s, added if it is a new string.
+      */
+    quint32 intern(const QString& s)
+    {
+        QHash<QString, quint32>::const_iterator it = ids.constFind(s);
+        if (it != ids.constEnd())
+            return it.value();
+        quint32 id = offsets.size();
+        ids.insert(s, id);
+        offsets << chars.size();
+        for (int i=0; i<s.size(); ++i)
+            chars << s.at(i).unicode();
+        return id;
+    }
+
+    /*! Index of each string */
+    QHash<QString, quint32> ids;
+    /*! Start of each string in chars */
+    QVector<quint32> offsets;
+    /*! Characters of all the strings */
+    QVector<ushort> chars;
+};
+
+/*! Constructs a closed snapshot.
+  */
+MPSnapshot::MPSnapshot() :
+    m_map(0)
+{
+}
+
+/*! Destroys the snapshot, unmapping its file.
+  */
+MPSnapshot::~MPSnapshot()
+{
+    close();
+}
+
+/*! Maps the snapshot file \a fileName. Returns false, with an error
+  string, if it is not a valid snapshot of this version.
+  */
+bool MPSnapshot::open(const QString& fileName)
+{
+    close();
+    m_file.setFileName(fileName);
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        m_error = m_file.errorString();
+        return false;
+    }
+    quint64 size = m_file.size();
+    if (size >= sizeof(MPSnapshotHeader))
+        m_map = m_file.map(0, size);
+    if (!m_map) {
+        m_error = QObject::tr("Not a snapshot");
+        close();
+        return false;
+    }
+
+    const MPSnapshotHeader* h = header();
+    if (h->magic != SNAPSHOT_MAGIC)
+        m_error = QObject::tr("Not a snapshot");
+    else if (h->version != SNAPSHOT_VERSION)
+        m_error = QObject::tr("Snapshot version %1, expected %2").arg(h->version).arg(SNAPSHOT_VERSION);
+    else if (h->fileSize != size)
+        m_error = QObject::tr("Truncated snapshot");
+    else if (!(h->cellSize > 0) ||
+             !tableFits(h->layers, h->layerCount, sizeof(MPSnapshotLayer), size) ||
+             !tableFits(h->features, h->featureCount, sizeof(MPSnapshotFeature), size) ||
+             !tableFits(h->cells, h->cellCount, sizeof(MPSnapshotCell), size) ||
+             !tableFits(h->refs, h->refCount, sizeof(quint32), size) ||
+             !tableFits(h->coords, h->coordCount, 2*sizeof(qint32), size) ||
+             !tableFits(h->tags, h->tagCount, 2*sizeof(quint32), size) ||
+             !tableFits(h->strings, quint64(h->stringCount) + 1, sizeof(quint32), size) ||
+             !tableFits(h->chars, h->charCount, sizeof(ushort), size))
+        m_error = QObject::tr("Corrupted snapshot");
+    else {
+        m_error.clear();
+        return true;
+    }
+    close();
+    return false;
+}
+
+/*! Unmaps and closes the snapshot file.
+  */
+void MPSnapshot::close()
+{
+    if (m_map)
+        m_file.unmap(const_cast<uchar*>(m_map));
+    m_map = 0;
+    m_file.close();
+}
+
+/*! Checks whether a snapshot is opened.
+  */
+bool MPSnapshot::isOpen() const
+{
+    return m_map != 0;
+}
+
+/*! Why the last open() failed.
+  */
+QString MPSnapshot::errorString() const
+{
+    return m_error;
+}
+
+/*! Names of the saved layers.
+  */
+QStringList MPSnapshot::layerNames() const
+{
+    QStringList names;
+    if (!m_map)
+        return names;
+    const MPSnapshotLayer* layers = reinterpret_cast<const MPSnapshotLayer*>(m_map + header()->layers);
+    for (quint32 i=0; i<header()->layerCount; ++i)
+        names << string(layers[i].name);
+    return names;
+}
+
+/*! Area of all the features, in longitudes and latitudes, computed
+  when the snapshot was written.
+  */
+QRectF MPSnapshot::extent() const
+{
+    if (!m_map || !header()->featureCount)
+        return QRectF();
+    const double* e = header()->extent;
+    return QRectF(QPointF(e[0], e[1]), QPointF(e[2], e[3]));
+}
+
+/*! Cells intersecting \a box (longitudes and latitudes).
+  */
+QList<QPoint> MPSnapshot::cells(const CoordBox& box) const
+{
+    if (!m_map)
+        return QList<QPoint>();
+    return gridCells(box, header()->cellSize);
+}
+
+/*! Checks whether \a cell holds features.
+  */
+bool MPSnapshot::contains(const QPoint& cell) const
+{
+    return findCell(cell) != 0;
+}
+
+/*! Reads the features of \a cell. Strings are shared between the
+  records of a call.
+  */
+QList<MPFeatureRecord> MPSnapshot::read(const QPoint& cell) const
+{
+    QList<MPFeatureRecord> records;
+    const MPSnapshotCell* entry = findCell(cell);
+    if (!entry)
+        return records;
+
+    const MPSnapshotHeader* h = header();
+    if (entry->first > h->refCount || entry->count > h->refCount - entry->first) {
+        qWarning("Corrupted cell %d,%d in %s", cell.x(), cell.y(), qPrintable(m_file.fileName()));
+        return records;
+    }
+    const quint32* refs = reinterpret_cast<const quint32*>(m_map + h->refs) + entry->first;
+    const MPSnapshotFeature* features = reinterpret_cast<const MPSnapshotFeature*>(m_map + h->features);
+    const qint32* coords = reinterpret_cast<const qint32*>(m_map + h->coords);
+    const quint32* tags = reinterpret_cast<const quint32*>(m_map + h->tags);
+
+    QHash<quint32, QString> strings;
+    for (quint32 i=0; i<entry->count; ++i) {
+        if (refs[i] >= h->featureCount)
+            continue;
+        const MPSnapshotFeature& f = features[refs[i]];
+        if (f.coords > h->coordCount || f.coordCount > h->coordCount - f.coords ||
+            f.tags > h->tagCount || f.tagCount > h->tagCount - f.tags || f.layer >= h->layerCount) {
+            qWarning("Corrupted feature %u in %s", refs[i], qPrintable(m_file.fileName()));
+            continue;
+        }
+
+        MPFeatureRecord record;
+        record.id = refs[i];
+        record.type = MPFeatureRecord::Type(f.type);
+        record.closed = f.closed;
+        record.layer = f.layer;
+        record.coords.resize(f.coordCount);
+        const qint32* c = coords + 2*f.coords;
+        for (quint32 j=0; j<f.coordCount; ++j)
+            record.coords[j] = QPointF(c[2*j] / SNAPSHOT_COORD_SCALE, c[2*j+1] / SNAPSHOT_COORD_SCALE);
+        const quint32* t = tags + 2*quint64(f.tags);
+        for (quint32 j=0; j<f.tagCount; ++j) {
+            for (int k=0; k<2; ++k)
+                if (!strings.contains(t[2*j+k]))
+                    strings.insert(t[2*j+k], string(t[2*j+k]));
+            record.tags << qMakePair(strings.value(t[2*j]), strings.value(t[2*j+1]));
+        }
+        records << record;
+    }
+    return records;
+}
+
+/*! Writes a snapshot of the features of \a layers to \a fileName : tagged
+  nodes, and ways. Deleted features are skipped. The file is written
+  aside and renamed when complete, so that it is never seen truncated.
+
+  The layers must not be modified while they are written.
+  */
+bool MPSnapshot::write(const QString& fileName, const QList<Layer*>& layers)
+{
+    MPSnapshotStrings strings;
+    QVector<MPSnapshotLayer> layerTable;
+    QVector<MPSnapshotFeature> featureTable;
+    QVector<qint32> coordTable;
+    QVector<quint32> tagTable;
+    QMap< QPair<int, int>, QVector<quint32> > cellTable;  // by row, then column
+    QRectF extent;
+
+    for (int i=0; i<layers.size() && i<=0xffff; ++i) {
+        MPSnapshotLayer l;
+        l.name = strings.intern(layers[i]->name());
+        l.reserved = 0;
+        layerTable << l;
+
+        for (int j=0; j<layers[i]->size(); ++j) {
+            Feature* feature = layers[i]->get(j);
+            Node* node = dynamic_cast<Node*>(feature);
+            Way* way = dynamic_cast<Way*>(feature);
+            if (feature->isDeleted() || (node && !feature->tagSize()) || (way && !way->size()) || (!node && !way))
+                continue;
+
+            MPSnapshotFeature f;
+            f.coords = coordTable.size() / 2;
+            f.tags = tagTable.size() / 2;
+            f.tagCount = qMin(feature->tagSize(), 0xffff);
+            f.layer = i;
+            f.type = node ? MPFeatureRecord::NodeRecord : MPFeatureRecord::WayRecord;
+            f.closed = way && way->size() > 3 && way->getNode(0) == way->getNode(way->size()-1);
+            f.reserved = 0;
+
+            // The repeated first node of closed ways is not stored
+            QVector<QPointF> points;
+            if (node)
+                points << QPointF(node->position());
+            else
+                for (int k=0; k<way->size() - (f.closed ? 1 : 0); ++k)
+                    points << QPointF(way->getNode(k)->position());
+            f.coordCount = points.size();
+            QRectF box(points[0], points[0]);
+            foreach (QPointF p, points) {
+                coordTable << qRound(p.x() * SNAPSHOT_COORD_SCALE) << qRound(p.y() * SNAPSHOT_COORD_SCALE);
+                box |= QRectF(p, p);
+            }
+            for (int k=0; k<f.tagCount; ++k)
+                tagTable << strings.intern(feature->tagKey(k)) << strings.intern(feature->tagValue(k));
+
+            QList<QPoint> cells = gridCells(CoordBox(Coord(box.left(), box.top()), Coord(box.right(), box.bottom())), CELL_SIZE);
+            foreach (QPoint cell, cells)
+                cellTable[qMakePair(cell.y(), cell.x())] << featureTable.size();
+            extent = featureTable.isEmpty() ? box : (extent | box);
+            featureTable << f;
+        }
+    }
+    quint32 stringCount = strings.offsets.size();
+    strings.offsets << strings.chars.size();
+
+    QVector<MPSnapshotCell> cellEntries;
+    QVector<quint32> refTable;
+    QMapIterator< QPair<int, int>, QVector<quint32> > it(cellTable);
+    while (it.hasNext()) {
+        it.next();
+        MPSnapshotCell c;
+        c.x = it.key().second;
+        c.y = it.key().first;
+        c.first = refTable.size();
+        c.count = it.value().size();
+        refTable += it.value();
+        cellEntries << c;
+    }
+
+    MPSnapshotHeader h;
+    memset(&h, 0, sizeof(h));
+    h.magic = SNAPSHOT_MAGIC;
+    h.version = SNAPSHOT_VERSION;
+    h.layerCount = layerTable.size();
+    h.featureCount = featureTable.size();
+    h.stringCount = stringCount;
+    h.cellCount = cellEntries.size();
+    h.refCount = refTable.size();
+    h.tagCount = tagTable.size() / 2;
+    h.coordCount = coordTable.size() / 2;
+    h.charCount = strings.chars.size();
+    h.cellSize = CELL_SIZE;
+    h.extent[0] = extent.left();
+    h.extent[1] = extent.top();
+    h.extent[2] = extent.right();
+    h.extent[3] = extent.bottom();
+
+    QString tempName = fileName + ".tmp";
+    QFile file(tempName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+    bool ok = file.write(reinterpret_cast<const char*>(&h), sizeof(h)) == qint64(sizeof(h)) &&
+              writeTable(file, layerTable.constData(), layerTable.size() * sizeof(MPSnapshotLayer), h.layers) &&
+              writeTable(file, featureTable.constData(), featureTable.size() * sizeof(MPSnapshotFeature), h.features) &&
+              writeTable(file, cellEntries.constData(), cellEntries.size() * sizeof(MPSnapshotCell), h.cells) &&
+              writeTable(file, coordTable.constData(), coordTable.size() * sizeof(qint32), h.coords) &&
+              writeTable(file, refTable.constData(), refTable.size() * sizeof(quint32), h.refs) &&
+              writeTable(file, tagTable.constData(), tagTable.size() * sizeof(quint32), h.tags) &&
+              writeTable(file, strings.offsets.constData(), strings.offsets.size() * sizeof(quint32), h.strings) &&
+              writeTable(file, strings.chars.constData(), strings.chars.size() * sizeof(ushort), h.chars);
+    if (ok) {
+        // Offsets are known now, the header is written again
+        h.fileSize = file.pos();
+        ok = file.seek(0) && file.write(reinterpret_cast<const char*>(&h), sizeof(h)) == qint64(sizeof(h));
+    }
+    file.close();
+    if (!ok || (QFile::exists(fileName) && !QFile::remove(fileName)) || !QFile::rename(tempName, fileName)) {
+        qWarning("Could not write snapshot %s", qPrintable(fileName));
+        QFile::remove(tempName);
+        return false;
+    }
+    return true;
+}
+
+/*! Name of the snapshot of the imported file \a sourceFileName.
+  */
+QString MPSnapshot::fileNameFor(const QString& sourceFileName)
+{
+    return sourceFileName + SNAPSHOT_EXTENSION;
+}
+
+/*! Checks whether the snapshot of \a sourceFileName exists
+  and is newer than it.
+  */
+bool MPSnapshot::isUpToDate(const QString& sourceFileName)
+{
+    QFileInfo snapshot(fileNameFor(sourceFileName));
+    return snapshot.exists() && snapshot.lastModified() >= QFileInfo(sourceFileName).lastModified();
+}
+
+/*! Header of the mapped file.
+  */
+const MPSnapshotHeader* MPSnapshot::header() const
+{
+    return reinterpret_cast<const MPSnapshotHeader*>(m_map);
+}
+
+/*! Entry of \a cell, 0 if it holds no feature. Entries are sorted
+  by row then column, and binary searched.
+  */
+const MPSnapshotCell* MPSnapshot::findCell(const QPoint& cell) const
+{
+    if (!m_map)
+        return 0;
+    const MPSnapshotCell* cells = reinterpret_cast<const MPSnapshotCell*>(m_map + header()->cells);
+    int low = 0, high = int(header()->cellCount) - 1;
+    while (low <= high) {
+        int middle = (low + high) / 2;
+        const MPSnapshotCell& c = cells[middle];
+        if (c.y < cell.y() || (c.y == cell.y() && c.x < cell.x()))
+            low = middle + 1;
+        else if (c.y == cell.y() && c.x == cell.x())
+            return &c;
+        else
+            high = middle - 1;
+    }
+    return 0;
+}
+
+/*! String \a index of the string table, empty if out of range.
+  */
+QString MPSnapshot::string(quint32 index) const
+{
+    const MPSnapshotHeader* h = header();
+    if (index >= h->stringCount)
+        return QString();
+    const quint32* offsets = reinterpret_cast<const quint32*>(m_map + h->strings);
+    quint32 begin = offsets[index], end = offsets[index+1];
+    if (begin > end || end > h->charCount)
+        return QString();
+    return QString::fromUtf16(reinterpret_cast<const ushort*>(m_map + h->chars) + begin, end - begin);
+}
@@ -0,0 +1,114 @@
+#ifndef MPSNAPSHOT_H
+#define MPSNAPSHOT_H
+
+#include <QFile>
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+#include "mpcellstore.h"
+
+#define SNAPSHOT_MAGIC 0x534e504d  // "MPNS"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_EXTENSION ".mps"
+#define SNAPSHOT_COORD_SCALE 10000000.0
+
+class Layer;
+
+
+/*! Header of a snapshot file. Offsets are from the file start. */
+struct MPSnapshotHeader
+{
+    /*! SNAPSHOT_MAGIC (stays first in all versions) */
+    quint32 magic;
+    /*! SNAPSHOT_VERSION (stays second in all versions) */
+    quint32 version;
+    /*! Number of layers, features, strings and non empty cells */
+    quint32 layerCount, featureCount, stringCount, cellCount;
+    /*! Number of feature references (in cells) and of tags */
+    quint32 refCount, tagCount;
+    /*! Number of coordinate pairs and of string characters */
+    quint64 coordCount, charCount;
+    /*! Size of the cells, in degrees */
+    double cellSize;
+    /*! Extent of the features : west, south, east, north */
+    double extent[4];
+    /*! Size of the complete file, to detect truncated files */
+    quint64 fileSize;
+    /*! Offsets of the tables */
+    quint64 layers, features, cells, refs, coords, tags, strings, chars;
+};
+
+/*! A layer in a snapshot file. */
+struct MPSnapshotLayer
+{
+    /*! Name (string index) */
+    quint32 name;
+    quint32 reserved;
+};
+
+/*! A feature in a snapshot file. */
+struct MPSnapshotFeature
+{
+    /*! Index of the first coordinate pair */
+    quint64 coords;
+    /*! Number of coordinate pairs */
+    quint32 coordCount;
+    /*! Index of the first tag */
+    quint32 tags;
+    /*! Number of tags */
+    quint16 tagCount;
+    /*! Index of the layer */
+    quint16 layer;
+    /*! MPFeatureRecord::Type */
+    quint8 type;
+    /*! Whether the way is closed */
+    quint8 closed;
+    quint16 reserved;
+};
+
+/*! A non empty cell in a snapshot file. Cells are sorted by row, then column. */
+struct MPSnapshotCell
+{
+    /*! Cell coordinates (see MPCellSource::gridCells()) */
+    qint32 x, y;
+    /*! Index of the first feature reference, and number of references */
+    quint32 first, count;
+};
+
+
+class MPSnapshot : public MPCellSource
+{
+public:
+    MPSnapshot();
+    ~MPSnapshot();
+
+    bool open(const QString& fileName);
+    void close();
+    bool isOpen() const;
+    QString errorString() const;
+
+    QStringList layerNames() const;
+    QRectF extent() const;
+    QList<QPoint> cells(const CoordBox& box) const;
+    bool contains(const QPoint& cell) const;
+    QList<MPFeatureRecord> read(const QPoint& cell) const;
+
+    static bool write(const QString& fileName, const QList<Layer*>& layers);
+    static QString fileNameFor(const QString& sourceFileName);
+    static bool isUpToDate(const QString& sourceFileName);
+
+protected:
+    const MPSnapshotHeader* header() const;
+    const MPSnapshotCell* findCell(const QPoint& cell) const;
+    QString string(quint32 index) const;
+
+    /*! Snapshot file, opened read-only */
+    QFile m_file;
+    /*! Whole file mapping, 0 if closed */
+    const uchar* m_map;
+    /*! Why the last open() failed */
+    QString m_error;
+};
+
+#endif // MPSNAPSHOT_H
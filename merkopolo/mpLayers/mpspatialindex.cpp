@@ -0,0 +1,246 @@
+#include "mpspatialindex.h"
+
+#include <QSet>
+#include <qmath.h>
+
+#include "Layer.h"
+#include "Feature.h"
+
+/*! Smallest rectangle containing \a a and \a b. Unlike QRectF::united(),
+  rectangles of null size (nodes) are taken into account.
+  */
+static QRectF unite(const QRectF& a, const QRectF& b)
+{
+    return QRectF(QPointF(qMin(a.left(), b.left()), qMin(a.top(), b.top())),
+                  QPointF(qMax(a.right(), b.right()), qMax(a.bottom(), b.bottom())));
+}
+
+/*! Tells whether \a box lies within \a extent, boxes of null size included.
+  */
+static bool covers(const QRectF& extent, const QRectF& box)
+{
+    return box.left() >= extent.left() && box.right() <= extent.right() &&
+           box.top() >= extent.top() && box.bottom() <= extent.bottom();
+}
+
+/*!
+  \class MPSpatialIndex
+  \brief A uniform grid index of the features of a layer, for fast hit-testing.
+
+  The grid is sized when bulk loaded with build(), so that each cell holds
+  about SPATIAL_INDEX_CELL_LOAD features. Features can then be inserted,
+  removed and updated incrementally when edited.
+
+  Layers filled incrementally (loaded cells, imports) start empty : the
+  grid is rebuilt when a feature falls outside its extent, or when cells
+  hold SPATIAL_INDEX_REGROW_LOAD times their load. It is then sized for
+  twice the features, on an extent grown by SPATIAL_INDEX_REGROW_SLACK,
+  so that rebuilds get rarer as the layer grows.
+
+  Features spanning more than SPATIAL_INDEX_LARGE_SPAN cells (coastlines,
+  boundaries...) are kept aside instead of in their cells : find() tests
+  their bounding boxes one by one.
+ */
+
+/*! Constructs an empty index.
+  */
+MPSpatialIndex::MPSpatialIndex() :
+    m_columns(0),
+    m_rows(0)
+{
+}
+
+/*! Bulk loads the features of the specified layer, replacing the index content.
+  */
+void MPSpatialIndex::build(Layer* aLayer)
+{
+    clear();
+
+    QVector<Feature*> features;
+    QVector<QRectF> boxes;
+    QRectF extent;
+    for (int i=0; i<aLayer->size(); ++i) {
+        Feature* f = aLayer->get(i);
+        if (f->isDeleted())
+            continue;
+        QRectF box = f->boundingBox().normalized();
+        features << f;
+        boxes << box;
+        extent = features.size() == 1 ? box : unite(extent, box);
+    }
+
+    setupGrid(extent, features.size());
+    for (int i=0; i<features.size(); ++i)
+        insertBox(features[i], boxes[i]);
+}
+
+/*! Removes all features from the index.
+  */
+void MPSpatialIndex::clear()
+{
+    m_extent = QRectF();
+    m_columns = m_rows = 0;
+    m_cells.clear();
+    m_large.clear();
+    m_boxes.clear();
+}
+
+/*! Number of indexed features.
+  */
+int MPSpatialIndex::size() const
+{
+    return m_boxes.size();
+}
+
+/*! Sizes the grid for \a count features within \a extent.
+  */
+void MPSpatialIndex::setupGrid(const QRectF& extent, int count)
+{
+    m_extent = extent;
+    qreal cells = qMax(1, count / SPATIAL_INDEX_CELL_LOAD);
+    qreal aspect = extent.height() > 0 ? extent.width() / extent.height() : 1;
+    m_columns = qBound(1, qRound(qSqrt(cells * aspect)), SPATIAL_INDEX_MAX_CELLS);
+    m_rows = qBound(1, qCeil(cells / m_columns), SPATIAL_INDEX_MAX_CELLS);
+    m_cells = QVector< QVector<Feature*> >(m_columns * m_rows);
+}
+
+/*! Computes the range of cells covered by \a box. Returns false if the grid is empty.
+  */
+bool MPSpatialIndex::cellRange(const QRectF& box, int& x0, int& y0, int& x1, int& y1) const
+{
+    if (m_cells.isEmpty())
+        return false;
+
+    qreal cw = m_extent.width() / m_columns;
+    qreal ch = m_extent.height() / m_rows;
+    x0 = cw > 0 ? qFloor((box.left() - m_extent.left()) / cw) : 0;
+    x1 = cw > 0 ? qFloor((box.right() - m_extent.left()) / cw) : 0;
+    y0 = ch > 0 ? qFloor((box.top() - m_extent.top()) / ch) : 0;
+    y1 = ch > 0 ? qFloor((box.bottom() - m_extent.top()) / ch) : 0;
+    x0 = qBound(0, x0, m_columns - 1);
+    x1 = qBound(0, x1, m_columns - 1);
+    y0 = qBound(0, y0, m_rows - 1);
+    y1 = qBound(0, y1, m_rows - 1);
+    return true;
+}
+
+/*! Indexes a feature with the specified (normalized) box.
+  */
+void MPSpatialIndex::insertBox(Feature* aFeature, const QRectF& box)
+{
+    m_boxes.insert(aFeature, box);
+
+    int x0, y0, x1, y1;
+    cellRange(box, x0, y0, x1, y1);
+    if ((x1 - x0 + 1) * (y1 - y0 + 1) > SPATIAL_INDEX_LARGE_SPAN) {
+        m_large.insert(aFeature);
+        return;
+    }
+    for (int y=y0; y<=y1; ++y)
+        for (int x=x0; x<=x1; ++x)
+            m_cells[y * m_columns + x].append(aFeature);
+}
+
+/*! Adds a feature to the index (after creation).
+  */
+void MPSpatialIndex::insert(Feature* aFeature)
+{
+    if (m_boxes.contains(aFeature))
+        return;
+
+    QRectF box = aFeature->boundingBox().normalized();
+    bool crowded = m_boxes.size() >= m_columns * m_rows * SPATIAL_INDEX_CELL_LOAD * SPATIAL_INDEX_REGROW_LOAD &&
+                   (m_columns < SPATIAL_INDEX_MAX_CELLS || m_rows < SPATIAL_INDEX_MAX_CELLS);
+    if (m_cells.isEmpty() || !covers(m_extent, box) || crowded)
+        regrow(box);
+    insertBox(aFeature, box);
+}
+
+/*! Rebuilds the grid so that it covers \a box too, with room for as
+  many features again.
+  */
+void MPSpatialIndex::regrow(const QRectF& box)
+{
+    QRectF extent = m_cells.isEmpty() ? box : unite(m_extent, box);
+    qreal dx = extent.width() * SPATIAL_INDEX_REGROW_SLACK / 2;
+    qreal dy = extent.height() * SPATIAL_INDEX_REGROW_SLACK / 2;
+    extent.adjust(-dx, -dy, dx, dy);
+
+    QHash<Feature*, QRectF> boxes = m_boxes;
+    m_boxes.clear();
+    m_large.clear();
+    setupGrid(extent, 2 * (boxes.size() + 1));
+    QHashIterator<Feature*, QRectF> it(boxes);
+    while (it.hasNext()) {
+        it.next();
+        insertBox(it.key(), it.value());
+    }
+}
+
+/*! Removes a feature from the index (before deletion).
+  */
+void MPSpatialIndex::remove(Feature* aFeature)
+{
+    if (!m_boxes.contains(aFeature))
+        return;
+
+    QRectF box = m_boxes.take(aFeature);
+    if (m_large.remove(aFeature))
+        return;
+    int x0, y0, x1, y1;
+    cellRange(box, x0, y0, x1, y1);
+    for (int y=y0; y<=y1; ++y) {
+        for (int x=x0; x<=x1; ++x) {
+            QVector<Feature*>& cell = m_cells[y * m_columns + x];
+            int i = cell.indexOf(aFeature);
+            if (i >= 0)
+                cell.remove(i);
+        }
+    }
+}
+
+/*! Updates a feature whose geometry changed.
+  */
+void MPSpatialIndex::update(Feature* aFeature)
+{
+    remove(aFeature);
+    insert(aFeature);
+}
+
+/*! Finds the features whose bounding box overlaps \a aBox.
+  */
+QList<Feature*> MPSpatialIndex::find(const CoordBox& aBox) const
+{
+    QList<Feature*> result;
+    int x0, y0, x1, y1;
+    if (!cellRange(aBox.normalized(), x0, y0, x1, y1))
+        return result;
+
+    QRectF box = aBox.normalized();
+    QSet<Feature*> seen;
+    for (int y=y0; y<=y1; ++y) {
+        for (int x=x0; x<=x1; ++x) {
+            const QVector<Feature*>& cell = m_cells[y * m_columns + x];
+            for (int i=0; i<cell.size(); ++i) {
+                Feature* f = cell[i];
+                const QRectF& fbox = m_boxes[f];
+                if (fbox.left() > box.right() || fbox.right() < box.left() ||
+                    fbox.top() > box.bottom() || fbox.bottom() < box.top())
+                    continue;
+                if (x1 > x0 || y1 > y0) {
+                    if (seen.contains(f))
+                        continue;
+                    seen.insert(f);
+                }
+                result.append(f);
+            }
+        }
+    }
+    foreach (Feature* f, m_large) {
+        const QRectF& fbox = m_boxes[f];
+        if (fbox.left() <= box.right() && fbox.right() >= box.left() &&
+            fbox.top() <= box.bottom() && fbox.bottom() >= box.top())
+            result.append(f);
+    }
+    return result;
+}
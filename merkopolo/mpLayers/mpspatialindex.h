@@ -0,0 +1,56 @@
+#ifndef MPSPATIALINDEX_H
+#define MPSPATIALINDEX_H
+
+#include <QHash>
+#include <QList>
+#include <QRectF>
+#include <QSet>
+#include <QVector>
+
+#include "Coord.h"
+
+#define SPATIAL_INDEX_CELL_LOAD 8
+#define SPATIAL_INDEX_MAX_CELLS 1024
+#define SPATIAL_INDEX_LARGE_SPAN 64
+#define SPATIAL_INDEX_REGROW_LOAD 4
+#define SPATIAL_INDEX_REGROW_SLACK 0.5
+
+class Layer;
+class Feature;
+
+
+class MPSpatialIndex
+{
+public:
+    MPSpatialIndex();
+
+    void build(Layer* aLayer);
+    void clear();
+    void insert(Feature* aFeature);
+    void remove(Feature* aFeature);
+    void update(Feature* aFeature);
+
+    QList<Feature*> find(const CoordBox& aBox) const;
+    int size() const;
+
+protected:
+    void setupGrid(const QRectF& extent, int count);
+    void regrow(const QRectF& box);
+    bool cellRange(const QRectF& box, int& x0, int& y0, int& x1, int& y1) const;
+    void insertBox(Feature* aFeature, const QRectF& box);
+
+    /*! Area covered by the grid (features outside are clamped to the border cells) */
+    QRectF m_extent;
+    /*! Number of grid columns */
+    int m_columns;
+    /*! Number of grid rows */
+    int m_rows;
+    /*! Features of each cell, row by row */
+    QVector< QVector<Feature*> > m_cells;
+    /*! Features spanning too many cells, always tested */
+    QSet<Feature*> m_large;
+    /*! Box each feature was indexed with */
+    QHash<Feature*, QRectF> m_boxes;
+};
+
+#endif // MPSPATIALINDEX_H
@@ -0,0 +1,224 @@
+#include "mpstylematcher.h"
+
+#include <QMap>
+#include <QRegExp>
+#include <QVector>
+#include <QtAlgorithms>
+
+#include "Feature.h"
+#include "Node.h"
+#include "Way.h"
+#include "Relation.h"
+
+#include "mptagpool.h"
+
+
+/*!
+  \class MPStyleMatcher
+  \brief Finds the painter of a feature without walking the whole style.
+
+  Painter selectors (Painter::userName()) are compiled into decision tables
+  indexed on tag keys and values interned in the document pool (MPTagPool) :
+
+  \li selectors made only of "[key] is value" alternatives are indexed by
+  their key/value pairs;
+  \li other selectors without negation are indexed by the keys they require;
+  \li remaining selectors are evaluated for every feature, as well as
+  selectors whose keys or values are not literal strings (quoted strings,
+  wildcards, regular expressions), which Painter::matchesTag() does not
+  compare as they are written.
+
+  Only the candidates found in these tables are evaluated with
+  Painter::matchesTag(), in style order. The matching painters are then
+  memoized by feature signature : its type and its tags whose key is used by
+  a selector. Most features share a few hundred signatures, so the style is
+  rarely evaluated. Zoom ranges are checked on the memoized painters. The
+  memo is emptied when it reaches STYLE_MATCHER_MAX_SIGNATURES, should a
+  selector use a key with many values (names, references...).
+
+  Tags of pooled features are identified without hashing their strings,
+  so that signatures and candidates only compare integers.
+*/
+
+/*! Constructs an empty matcher, interning strings in \a aPool.
+  */
+MPStyleMatcher::MPStyleMatcher(MPTagPool* aPool) :
+    m_pool(aPool),
+    m_allKeys(false)
+{
+}
+
+/*! Compiles the selectors of the specified painters, replacing
+  the previous ones.
+  */
+void MPStyleMatcher::compile(const QList<MPFeaturePainter>& painters)
+{
+    clear();
+    m_painters = painters;
+
+    QRegExp keyExp("\\[([^\\]]+)\\]");
+    QRegExp pairExp("\\[([^\\]]+)\\]\\s*(?:is|=)\\s*([^\\s\\)]+)");
+    QRegExp negationExp("\\b(not|isnot)\\b|!=");
+    QRegExp conjunctionExp("\\band\\b");
+
+    for (int i=0; i<m_painters.size(); ++i) {
+        QString selector = m_painters[i].userName();
+
+        QList<int> keys;
+        for (int pos=0; (pos = keyExp.indexIn(selector, pos)) != -1; pos += keyExp.matchedLength()) {
+            if (!isLiteral(keyExp.cap(1)))
+                m_allKeys = true;
+            else
+                keys << m_pool->intern(keyExp.cap(1));
+        }
+        foreach (int k, keys)
+            m_keys.insert(k);
+
+        if (keys.isEmpty() || m_allKeys || negationExp.indexIn(selector) != -1) {
+            m_generic << i;
+            continue;
+        }
+
+        QList< QPair<int, int> > pairs;
+        bool literal = true;
+        for (int pos=0; (pos = pairExp.indexIn(selector, pos)) != -1; pos += pairExp.matchedLength()) {
+            literal = literal && isLiteral(pairExp.cap(2));
+            pairs << qMakePair(m_pool->intern(pairExp.cap(1)), m_pool->intern(pairExp.cap(2)));
+        }
+
+        if (!literal) {
+            // The value is not compared as written, nothing to index on
+            m_generic << i;
+            continue;
+        }
+
+        if (pairs.size() == keys.size() && conjunctionExp.indexIn(selector) == -1) {
+            // Only alternatives of key/value pairs
+            for (int j=0; j<pairs.size(); ++j)
+                if (!m_valueTable[pairs[j]].contains(i))
+                    m_valueTable[pairs[j]] << i;
+        }
+        else {
+            // Any of the required keys is enough to be a candidate
+            foreach (int k, keys)
+                if (!m_keyTable[k].contains(i))
+                    m_keyTable[k] << i;
+        }
+    }
+}
+
+/*! Removes the compiled painters and the memoized results.
+  */
+void MPStyleMatcher::clear()
+{
+    m_painters.clear();
+    m_valueTable.clear();
+    m_keyTable.clear();
+    m_generic.clear();
+    m_keys.clear();
+    m_allKeys = false;
+    m_cache.clear();
+}
+
+/*! Forgets the memoized results, keeping the compiled painters.
+  */
+void MPStyleMatcher::invalidate()
+{
+    m_cache.clear();
+}
+
+/*! Finds the first painter matching the tags of \a aFeature and
+  the specified zoom, or 0 if the feature is not styled.
+  */
+const Painter* MPStyleMatcher::find(Feature* aFeature, qreal pixelPerM)
+{
+    QByteArray key = signature(aFeature);
+    QHash<QByteArray, QList<int> >::const_iterator it = m_cache.constFind(key);
+    if (it == m_cache.constEnd()) {
+        QList<int> matching;
+        foreach (int i, candidates(aFeature))
+            if (m_painters[i].matchesTag(aFeature))
+                matching << i;
+        if (m_cache.size() >= STYLE_MATCHER_MAX_SIGNATURES)
+            m_cache.clear();
+        it = m_cache.insert(key, matching);
+    }
+
+    foreach (int i, it.value())
+        if (m_painters[i].matchesZoom(pixelPerM))
+            return &m_painters[i];
+    return 0;
+}
+
+/*! Number of memoized feature signatures.
+  */
+int MPStyleMatcher::cacheSize() const
+{
+    return m_cache.size();
+}
+
+/*! Signature of \a aFeature : its type, then the number of its styled tags and the tags as pairs
+  of interned keys and values, sorted by key. Values which are not pooled
+  (see MPTagPool::pooledValue()) are written as they are, rather than
+  interned.
+  */
+QByteArray MPStyleMatcher::signature(Feature* aFeature)
+{
+    QVector<int> ids;
+    if (dynamic_cast<Node*>(aFeature))
+        ids << 0;
+    else if (Way* w = dynamic_cast<Way*>(aFeature))
+        ids << (w->isClosed() ? 2 : 1);
+    else if (dynamic_cast<Relation*>(aFeature))
+        ids << 3;
+    else
+        ids << 4;
+
+    QMap<int, QString> tags;
+    for (int i=0; i<aFeature->tagSize(); ++i) {
+        int k = m_allKeys ? m_pool->intern(aFeature->tagKey(i)) : m_pool->id(aFeature->tagKey(i));
+        if (m_allKeys || m_keys.contains(k))
+            tags.insert(k, aFeature->tagValue(i));
+    }
+
+    QByteArray values;
+    ids << tags.size();
+    QMapIterator<int, QString> it(tags);
+    while (it.hasNext()) {
+        it.next();
+        int v = m_pool->id(it.value());
+        ids << it.key() << v;
+        if (v == -1) {
+            values.append(reinterpret_cast<const char*>(it.value().constData()), it.value().size() * sizeof(QChar));
+            values.append('\0').append('\0');
+        }
+    }
+
+    return QByteArray(reinterpret_cast<const char*>(ids.constData()), ids.size() * sizeof(int)) + values;
+}
+
+/*! Painters which may match \a aFeature, in style order.
+  */
+QList<int> MPStyleMatcher::candidates(Feature* aFeature)
+{
+    QSet<int> found = m_generic.toSet();
+    for (int i=0; i<aFeature->tagSize(); ++i) {
+        int k = m_pool->id(aFeature->tagKey(i));
+        if (k == -1)
+            continue;
+        found += m_keyTable.value(k).toSet();
+        found += m_valueTable.value(qMakePair(k, m_pool->id(aFeature->tagValue(i)))).toSet();
+    }
+    QList<int> result = found.toList();
+    qSort(result);
+    return result;
+}
+
+/*! Tells whether \a aString is compared as written by the selectors :
+  not quoted, without wildcard nor regular expression.
+  */
+bool MPStyleMatcher::isLiteral(const QString& aString)
+{
+    QRegExp special("[\"'*?/\\^$|()\\[\\]{}+]");
+    return !aString.isEmpty() && special.indexIn(aString) == -1;
+}
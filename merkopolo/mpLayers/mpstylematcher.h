@@ -0,0 +1,53 @@
+#ifndef MPSTYLEMATCHER_H
+#define MPSTYLEMATCHER_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QPair>
+#include <QSet>
+#include <QString>
+
+#include "mpfeaturepainter.h"
+
+#define STYLE_MATCHER_MAX_SIGNATURES 8192
+
+class Feature;
+class MPTagPool;
+
+
+class MPStyleMatcher
+{
+public:
+    explicit MPStyleMatcher(MPTagPool* aPool);
+
+    void compile(const QList<MPFeaturePainter>& painters);
+    void clear();
+    void invalidate();
+    const Painter* find(Feature* aFeature, qreal pixelPerM);
+    int cacheSize() const;
+
+protected:
+    QByteArray signature(Feature* aFeature);
+    QList<int> candidates(Feature* aFeature);
+    static bool isLiteral(const QString& aString);
+
+    /*! Compiled painters, in style order */
+    QList<MPFeaturePainter> m_painters;
+    /*! Identifiers of the tag keys and values, shared with the document */
+    MPTagPool* m_pool;
+    /*! Painters selecting a key/value pair only, by interned pair */
+    QHash< QPair<int, int>, QList<int> > m_valueTable;
+    /*! Painters requiring a key, by interned key */
+    QHash<int, QList<int> > m_keyTable;
+    /*! Painters evaluated for every feature (negations, wildcards...) */
+    QList<int> m_generic;
+    /*! Interned keys referenced by selectors */
+    QSet<int> m_keys;
+    /*! Whether some selector may depend on any tag */
+    bool m_allKeys;
+    /*! Painters matching tags, by feature signature (type and tags), at most STYLE_MATCHER_MAX_SIGNATURES */
+    QHash<QByteArray, QList<int> > m_cache;
+};
+
+#endif // MPSTYLEMATCHER_H
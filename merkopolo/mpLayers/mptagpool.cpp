@@ -0,0 +1,117 @@
+#include "mptagpool.h"
+
+/*!
+  \class MPTagPool
+  \brief Document-wide pool of tag keys and values, with integer identifiers.
+
+  Tags of the features created from stored or imported records are pooled
+  strings (see pooled()) : as QString is implicitly shared, a key or value
+  repeated on millions of features ("highway", "residential"...) is stored
+  once, and features only hold references to it.
+
+  Pooled strings are also found by the address of their characters, so
+  that the identifier of a tag of a feature is found without hashing nor
+  comparing the string (see id()). Strings which are not pooled, set by
+  other code, are still found by value.
+
+  Strings are never removed, so only strings repeated on many features
+  are pooled : keys, and values of keys with few distinct values (see
+  pooledValue()). Names, references, addresses... stay ordinary strings,
+  freed with their features. The pool only grows with the vocabulary of
+  the tags, not with the number of features. The pool is used from the GUI
+  thread only.
+*/
+
+/*! Keys whose values are mostly unique to a feature, or prefixes of such keys (ending with ':'). */
+static const char* const uniqueKeys[] = {
+    "name", "name:", "alt_name", "old_name", "official_name", "short_name", "loc_name",
+    "ref", "ref:", "addr:", "contact:", "note", "description", "fixme", "FIXME",
+    "source", "source:", "website", "url", "phone", "email", "wikipedia", "wikidata",
+    "opening_hours", "ele", "height", "start_date", "created_by",
+    0
+};
+
+/*! Constructs an empty pool.
+  */
+MPTagPool::MPTagPool()
+{
+}
+
+/*! Identifier of \a aString, which is added to the pool if needed.
+  */
+int MPTagPool::intern(const QString& aString)
+{
+    int found = id(aString);
+    if (found != -1)
+        return found;
+    found = m_strings.size();
+    m_strings.append(aString);
+    m_ids.insert(aString, found);
+    m_data.insert(m_strings[found].constData(), found);
+    return found;
+}
+
+/*! Pooled string equal to \a aString, sharing its characters with
+  every other use of the pool.
+  */
+QString MPTagPool::pooled(const QString& aString)
+{
+    return m_strings[intern(aString)];
+}
+
+/*! Value \a aValue of the key \a aKey, pooled unless the key has values
+  mostly unique to a feature : keys of isUniqueKey(), and keys with more
+  than TAG_POOL_MAX_VALUES pooled values. Values already pooled are shared
+  in any case.
+  */
+QString MPTagPool::pooledValue(const QString& aKey, const QString& aValue)
+{
+    int found = id(aValue);
+    if (found != -1)
+        return m_strings[found];
+
+    int key = intern(aKey);
+    int& count = m_values[key];
+    if (count >= TAG_POOL_MAX_VALUES || isUniqueKey(aKey))
+        return aValue;
+    ++count;
+    return m_strings[intern(aValue)];
+}
+
+/*! Identifier of \a aString, or -1 if it is not pooled.
+  */
+int MPTagPool::id(const QString& aString) const
+{
+    QHash<const void*, int>::const_iterator it = m_data.constFind(aString.constData());
+    if (it != m_data.constEnd())
+        return it.value();
+    return m_ids.value(aString, -1);
+}
+
+/*! String of the identifier \a anId, empty if unknown.
+  */
+QString MPTagPool::string(int anId) const
+{
+    return m_strings.value(anId);
+}
+
+/*! Number of pooled strings.
+  */
+int MPTagPool::size() const
+{
+    return m_strings.size();
+}
+
+/*! Tells whether the values of \a aKey are mostly unique to a feature
+  (names, references, addresses...), and not worth pooling.
+  */
+bool MPTagPool::isUniqueKey(const QString& aKey)
+{
+    for (int i=0; uniqueKeys[i]; ++i) {
+        QLatin1String key(uniqueKeys[i]);
+        int length = qstrlen(uniqueKeys[i]);
+        if (uniqueKeys[i][length - 1] == ':' ? aKey.startsWith(key) : aKey == key)
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,36 @@
+#ifndef MPTAGPOOL_H
+#define MPTAGPOOL_H
+
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+#define TAG_POOL_MAX_VALUES 1024
+
+
+class MPTagPool
+{
+public:
+    MPTagPool();
+
+    int intern(const QString& aString);
+    QString pooled(const QString& aString);
+    QString pooledValue(const QString& aKey, const QString& aValue);
+    int id(const QString& aString) const;
+    QString string(int anId) const;
+    int size() const;
+
+    static bool isUniqueKey(const QString& aKey);
+
+protected:
+    /*! Pooled strings, by identifier */
+    QVector<QString> m_strings;
+    /*! Identifiers of the pooled strings */
+    QHash<QString, int> m_ids;
+    /*! Identifiers of the pooled strings, by address of their shared characters */
+    QHash<const void*, int> m_data;
+    /*! Number of strings pooled as values of each key, by key identifier */
+    QHash<int, int> m_values;
+};
+
+#endif // MPTAGPOOL_H
@@ -0,0 +1,14 @@
+INCLUDEPATH += $$MERKOPOLO_SRC_DIR/mpRender
+DEPENDPATH += $$MERKOPOLO_SRC_DIR/mpRender
+HEADERS += mptilerenderer.h \
+    mppaintprofiler.h \
+    mpreprojector.h \
+    mpgeometry.h \
+    mplabelcache.h \
+    mpbenchmark.h
+SOURCES += mptilerenderer.cpp \
+    mppaintprofiler.cpp \
+    mpreprojector.cpp \
+    mpgeometry.cpp \
+    mplabelcache.cpp \
+    mpbenchmark.cpp
@@ -0,0 +1,136 @@
+#include "mpbenchmark.h"
+
+#include <QElapsedTimer>
+#include <QImage>
+#include <QList>
+#include <QPainter>
+#include <QTextStream>
+#include <QTransform>
+
+/*!
+  \class MPBenchmark
+  \brief Headless microbenchmarks of the rendering code, run from the command line.
+
+  geometry() compares the ways of mapping a long polyline to the screen
+  and drawing it : point by point with QTransform, as Merkaartor's
+  renderer does, then with the MPGeometry kernel, with and without
+  clipping and decimation.
+
+  The polyline is a random walk with a fixed seed, BENCH_WORLD_SCALE
+  times larger than a view of BENCH_VIEW_WIDTH x BENCH_VIEW_HEIGHT
+  pixels : most of it is out of the view, and many of its vertices fall
+  on the same pixels, like a coastline or a boundary zoomed out. Each
+  case is run several times and the fastest run is reported, to leave
+  out the warm up.
+*/
+
+/*! Runs the geometry benchmark with a polyline of \a points vertices,
+  \a runs times per case, and writes the results to \a out.
+  */
+void MPBenchmark::geometry(QTextStream& out, int points, int runs)
+{
+    points = qMax(2, points);
+    runs = qMax(1, runs);
+
+    MPCoordBuffer coords;
+    randomWalk(points, coords);
+    QRectF view(0, 0, BENCH_VIEW_WIDTH, BENCH_VIEW_HEIGHT);
+    QRectF world = MPGeometry::bounds(coords);
+    qreal scale = qMin(view.width() / world.width(), view.height() / world.height()) * BENCH_WORLD_SCALE;
+    QTransform transform = QTransform::fromTranslate(view.center().x(), view.center().y())
+            .scale(scale, -scale).translate(-world.center().x(), -world.center().y());
+    QRectF clip = view.adjusted(-GEOMETRY_CLIP_MARGIN, -GEOMETRY_CLIP_MARGIN,
+                                GEOMETRY_CLIP_MARGIN, GEOMETRY_CLIP_MARGIN);
+    QImage image(view.size().toSize(), QImage::Format_ARGB32_Premultiplied);
+
+    out << QString("Geometry benchmark: %1 points, best of %2 runs, %3 kernel")
+           .arg(points).arg(runs).arg(MPGeometry::kernelName()) << endl;
+
+    qint64 best[5] = { -1, -1, -1, -1, -1 };
+    int vertices[5] = { points, points, 0, points, 0 };
+    QElapsedTimer timer;
+    for (int run=0; run<runs; ++run) {
+        // Point by point
+        timer.start();
+        QPolygonF polygon(points);
+        for (int i=0; i<points; ++i)
+            polygon[i] = transform.map(QPointF(coords.x[i], coords.y[i]));
+        qint64 elapsed = timer.nsecsElapsed();
+        best[0] = best[0] < 0 ? elapsed : qMin(best[0], elapsed);
+
+        // Transform kernel
+        MPCoordBuffer screen;
+        timer.start();
+        MPGeometry::transform(coords, transform, screen);
+        elapsed = timer.nsecsElapsed();
+        best[1] = best[1] < 0 ? elapsed : qMin(best[1], elapsed);
+
+        // Transform kernel, clipping and decimation
+        timer.start();
+        MPGeometry::transform(coords, transform, screen);
+        QList<QPolygonF> parts = MPGeometry::clipPolyline(screen, clip);
+        elapsed = timer.nsecsElapsed();
+        best[2] = best[2] < 0 ? elapsed : qMin(best[2], elapsed);
+        vertices[2] = 0;
+        foreach (const QPolygonF& part, parts)
+            vertices[2] += part.size();
+
+        // Drawing the whole polyline, transformed point by point
+        image.fill(0);
+        timer.start();
+        {
+            QPainter P(&image);
+            P.setRenderHint(QPainter::Antialiasing);
+            for (int i=0; i<points; ++i)
+                polygon[i] = transform.map(QPointF(coords.x[i], coords.y[i]));
+            P.drawPolyline(polygon);
+        }
+        elapsed = timer.nsecsElapsed();
+        best[3] = best[3] < 0 ? elapsed : qMin(best[3], elapsed);
+
+        // Drawing the clipped and decimated parts
+        image.fill(0);
+        timer.start();
+        {
+            QPainter P(&image);
+            P.setRenderHint(QPainter::Antialiasing);
+            MPGeometry::transform(coords, transform, screen);
+            foreach (const QPolygonF& part, MPGeometry::clipPolyline(screen, clip))
+                P.drawPolyline(part);
+        }
+        elapsed = timer.nsecsElapsed();
+        best[4] = best[4] < 0 ? elapsed : qMin(best[4], elapsed);
+        vertices[4] = vertices[2];
+    }
+
+    report(out, "transform, point by point", best[0], points, vertices[0]);
+    report(out, "transform, kernel", best[1], points, vertices[1]);
+    report(out, "transform, clip and decimate", best[2], points, vertices[2]);
+    report(out, "draw, point by point", best[3], points, vertices[3]);
+    report(out, "draw, clipped and decimated", best[4], points, vertices[4]);
+}
+
+/*! Fills \a buffer with a random walk of \a points vertices, always
+  the same one.
+  */
+void MPBenchmark::randomWalk(int points, MPCoordBuffer& buffer)
+{
+    qsrand(1);
+    buffer.clear();
+    buffer.reserve(points);
+    QPointF p;
+    for (int i=0; i<points; ++i) {
+        p += QPointF(qrand() / qreal(RAND_MAX) - 0.5, qrand() / qreal(RAND_MAX) - 0.5);
+        buffer.append(p);
+    }
+}
+
+/*! Writes the duration \a nsecs of a case of the benchmark to \a out,
+  in total and per point, with the number of vertices drawn.
+  */
+void MPBenchmark::report(QTextStream& out, const QString& name, qint64 nsecs, int points, int vertices)
+{
+    out << QString("  %1: %2 ms, %3 ns/point, %4 vertices")
+           .arg(name, -30).arg(nsecs / 1e6, 0, 'f', 3)
+           .arg(qreal(nsecs) / points, 0, 'f', 2).arg(vertices) << endl;
+}
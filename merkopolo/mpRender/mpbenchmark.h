@@ -0,0 +1,28 @@
+#ifndef MPBENCHMARK_H
+#define MPBENCHMARK_H
+
+#include <QPolygonF>
+#include <QString>
+
+#include "mpgeometry.h"
+
+#define BENCH_GEOMETRY_POINTS 1000000
+#define BENCH_GEOMETRY_RUNS 5
+#define BENCH_VIEW_WIDTH 1024
+#define BENCH_VIEW_HEIGHT 768
+#define BENCH_WORLD_SCALE 16
+
+class QTextStream;
+
+
+class MPBenchmark
+{
+public:
+    static void geometry(QTextStream& out, int points = BENCH_GEOMETRY_POINTS, int runs = BENCH_GEOMETRY_RUNS);
+
+protected:
+    static void randomWalk(int points, MPCoordBuffer& buffer);
+    static void report(QTextStream& out, const QString& name, qint64 nsecs, int points, int vertices);
+};
+
+#endif // MPBENCHMARK_H
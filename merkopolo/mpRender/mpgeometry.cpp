@@ -0,0 +1,286 @@
+#include "mpgeometry.h"
+
+#include <float.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define MP_GEOMETRY_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MP_GEOMETRY_SSE2
+#endif
+
+/*!
+  \class MPGeometry
+  \brief Maps geometries to the screen and prepares them for QPainter.
+
+  Coordinates are handled as separate arrays of x and y (MPCoordBuffer),
+  which transform() maps several at a time : four with AVX, two with SSE2,
+  one by one otherwise. The kernel is chosen at compile time.
+
+  Screen geometries are then clipped to the viewport (extended by a
+  margin, so that pens and joins are not cut), and decimated : vertices
+  closer than a tolerance, a pixel by default, to the previous vertex kept
+  are dropped. A long way of the whole world only gives QPainter the few
+  hundred vertices which are visible and distinct on screen.
+*/
+
+/*! Clips the segment [\a a, \a b] to \a r (Liang-Barsky). Returns
+  false if it is outside, otherwise moves its ends inside \a r.
+  */
+static bool clipSegment(QPointF& a, QPointF& b, const QRectF& r)
+{
+    qreal dx = b.x() - a.x();
+    qreal dy = b.y() - a.y();
+    qreal p[4] = { -dx, dx, -dy, dy };
+    qreal q[4] = { a.x() - r.left(), r.right() - a.x(), a.y() - r.top(), r.bottom() - a.y() };
+    qreal t0 = 0, t1 = 1;
+    for (int k=0; k<4; ++k) {
+        if (p[k] == 0) {
+            if (q[k] < 0)
+                return false;
+            continue;
+        }
+        qreal t = q[k] / p[k];
+        if (p[k] < 0) {
+            if (t > t1)
+                return false;
+            t0 = qMax(t0, t);
+        }
+        else {
+            if (t < t0)
+                return false;
+            t1 = qMin(t1, t);
+        }
+    }
+    QPointF start = a;
+    if (t1 < 1)
+        b = start + t1 * QPointF(dx, dy);
+    if (t0 > 0)
+        a = start + t0 * QPointF(dx, dy);
+    return true;
+}
+
+/*! Tells whether \a p is inside \a edge (0 left, 1 right, 2 top, 3 bottom) of \a r.
+  */
+static bool insideEdge(const QPointF& p, int edge, const QRectF& r)
+{
+    switch (edge) {
+    case 0: return p.x() >= r.left();
+    case 1: return p.x() <= r.right();
+    case 2: return p.y() >= r.top();
+    default: return p.y() <= r.bottom();
+    }
+}
+
+/*! Intersection of [\a a, \a b] with the line of \a edge of \a r.
+  */
+static QPointF edgeIntersection(const QPointF& a, const QPointF& b, int edge, const QRectF& r)
+{
+    if (edge < 2) {
+        qreal x = edge == 0 ? r.left() : r.right();
+        return QPointF(x, a.y() + (b.y() - a.y()) * (x - a.x()) / (b.x() - a.x()));
+    }
+    qreal y = edge == 2 ? r.top() : r.bottom();
+    return QPointF(a.x() + (b.x() - a.x()) * (y - a.y()) / (b.y() - a.y()), y);
+}
+
+/*! Tells whether \a box overlaps \a clip. Unlike QRectF::intersects(),
+  horizontal and vertical geometries (null width or height) are taken into account.
+  */
+static bool overlaps(const QRectF& box, const QRectF& clip)
+{
+    return box.left() <= clip.right() && clip.left() <= box.right() &&
+           box.top() <= clip.bottom() && clip.top() <= box.bottom();
+}
+
+/*! Tells whether \a a and \a b are distinct at \a tolerance.
+  */
+static bool isDistinct(const QPointF& a, const QPointF& b, qreal tolerance)
+{
+    return qAbs(a.x() - b.x()) + qAbs(a.y() - b.y()) >= tolerance;
+}
+
+/*! Ends the polyline \a part with its \a pending vertex, if any,
+  and adds it to \a parts unless it is a single vertex.
+  */
+static void endPart(QList<QPolygonF>& parts, QPolygonF& part, const QPointF& pending, bool& hasPending)
+{
+    if (hasPending)
+        part << pending;
+    if (part.size() > 1)
+        parts << part;
+    part.clear();
+    hasPending = false;
+}
+
+/*! Maps \a in with \a aTransform into \a out (which may be \a in).
+  */
+void MPGeometry::transform(const MPCoordBuffer& in, const QTransform& aTransform, MPCoordBuffer& out)
+{
+    out.resize(in.size());
+    transform(in.x.constData(), in.y.constData(), in.size(), aTransform, out.x.data(), out.y.data());
+}
+
+/*! Maps \a count points of coordinates \a x and \a y with \a aTransform,
+  into \a outX and \a outY (which may be the input arrays).
+
+  Affine transforms (view transforms) are computed by the SIMD kernel,
+  projective ones point by point.
+  */
+void MPGeometry::transform(const double* x, const double* y, int count, const QTransform& aTransform,
+                           double* outX, double* outY)
+{
+    if (aTransform.type() == QTransform::TxProject) {
+        for (int i=0; i<count; ++i) {
+            QPointF p = aTransform.map(QPointF(x[i], y[i]));
+            outX[i] = p.x();
+            outY[i] = p.y();
+        }
+        return;
+    }
+
+    const double m11 = aTransform.m11(), m12 = aTransform.m12();
+    const double m21 = aTransform.m21(), m22 = aTransform.m22();
+    const double dx = aTransform.dx(), dy = aTransform.dy();
+    int i = 0;
+#if defined(MP_GEOMETRY_AVX)
+    const __m256d a11 = _mm256_set1_pd(m11), a12 = _mm256_set1_pd(m12);
+    const __m256d a21 = _mm256_set1_pd(m21), a22 = _mm256_set1_pd(m22);
+    const __m256d adx = _mm256_set1_pd(dx), ady = _mm256_set1_pd(dy);
+    for (; i+4<=count; i+=4) {
+        __m256d vx = _mm256_loadu_pd(x + i);
+        __m256d vy = _mm256_loadu_pd(y + i);
+        __m256d sx = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(vx, a11), _mm256_mul_pd(vy, a21)), adx);
+        __m256d sy = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(vx, a12), _mm256_mul_pd(vy, a22)), ady);
+        _mm256_storeu_pd(outX + i, sx);
+        _mm256_storeu_pd(outY + i, sy);
+    }
+#elif defined(MP_GEOMETRY_SSE2)
+    const __m128d a11 = _mm_set1_pd(m11), a12 = _mm_set1_pd(m12);
+    const __m128d a21 = _mm_set1_pd(m21), a22 = _mm_set1_pd(m22);
+    const __m128d adx = _mm_set1_pd(dx), ady = _mm_set1_pd(dy);
+    for (; i+2<=count; i+=2) {
+        __m128d vx = _mm_loadu_pd(x + i);
+        __m128d vy = _mm_loadu_pd(y + i);
+        __m128d sx = _mm_add_pd(_mm_add_pd(_mm_mul_pd(vx, a11), _mm_mul_pd(vy, a21)), adx);
+        __m128d sy = _mm_add_pd(_mm_add_pd(_mm_mul_pd(vx, a12), _mm_mul_pd(vy, a22)), ady);
+        _mm_storeu_pd(outX + i, sx);
+        _mm_storeu_pd(outY + i, sy);
+    }
+#endif
+    // Scalar fallback, and remaining points of the SIMD kernels
+    for (; i<count; ++i) {
+        double px = x[i], py = y[i];
+        outX[i] = m11*px + m21*py + dx;
+        outY[i] = m12*px + m22*py + dy;
+    }
+}
+
+/*! Clips the polyline \a screen to \a clip, and decimates it at
+  \a tolerance pixels. Returns the parts of the polyline inside \a clip,
+  of at least two vertices : ends of the polyline or of its parts are
+  always kept.
+  */
+QList<QPolygonF> MPGeometry::clipPolyline(const MPCoordBuffer& screen, const QRectF& clip, qreal tolerance)
+{
+    QList<QPolygonF> parts;
+    if (screen.size() < 2 || !overlaps(bounds(screen), clip))
+        return parts;
+
+    QPolygonF part;
+    QPointF pending;
+    bool hasPending = false;
+    for (int i=1; i<screen.size(); ++i) {
+        QPointF from(screen.x[i-1], screen.y[i-1]), to(screen.x[i], screen.y[i]);
+        QPointF a = from, b = to;
+        bool visible = clipSegment(a, b, clip);
+
+        // A part ends where the polyline leaves the clip area
+        if (!part.isEmpty() && (!visible || a != from))
+            endPart(parts, part, pending, hasPending);
+        if (!visible)
+            continue;
+
+        if (part.isEmpty())
+            part << a;
+        if (isDistinct(b, part.last(), tolerance)) {
+            part << b;
+            hasPending = false;
+        }
+        else {
+            pending = b;
+            hasPending = true;
+        }
+        if (b != to)
+            endPart(parts, part, pending, hasPending);
+    }
+    endPart(parts, part, pending, hasPending);
+    return parts;
+}
+
+/*! Clips the polygon \a screen to \a clip (Sutherland-Hodgman), after
+  decimating it at \a tolerance pixels. Parts of the outline along \a clip
+  are added : \a clip should be larger than the viewport.
+  */
+QPolygonF MPGeometry::clipPolygon(const MPCoordBuffer& screen, const QRectF& clip, qreal tolerance)
+{
+    QRectF box = bounds(screen);
+    if (screen.size() < 3 || !overlaps(box, clip))
+        return QPolygonF();
+
+    QPolygonF polygon;
+    polygon.reserve(screen.size());
+    polygon << QPointF(screen.x[0], screen.y[0]);
+    for (int i=1; i<screen.size(); ++i) {
+        QPointF p(screen.x[i], screen.y[i]);
+        if (isDistinct(p, polygon.last(), tolerance))
+            polygon << p;
+    }
+    if (polygon.size() < 3 || clip.contains(box))
+        return polygon;
+
+    for (int edge=0; edge<4 && !polygon.isEmpty(); ++edge) {
+        QPolygonF input = polygon;
+        polygon.clear();
+        QPointF previous = input.last();
+        foreach (QPointF current, input) {
+            bool currentInside = insideEdge(current, edge, clip);
+            if (currentInside != insideEdge(previous, edge, clip))
+                polygon << edgeIntersection(previous, current, edge, clip);
+            if (currentInside)
+                polygon << current;
+            previous = current;
+        }
+    }
+    return polygon;
+}
+
+/*! Bounding rectangle of \a buffer.
+  */
+QRectF MPGeometry::bounds(const MPCoordBuffer& buffer)
+{
+    if (!buffer.size())
+        return QRectF();
+    double x0 = DBL_MAX, y0 = DBL_MAX, x1 = -DBL_MAX, y1 = -DBL_MAX;
+    for (int i=0; i<buffer.size(); ++i) {
+        x0 = qMin(x0, buffer.x[i]);
+        x1 = qMax(x1, buffer.x[i]);
+        y0 = qMin(y0, buffer.y[i]);
+        y1 = qMax(y1, buffer.y[i]);
+    }
+    return QRectF(QPointF(x0, y0), QPointF(x1, y1));
+}
+
+/*! Name of the transform kernel compiled in : "avx", "sse2" or "scalar".
+  */
+const char* MPGeometry::kernelName()
+{
+#if defined(MP_GEOMETRY_AVX)
+    return "avx";
+#elif defined(MP_GEOMETRY_SSE2)
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
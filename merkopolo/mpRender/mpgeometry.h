@@ -0,0 +1,48 @@
+#ifndef MPGEOMETRY_H
+#define MPGEOMETRY_H
+
+#include <QList>
+#include <QPointF>
+#include <QPolygonF>
+#include <QRectF>
+#include <QTransform>
+#include <QVector>
+
+#define GEOMETRY_DECIMATE_PIXELS 1.0
+#define GEOMETRY_CLIP_MARGIN 8
+
+
+/*! Coordinates of a polyline or polygon, as separate arrays of x and y
+  (structure of arrays), so that they are transformed several at a time. */
+struct MPCoordBuffer
+{
+    void clear() { x.clear(); y.clear(); }
+    void reserve(int size) { x.reserve(size); y.reserve(size); }
+    void append(const QPointF& p) { x.append(p.x()); y.append(p.y()); }
+    void resize(int size) { x.resize(size); y.resize(size); }
+    int size() const { return x.size(); }
+
+    /*! Abscissas */
+    QVector<double> x;
+    /*! Ordinates */
+    QVector<double> y;
+};
+
+
+class MPGeometry
+{
+public:
+    static void transform(const MPCoordBuffer& in, const QTransform& aTransform, MPCoordBuffer& out);
+    static void transform(const double* x, const double* y, int count, const QTransform& aTransform,
+                          double* outX, double* outY);
+
+    static QList<QPolygonF> clipPolyline(const MPCoordBuffer& screen, const QRectF& clip,
+                                         qreal tolerance = GEOMETRY_DECIMATE_PIXELS);
+    static QPolygonF clipPolygon(const MPCoordBuffer& screen, const QRectF& clip,
+                                 qreal tolerance = GEOMETRY_DECIMATE_PIXELS);
+    static QRectF bounds(const MPCoordBuffer& buffer);
+
+    static const char* kernelName();
+};
+
+#endif // MPGEOMETRY_H
@@ -0,0 +1,313 @@
+#include "mplabelcache.h"
+
+#include <float.h>
+
+#include <QMultiMap>
+#include <QPainter>
+#include <QSet>
+#include <qmath.h>
+
+#include "MapView.h"
+#include "Document.h"
+#include "Layer.h"
+#include "Node.h"
+#include "Way.h"
+#include "Projection.h"
+
+#include "mpdocument.h"
+#include "mpspatialindex.h"
+
+/*!
+  \class MPLabelCache
+  \brief Places the names of the features, and keeps them placed while the map is panned.
+
+  Labels are anchored in projected map coordinates, and their collision
+  boxes are kept at the scale of their zoom level, without the view
+  translation : a pan does not move them relative to each other. Each
+  update() then only drops the labels whose anchor left the viewport
+  (plus LABEL_VIEWPORT_MARGIN pixels), and tries to place the features
+  whose anchor entered it. Labels already placed never move, and a feature
+  rejected once stays rejected while its anchor is in view.
+
+  Texts are laid out once, when placed (QStaticText), and drawn above the
+  rendered layers by paint(), at their anchor mapped with the current view
+  transform.
+
+  Placed labels of the last LABEL_CACHED_LEVELS zoom levels are kept, so
+  that zooming back to a level shows the same labels again. Labels are
+  kept by feature identifier, not by address, which a new feature may
+  reuse, and are all dropped when the projection changes.
+
+  Features are taken from the spatial indexes of MPDocument: no labels
+  are placed for other documents.
+*/
+
+/*! Key of a cell of the collision grid.
+  */
+static quint64 cellKey(int x, int y)
+{
+    return (quint64(quint32(x)) << 32) | quint64(quint32(y));
+}
+
+/*! Tells whether \a a and \a b have the same scale and rotation.
+  */
+static bool isSameScale(const QTransform& a, const QTransform& b)
+{
+    return qFuzzyCompare(a.m11(), b.m11()) && qFuzzyCompare(a.m22(), b.m22()) &&
+           qFuzzyCompare(1 + a.m12(), 1 + b.m12()) && qFuzzyCompare(1 + a.m21(), 1 + b.m21());
+}
+
+/*! Constructs a label cache for \a aView.
+  */
+MPLabelCache::MPLabelCache(MapView* aView) :
+    m_view(aView),
+    m_projectionRevision(-1)
+{
+}
+
+/*! Places the labels of the current viewport, from the features of \a layers.
+  Only features whose anchor entered the viewport since the last update
+  at this zoom level are placed, and labels whose anchor left it dropped.
+  */
+void MPLabelCache::update(const QList<Layer*>& layers)
+{
+    MPDocument* doc = dynamic_cast<MPDocument*>(m_view->document());
+    if (!doc) {
+        clear();
+        return;
+    }
+
+    // Anchors are projected coordinates
+    if (m_view->projection().projectionRevision() != m_projectionRevision) {
+        clear();
+        m_projectionRevision = m_view->projection().projectionRevision();
+    }
+
+    QTransform transform = m_view->transform();
+    MPLabelLevel& level = levelFor(transform);
+    if (level.layers != layers) {
+        level.labels.clear();
+        level.cells.clear();
+        level.viewport = QRectF();
+        level.layers = layers;
+    }
+
+    QPointF offset(transform.dx(), transform.dy());
+    QRectF viewport = QRectF(m_view->rect()).adjusted(-LABEL_VIEWPORT_MARGIN, -LABEL_VIEWPORT_MARGIN,
+                                                      LABEL_VIEWPORT_MARGIN, LABEL_VIEWPORT_MARGIN);
+    viewport.translate(-offset);
+
+    QList<QString> gone;
+    QHashIterator<QString, MPLabel> it(level.labels);
+    while (it.hasNext()) {
+        it.next();
+        if (!viewport.contains(level.scale.map(it.value().anchor)))
+            gone << it.key();
+    }
+    foreach (QString key, gone)
+        remove(level, key);
+
+    // Only the area not seen yet (the inner rectangle of the last viewport
+    // is subtracted, anchors are tested exactly below)
+    QRegion exposed(viewport.toAlignedRect());
+    if (!level.viewport.isNull())
+        exposed -= QRegion(level.viewport.adjusted(1, 1, -1, -1).toAlignedRect());
+    exposed.translate(offset.toPoint());
+
+    // Place points first (cities, peaks...), then the largest features
+    QMultiMap<qreal, QPair<Feature*, QPointF> > sorted;
+    foreach (Feature* f, candidates(doc, layers, exposed)) {
+        if (!f->tagSize() || f->isHidden() || f->isDeleted() || level.labels.contains(labelKey(f)))
+            continue;
+        QPointF a = anchor(f);
+        QPointF p = level.scale.map(a);
+        if (!viewport.contains(p) || level.viewport.contains(p))
+            continue;
+        CoordBox box = f->boundingBox();
+        qreal extent = dynamic_cast<Node*>(f) ? DBL_MAX : qMax(qAbs(box.width()), qAbs(box.height()));
+        sorted.insert(-extent, qMakePair(f, a));
+    }
+    QMapIterator<qreal, QPair<Feature*, QPointF> > candidate(sorted);
+    while (candidate.hasNext()) {
+        candidate.next();
+        place(level, doc, candidate.value().first, candidate.value().second);
+    }
+    level.viewport = viewport;
+}
+
+/*! Draws the labels of the current zoom level, with the view transform \a aTransform.
+  */
+void MPLabelCache::paint(QPainter& thePainter, const QTransform& aTransform) const
+{
+    if (m_levels.isEmpty())
+        return;
+
+    thePainter.save();
+    thePainter.resetTransform();
+    QColor halo(255, 255, 255, 192);
+    foreach (const MPLabel& label, m_levels.first().labels) {
+        QSizeF size = label.text.size();
+        QPointF topLeft = aTransform.map(label.anchor) - QPointF(size.width() / 2, size.height() / 2);
+        thePainter.setFont(label.font);
+        thePainter.setPen(halo);
+        thePainter.drawStaticText(topLeft + QPointF(-1, 0), label.text);
+        thePainter.drawStaticText(topLeft + QPointF(1, 0), label.text);
+        thePainter.drawStaticText(topLeft + QPointF(0, -1), label.text);
+        thePainter.drawStaticText(topLeft + QPointF(0, 1), label.text);
+        thePainter.setPen(label.color);
+        thePainter.drawStaticText(topLeft, label.text);
+    }
+    thePainter.restore();
+}
+
+/*! Considers all the features of the viewport again at the next update(),
+  when features were added. Placed labels are kept.
+  */
+void MPLabelCache::refresh()
+{
+    for (int i=0; i<m_levels.size(); ++i)
+        m_levels[i].viewport = QRectF();
+}
+
+/*! Forgets the zoom levels but the current one, before features are
+  removed. Features are only removed far from the viewport (see
+  MPFeatureSource), the labels of the current level are not theirs.
+  */
+void MPLabelCache::release()
+{
+    while (m_levels.size() > 1)
+        m_levels.removeLast();
+}
+
+/*! Forgets all the labels, for instance when the document is replaced.
+  */
+void MPLabelCache::clear()
+{
+    m_levels.clear();
+}
+
+/*! Number of labels placed at the current zoom level.
+  */
+int MPLabelCache::size() const
+{
+    return m_levels.isEmpty() ? 0 : m_levels.first().labels.size();
+}
+
+/*! Labels of the zoom level of \a aTransform, made the current one.
+  The least recently used level is dropped beyond LABEL_CACHED_LEVELS.
+  */
+MPLabelLevel& MPLabelCache::levelFor(const QTransform& aTransform)
+{
+    QTransform scale(aTransform.m11(), aTransform.m12(), aTransform.m21(), aTransform.m22(), 0, 0);
+    for (int i=0; i<m_levels.size(); ++i) {
+        if (isSameScale(m_levels.at(i).scale, scale)) {
+            m_levels.move(i, 0);
+            return m_levels.first();
+        }
+    }
+
+    MPLabelLevel level;
+    level.scale = scale;
+    m_levels.prepend(level);
+    while (m_levels.size() > LABEL_CACHED_LEVELS)
+        m_levels.removeLast();
+    return m_levels.first();
+}
+
+/*! Features of \a layers within \a region (screen coordinates).
+  */
+QList<Feature*> MPLabelCache::candidates(MPDocument* doc, const QList<Layer*>& layers, const QRegion& region) const
+{
+    QSet<Feature*> found;
+    foreach (QRect area, region.rects()) {
+        CoordBox box(m_view->fromView(area.bottomLeft()), m_view->fromView(area.topRight()));
+        foreach (Layer* l, layers)
+            found += doc->spatialIndex(l)->find(box).toSet();
+    }
+    return found.toList();
+}
+
+/*! Where the label of \a aFeature is centered, in projected map
+  coordinates : a node, the middle node of an open way, the center of
+  other features.
+  */
+QPointF MPLabelCache::anchor(Feature* aFeature) const
+{
+    if (Node* node = dynamic_cast<Node*>(aFeature))
+        return m_view->projection().project(node);
+    Way* way = dynamic_cast<Way*>(aFeature);
+    if (way && way->size() && !way->isClosed())
+        return m_view->projection().project(way->getNode(way->size() / 2));
+    return m_view->projection().project(Coord(aFeature->boundingBox().center()));
+}
+
+/*! Places the label of \a aFeature at \a anAnchor, unless the feature
+  has no label style or name, or the label overlaps a placed one.
+  */
+bool MPLabelCache::place(MPLabelLevel& level, MPDocument* doc, Feature* aFeature, const QPointF& anAnchor)
+{
+    const Painter* painter = doc->findPainter(aFeature, m_view->pixelPerM());
+    if (!painter || painter->getLabelTag().isEmpty())
+        return false;
+    QString name = aFeature->tagValue(painter->getLabelTag(), "");
+    if (name.isEmpty())
+        return false;
+
+    MPLabel label;
+    label.anchor = anAnchor;
+    label.font = painter->getLabelFont();
+    label.color = painter->getLabelColor();
+    label.text.setText(name);
+    label.text.setTextFormat(Qt::PlainText);
+    label.text.setPerformanceHint(QStaticText::AggressiveCaching);
+    label.text.prepare(QTransform(), label.font);
+
+    QSizeF size = label.text.size();
+    QPointF center = level.scale.map(anAnchor);
+    label.box = QRectF(center - QPointF(size.width() / 2, size.height() / 2), size)
+            .adjusted(-LABEL_PADDING, -LABEL_PADDING, LABEL_PADDING, LABEL_PADDING);
+
+    QList<quint64> cells = cellsOf(label.box);
+    foreach (quint64 cell, cells) {
+        foreach (QString other, level.cells.values(cell)) {
+            if (level.labels.value(other).box.intersects(label.box))
+                return false;
+        }
+    }
+    QString key = labelKey(aFeature);
+    level.labels.insert(key, label);
+    foreach (quint64 cell, cells)
+        level.cells.insert(cell, key);
+    return true;
+}
+
+/*! Drops the label of the feature \a aKey from \a level.
+  */
+void MPLabelCache::remove(MPLabelLevel& level, const QString& aKey)
+{
+    MPLabel label = level.labels.take(aKey);
+    foreach (quint64 cell, cellsOf(label.box))
+        level.cells.remove(cell, aKey);
+}
+
+/*! Identifier of the label of \a aFeature : its kind and id, which
+  nodes, ways and relations may share.
+  */
+QString MPLabelCache::labelKey(Feature* aFeature)
+{
+    QChar kind = dynamic_cast<Node*>(aFeature) ? 'n' : dynamic_cast<Way*>(aFeature) ? 'w' : 'r';
+    return QString("%1:%2").arg(kind).arg(aFeature->xmlId());
+}
+
+/*! Keys of the grid cells intersecting \a box.
+  */
+QList<quint64> MPLabelCache::cellsOf(const QRectF& box)
+{
+    QList<quint64> cells;
+    int x0 = qFloor(box.left() / LABEL_GRID_SIZE), x1 = qFloor(box.right() / LABEL_GRID_SIZE);
+    int y0 = qFloor(box.top() / LABEL_GRID_SIZE), y1 = qFloor(box.bottom() / LABEL_GRID_SIZE);
+    for (int x=x0; x<=x1; ++x)
+        for (int y=y0; y<=y1; ++y)
+            cells << cellKey(x, y);
+    return cells;
+}
@@ -0,0 +1,88 @@
+#ifndef MPLABELCACHE_H
+#define MPLABELCACHE_H
+
+#include <QColor>
+#include <QFont>
+#include <QHash>
+#include <QList>
+#include <QMultiHash>
+#include <QPointF>
+#include <QRectF>
+#include <QRegion>
+#include <QStaticText>
+#include <QString>
+#include <QTransform>
+
+#define LABEL_CACHED_LEVELS 4
+#define LABEL_GRID_SIZE 128
+#define LABEL_PADDING 2
+#define LABEL_VIEWPORT_MARGIN 64
+
+class MapView;
+class MPDocument;
+class Feature;
+class Layer;
+class QPainter;
+
+
+/*! A placed label. */
+struct MPLabel
+{
+    /*! Anchor of the label, in projected map coordinates */
+    QPointF anchor;
+    /*! Area taken by the label at its zoom level, without the view translation */
+    QRectF box;
+    /*! Laid out text */
+    QStaticText text;
+    /*! Font the text is laid out with */
+    QFont font;
+    /*! Text color */
+    QColor color;
+};
+
+/*! Labels placed at one zoom level. */
+struct MPLabelLevel
+{
+    /*! View transform of the level, without its translation */
+    QTransform scale;
+    /*! Area where the labels were placed, without the view translation */
+    QRectF viewport;
+    /*! Layers the labels were taken from */
+    QList<Layer*> layers;
+    /*! Placed labels, by feature identifier (see MPLabelCache::labelKey()) */
+    QHash<QString, MPLabel> labels;
+    /*! Labels of each cell of LABEL_GRID_SIZE pixels, for collisions */
+    QMultiHash<quint64, QString> cells;
+};
+
+
+class MPLabelCache
+{
+public:
+    explicit MPLabelCache(MapView* aView);
+
+    void update(const QList<Layer*>& layers);
+    void paint(QPainter& thePainter, const QTransform& aTransform) const;
+    void refresh();
+    void release();
+    void clear();
+    int size() const;
+
+protected:
+    MPLabelLevel& levelFor(const QTransform& aTransform);
+    QList<Feature*> candidates(MPDocument* doc, const QList<Layer*>& layers, const QRegion& region) const;
+    QPointF anchor(Feature* aFeature) const;
+    bool place(MPLabelLevel& level, MPDocument* doc, Feature* aFeature, const QPointF& anAnchor);
+    void remove(MPLabelLevel& level, const QString& aKey);
+    static QString labelKey(Feature* aFeature);
+    static QList<quint64> cellsOf(const QRectF& box);
+
+    /*! View whose labels are placed */
+    MapView* m_view;
+    /*! Recently used zoom levels, current one first */
+    QList<MPLabelLevel> m_levels;
+    /*! Revision of the projection the anchors were computed with */
+    int m_projectionRevision;
+};
+
+#endif // MPLABELCACHE_H
@@ -0,0 +1,95 @@
+#include "mppaintprofiler.h"
+
+#include <QCoreApplication>
+#include <QString>
+#include <QtAlgorithms>
+#include <qmath.h>
+
+
+/*!
+  \class MPPaintProfiler
+  \brief Keeps the durations of map view paint phases over the last frames.
+
+  For each phase, the last \a window samples are kept in a ring buffer,
+  from which percentiles (p50, p95, p99...) are computed on request.
+ */
+
+/*! Constructs a profiler keeping \a window samples per phase.
+  */
+MPPaintProfiler::MPPaintProfiler(int window) :
+    m_window(qMax(1, window)),
+    m_samples(PhaseCount),
+    m_next(PhaseCount, 0)
+{
+}
+
+/*! Records the duration of a phase for the current frame.
+  */
+void MPPaintProfiler::addSample(Phase phase, qreal msecs)
+{
+    QVector<qreal>& samples = m_samples[phase];
+    if (samples.size() < m_window) {
+        samples.append(msecs);
+    }
+    else {
+        samples[m_next[phase]] = msecs;
+    }
+    m_next[phase] = (m_next[phase] + 1) % m_window;
+}
+
+/*! Forgets all samples.
+  */
+void MPPaintProfiler::clear()
+{
+    for (int i=0; i<PhaseCount; ++i) {
+        m_samples[i].clear();
+        m_next[i] = 0;
+    }
+}
+
+/*! Number of samples currently kept for a phase.
+  */
+int MPPaintProfiler::sampleCount(Phase phase) const
+{
+    return m_samples[phase].size();
+}
+
+/*! Last sample recorded for a phase, 0 if none.
+  */
+qreal MPPaintProfiler::last(Phase phase) const
+{
+    const QVector<qreal>& samples = m_samples[phase];
+    if (samples.isEmpty())
+        return 0;
+    return samples[(m_next[phase] + m_window - 1) % m_window];
+}
+
+/*! Percentile \a p (between 0 and 100) of the kept samples of a phase, 0 if none.
+  */
+qreal MPPaintProfiler::percentile(Phase phase, qreal p) const
+{
+    QVector<qreal> sorted = m_samples[phase];
+    if (sorted.isEmpty())
+        return 0;
+    qSort(sorted);
+    int rank = qCeil(qBound(qreal(0), p, qreal(100)) / 100 * sorted.size()) - 1;
+    return sorted[qBound(0, rank, sorted.size() - 1)];
+}
+
+/*! Translated name of a phase.
+  */
+QString MPPaintProfiler::phaseName(Phase phase)
+{
+    static const char* names[PhaseCount] = {
+        QT_TRANSLATE_NOOP("MPPaintProfiler", "Background"),
+        QT_TRANSLATE_NOOP("MPPaintProfiler", "Foreground"),
+        QT_TRANSLATE_NOOP("MPPaintProfiler", "Touchup"),
+        QT_TRANSLATE_NOOP("MPPaintProfiler", "Names"),
+        QT_TRANSLATE_NOOP("MPPaintProfiler", "Grid"),
+        QT_TRANSLATE_NOOP("MPPaintProfiler", "Scale"),
+        QT_TRANSLATE_NOOP("MPPaintProfiler", "Interaction"),
+        QT_TRANSLATE_NOOP("MPPaintProfiler", "Blit"),
+        QT_TRANSLATE_NOOP("MPPaintProfiler", "Input latency")
+    };
+    return QCoreApplication::translate("MPPaintProfiler", names[phase]);
+}
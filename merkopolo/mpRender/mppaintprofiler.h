@@ -0,0 +1,47 @@
+#ifndef MPPAINTPROFILER_H
+#define MPPAINTPROFILER_H
+
+#include <QString>
+#include <QVector>
+
+#define PROFILER_WINDOW 200
+
+
+class MPPaintProfiler
+{
+public:
+    /*! Measured phases of a map view frame */
+    enum Phase {
+        BackgroundPhase,   /*!< background images (tiles) */
+        ForegroundPhase,   /*!< static features, summed over render tiles */
+        TouchupPhase,      /*!< touchup (annotations), summed over render tiles */
+        NamesPhase,        /*!< feature names placement */
+        GridPhase,         /*!< lat/lon grid */
+        ScalePhase,        /*!< scale bar */
+        InteractionPhase,  /*!< interaction overlay (hover, zoom box...) */
+        BlitPhase,         /*!< static buffer blit on screen */
+        InputLatencyPhase, /*!< from user input (pan, wheel) to the next frame */
+        PhaseCount
+    };
+
+    explicit MPPaintProfiler(int window = PROFILER_WINDOW);
+
+    void addSample(Phase phase, qreal msecs);
+    void clear();
+
+    int sampleCount(Phase phase) const;
+    qreal last(Phase phase) const;
+    qreal percentile(Phase phase, qreal p) const;
+
+    static QString phaseName(Phase phase);
+
+protected:
+    /*! Maximum number of samples kept per phase */
+    int m_window;
+    /*! Ring buffers of samples (milliseconds), one per phase */
+    QVector< QVector<qreal> > m_samples;
+    /*! Position of the next sample in each ring buffer */
+    QVector<int> m_next;
+};
+
+#endif // MPPAINTPROFILER_H
@@ -0,0 +1,150 @@
+#include "mpreprojector.h"
+
+#include <QtConcurrentMap>
+
+#include "MapView.h"
+#include "Document.h"
+#include "Layer.h"
+#include "ImageMapLayer.h"
+#include "Node.h"
+#include "Projection.h"
+
+/*!
+  \class MPReprojector
+  \brief Projects all the nodes of a document in the background.
+
+  Each node caches its projected coordinates, with the revision of the
+  projection they were computed with (Node::projectionRevision()). When
+  the projection changes, every cached point is outdated and the next
+  redraws project the visible nodes again, one at a time, from the
+  render workers.
+
+  reproject() refreshes these caches ahead : the points are computed in
+  chunks of REPROJECT_CHUNK_SIZE nodes run on the global thread pool, into
+  a separate array. The workers only read the node positions, never the
+  caches the GUI thread and the render workers use. Once finished() is
+  emitted, apply() stores the points into the nodes, from the GUI thread
+  and while nothing else reads them (see MPMapView) : redraws then find
+  all the points projected and do no projection math at all. Nodes
+  projected with the current revision meanwhile are left as they are.
+
+  The nodes are read from the workers : cancel() must be called before
+  features are deleted.
+*/
+
+/*! \fn void MPReprojector::finished()
+  This signal is emitted when all the nodes of the document are projected.
+  */
+
+/*! Projects the nodes of \a chunk into its points. Only the node
+  positions are read : the projection caches of the nodes are left to
+  apply().
+  */
+static void reprojectChunk(MPReprojectChunk& chunk)
+{
+    for (int i=0; i<chunk.count; ++i)
+        chunk.points[i] = chunk.projection->project(chunk.nodes[i]->position());
+}
+
+/*! Constructs a reprojector of the document of \a aView.
+  */
+MPReprojector::MPReprojector(MapView* aView) :
+    QObject(aView),
+    m_view(aView),
+    m_revision(-1)
+{
+    m_watcher = new QFutureWatcher<void>(this);
+    connect(m_watcher, SIGNAL(finished()), this, SIGNAL(finished()));
+}
+
+/*! Destroys the reprojector, waiting for the running chunks.
+  */
+MPReprojector::~MPReprojector()
+{
+    cancel();
+}
+
+/*! Starts projecting the nodes of the view document with the current
+  projection, cancelling a reprojection in progress.
+  */
+void MPReprojector::reproject()
+{
+    cancel();
+
+    Document* doc = m_view->document();
+    if (!doc)
+        return;
+    for (int i=0; i<doc->layerSize(); ++i) {
+        Layer* l = doc->getLayer(i);
+        if (dynamic_cast<ImageMapLayer*>(l))
+            continue;
+        for (int j=0; j<l->size(); ++j) {
+            Node* node = dynamic_cast<Node*>(l->get(j));
+            if (node && !node->isDeleted())
+                m_nodes << node;
+        }
+    }
+    if (m_nodes.isEmpty())
+        return;
+
+    const Projection* projection = &m_view->projection();
+    m_revision = projection->projectionRevision();
+    m_points.resize(m_nodes.size());
+    for (int i=0; i<m_nodes.size(); i+=REPROJECT_CHUNK_SIZE) {
+        MPReprojectChunk chunk;
+        chunk.projection = projection;
+        chunk.nodes = m_nodes.constData() + i;
+        chunk.points = m_points.data() + i;
+        chunk.count = qMin(REPROJECT_CHUNK_SIZE, m_nodes.size() - i);
+        m_chunks << chunk;
+    }
+    m_watcher->setFuture(QtConcurrent::map(m_chunks, reprojectChunk));
+}
+
+/*! Stops the reprojection in progress, waiting for the running chunks.
+  Its points are dropped : the nodes will be projected by the redraws.
+  */
+void MPReprojector::cancel()
+{
+    m_watcher->cancel();
+    m_watcher->waitForFinished();
+    m_nodes.clear();
+    m_points.clear();
+    m_chunks.clear();
+}
+
+/*! Stores the points of the finished reprojection into the nodes, unless
+  the projection changed meanwhile. To be called from the GUI thread,
+  while no render worker reads the nodes.
+  */
+void MPReprojector::apply()
+{
+    if (m_nodes.isEmpty() || m_watcher->isRunning() || m_watcher->isCanceled())
+        return;
+    if (m_view->projection().projectionRevision() == m_revision) {
+        for (int i=0; i<m_nodes.size(); ++i) {
+            Node* node = m_nodes[i];
+            if (node->projectionRevision() == m_revision)
+                continue;
+            node->setProjection(m_points[i]);
+            node->setProjectionRevision(m_revision);
+        }
+    }
+    m_nodes.clear();
+    m_points.clear();
+    m_chunks.clear();
+}
+
+/*! Checks whether a reprojection is in progress.
+  */
+bool MPReprojector::isRunning() const
+{
+    return m_watcher->isRunning();
+}
+
+/*! Number of nodes of the reprojection in progress.
+  */
+int MPReprojector::nodeCount() const
+{
+    return m_nodes.size();
+}
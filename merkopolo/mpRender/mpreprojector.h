@@ -0,0 +1,63 @@
+#ifndef MPREPROJECTOR_H
+#define MPREPROJECTOR_H
+
+#include <QObject>
+#include <QFutureWatcher>
+#include <QList>
+#include <QPointF>
+#include <QVector>
+
+#define REPROJECT_CHUNK_SIZE 8192
+
+class MapView;
+class Node;
+class Projection;
+
+
+/*! A slice of the nodes to reproject, processed by one worker at a time. */
+struct MPReprojectChunk
+{
+    /*! Projection of the view, shared by all chunks */
+    const Projection* projection;
+    /*! First node of the chunk */
+    Node* const* nodes;
+    /*! Projected points of the nodes, written by the worker */
+    QPointF* points;
+    /*! Number of nodes */
+    int count;
+};
+
+
+class MPReprojector : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit MPReprojector(MapView* aView);
+    ~MPReprojector();
+
+    void reproject();
+    void cancel();
+    void apply();
+    bool isRunning() const;
+    int nodeCount() const;
+
+signals:
+    void finished();
+
+protected:
+    /*! View whose document is reprojected */
+    MapView* m_view;
+    /*! Runs the chunks on the global thread pool */
+    QFutureWatcher<void>* m_watcher;
+    /*! Nodes of the document, while they are reprojected */
+    QVector<Node*> m_nodes;
+    /*! Projected points of m_nodes, stored into the nodes by apply() */
+    QVector<QPointF> m_points;
+    /*! Revision of the projection the nodes are projected with */
+    int m_revision;
+    /*! Slices of m_nodes */
+    QList<MPReprojectChunk> m_chunks;
+};
+
+#endif // MPREPROJECTOR_H
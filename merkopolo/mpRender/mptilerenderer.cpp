@@ -0,0 +1,700 @@
+#include "mptilerenderer.h"
+
+#include <QPainter>
+#include <QThread>
+#include <QMap>
+#include <QMultiMap>
+#include <QSet>
+#include <QMetaObject>
+#include <QElapsedTimer>
+#include <QPair>
+#include <QtAlgorithms>
+
+#include "MapView.h"
+#include "Document.h"
+#include "Layer.h"
+#include "ImageMapLayer.h"
+#include "Node.h"
+#include "Way.h"
+#include "Projection.h"
+
+#include "mpdocument.h"
+#include "mplodcache.h"
+#include "mpspatialindex.h"
+
+
+/*! Tells whether two boxes overlap. Unlike QRectF::intersects(),
+  boxes of null size (nodes) are taken into account.
+  */
+static bool boxesOverlap(const QRectF& a, const QRectF& b)
+{
+    QRectF na = a.normalized();
+    QRectF nb = b.normalized();
+    return na.left() <= nb.right() && nb.left() <= na.right() &&
+           na.top() <= nb.bottom() && nb.top() <= na.bottom();
+}
+
+
+/*! Key of a tile in the current render.
+  */
+static quint64 tileKey(const QRect& tile)
+{
+    return (quint64(quint16(tile.x())) << 48) | (quint64(quint16(tile.y())) << 32) |
+           (quint64(quint16(tile.width())) << 16) | quint64(quint16(tile.height()));
+}
+
+
+/*! Brings the projected points cached in the nodes of \a aFeature up to
+  date with \a aProjection, so that render workers only read them.
+  */
+static void projectNodes(Feature* aFeature, Projection& aProjection)
+{
+    if (Node* node = dynamic_cast<Node*>(aFeature)) {
+        aProjection.project(node);
+    }
+    else if (Way* way = dynamic_cast<Way*>(aFeature)) {
+        for (int i=0; i<way->size(); ++i)
+            aProjection.project(way->getNode(i));
+    }
+}
+
+
+/*! Tells whether the specified highway class is drawn by the coarse pass.
+  */
+static bool isMainRoad(const QString& highway)
+{
+    static QSet<QString> mainRoads = QSet<QString>()
+            << "motorway" << "motorway_link"
+            << "trunk" << "trunk_link"
+            << "primary" << "primary_link"
+            << "secondary";
+    return mainRoads.contains(highway);
+}
+
+
+/*!
+  \class MPTileJob
+  \brief Renders the features of one layer in one screen tile into an image, in a worker thread.
+ */
+
+/*! Constructs a tile job.
+  */
+MPTileJob::MPTileJob(MPTileRenderer* renderer, int generation, int layer, const MPRenderTile& tile,
+                     const MPRenderState& state, const QVector<MPRenderItem>& items, const RendererOptions& options) :
+    QRunnable(),
+    m_renderer(renderer),
+    m_generation(generation),
+    m_layer(layer),
+    m_rect(tile.rect),
+    m_box(tile.box),
+    m_state(state),
+    m_items(items),
+    m_options(options)
+{
+}
+
+/*! Renders the tile and hands the image back to the renderer (in its thread).
+  Does nothing if the generation was cancelled in the meantime. The
+  running jobs count of the renderer is decremented when done.
+
+  The tile is rendered with the view parameters of its generation (not
+  with the view itself), and reads the projected points cached in the
+  nodes, which collectItems() brought up to date.
+  */
+void MPTileJob::run()
+{
+    if (m_generation != m_renderer->generation()) {
+        m_renderer->jobFinished();
+        return;
+    }
+
+    QMap<RenderPriority, QSet<Feature*> > features;
+    for (int i=0; i<m_items.size(); ++i) {
+        const MPRenderItem& item = m_items.at(i);
+        if (boxesOverlap(item.box, m_box))
+            features[item.priority].insert(item.feature);
+    }
+
+    // Features and touchup are drawn by two passes with disjoint options, to
+    // be timed separately (in nanoseconds : a tile often takes less than a
+    // millisecond). Nothing is drawn twice.
+    qlonglong foreground = 0, touchup = 0;
+    RendererOptions featureOptions = m_options;
+    featureOptions.options &= ~RendererOptions::TouchupVisible;
+    RendererOptions touchupOptions = m_options;
+    touchupOptions.options &= ~(RendererOptions::BackgroundVisible | RendererOptions::ForegroundVisible | RendererOptions::NamesVisible);
+
+    QImage image(m_rect.size(), QImage::Format_ARGB32_Premultiplied);
+    image.fill(0);
+    if (!features.isEmpty()) {
+        QElapsedTimer timer;
+        timer.start();
+        QPainter P(&image);
+        P.setRenderHint(QPainter::Antialiasing);
+        P.translate(-m_rect.topLeft());
+        P.setClipRect(m_rect);
+        MapRenderer renderer;
+        renderer.render(&P, features, m_state.viewport, m_state.screen, m_state.pixelPerM, featureOptions);
+        foreground = timer.nsecsElapsed();
+        if (m_options.options.testFlag(RendererOptions::TouchupVisible)) {
+            timer.start();
+            renderer.render(&P, features, m_state.viewport, m_state.screen, m_state.pixelPerM, touchupOptions);
+            touchup = timer.nsecsElapsed();
+        }
+        P.end();
+    }
+
+    QMetaObject::invokeMethod(m_renderer, "onTileRendered", Qt::QueuedConnection,
+                              Q_ARG(int, m_generation),
+                              Q_ARG(int, m_layer),
+                              Q_ARG(QRect, m_rect),
+                              Q_ARG(QImage, image),
+                              Q_ARG(qlonglong, foreground),
+                              Q_ARG(qlonglong, touchup));
+    m_renderer->jobFinished();
+}
+
+
+/*! Tells whether \a to only differs from \a from by a whole pixels translation,
+  and if so gives that translation in \a delta.
+  */
+static bool isPixelTranslation(const QTransform& from, const QTransform& to, QPoint& delta)
+{
+    if (!qFuzzyCompare(from.m11(), to.m11()) || !qFuzzyCompare(from.m22(), to.m22()) ||
+        !qFuzzyCompare(1 + from.m12(), 1 + to.m12()) || !qFuzzyCompare(1 + from.m21(), 1 + to.m21()))
+        return false;
+
+    QPointF shift(to.dx() - from.dx(), to.dy() - from.dy());
+    delta = shift.toPoint();
+    return (shift - delta).manhattanLength() < 0.01;
+}
+
+/*!
+  \class MPTileRenderer
+  \brief Renders the static (vectorial) buffer of a map view with a pool of worker threads.
+
+  The view is split into screen tiles of RENDER_TILE_SIZE pixels, rendered
+  concurrently and composited as they finish. The GUI thread only prepares
+  the list of features and blits the images, it never waits for the workers.
+
+  Each layer is rendered on its own surface, and the surfaces of the visible
+  layers are composited by level (MPDocument::zOrder()), then in document
+  order. Surfaces of hidden layers are kept, so showing a layer again only
+  requires compositing. They are evicted, least recently shown first, beyond
+  LAYER_SURFACES_BUDGET bytes.
+
+  A redraw is made of two passes: a coarse one (CoarsePass) showing only main
+  roads and big areas without names, then a refining one (RefinePass) that
+  overwrites the tiles with the complete rendering. Passes can be interrupted
+  when the user moves the map again, and resumed later.
+
+  After a pan, the surfaces are reused: they are shifted and only the newly
+  exposed strips are rendered.
+
+  Names are not rendered by the tiles : they are placed in the GUI thread
+  by a label cache (MPLabelCache), which keeps them in place while panning,
+  and drawn above the buffer by paint().
+
+  Workers never read the view: each render copies its parameters
+  (MPRenderState) and the map areas of its tiles in the GUI thread, so a
+  tile is rendered with the transform its surface is composited with.
+
+  \warning Features are read from the workers: the document must not be
+  modified while isRendering().
+ */
+
+/*! \fn void MPTileRenderer::tileRendered(const QRect&)
+  This signal is emitted when a tile was composited (in screen coordinates).
+  */
+/*! \fn void MPTileRenderer::finished()
+  This signal is emitted when all tiles of the current render are composited.
+  */
+/*! \fn void MPTileRenderer::profiled(qlonglong, qlonglong, qlonglong)
+  This signal is emitted with the features, touchup and names rendering
+  durations (nanoseconds) when a render is complete. Features and touchup
+  are those of the tiles of the last pass, summed, features including
+  their collection in the GUI thread. Names are the labels placement, in
+  the GUI thread too.
+  */
+
+/*! Constructs a renderer for the specified view.
+  */
+MPTileRenderer::MPTileRenderer(MapView* aView) :
+    QObject(aView),
+    m_view(aView),
+    m_pool(new QThreadPool(this)),
+    m_generation(0),
+    m_pass(CoarsePass),
+    m_interrupted(false),
+    m_clock(0),
+    m_pendingTiles(0),
+    m_runningJobs(0),
+    m_collectElapsed(0),
+    m_labelElapsed(0),
+    m_labels(aView)
+{
+    m_pool->setMaxThreadCount(QThread::idealThreadCount());
+}
+
+/*! Destroys the renderer, waiting for the running tiles.
+  */
+MPTileRenderer::~MPTileRenderer()
+{
+    cancel();
+    m_pool->waitForDone();
+}
+
+/*! Current render generation.
+  */
+int MPTileRenderer::generation() const
+{
+    return m_generation;
+}
+
+/*! The rendered map view.
+  */
+MapView* MPTileRenderer::view() const
+{
+    return m_view;
+}
+
+/*! Checks whether some tile jobs are queued or running, of any
+  generation : workers may then read the features.
+  */
+bool MPTileRenderer::isRendering() const
+{
+    return int(m_runningJobs) > 0;
+}
+
+/*! Counts a tile job as finished. Called by the jobs, in worker threads.
+  */
+void MPTileRenderer::jobFinished()
+{
+    m_runningJobs.deref();
+}
+
+/*! Drops the current render. Queued tiles will not run, running ones will
+  be ignored : isRendering() stays true until they are finished.
+  */
+void MPTileRenderer::cancel()
+{
+    m_generation.ref();
+    m_pendingTiles = 0;
+    m_tileLayers.clear();
+    m_pendingRegion = QRegion();
+}
+
+/*! Starts rendering the current viewport of the view. Returns immediately,
+  tiles are composited while they finish (coarse pass first, then refined).
+
+  Only the visible layers without an up to date surface are rendered: after
+  a visibility change, the surfaces are only composited again. If a surface
+  is complete and the view was only moved by whole pixels since (pan), it is
+  shifted and only the exposed strips are rendered.
+  */
+void MPTileRenderer::render(const RendererOptions& options)
+{
+    QRect area(QPoint(0, 0), m_view->size());
+    QTransform transform = m_view->transform();
+
+    if (options.options != m_options.options)
+        discard();
+    bool fresh = false;
+
+    m_layers = visibleLayers();
+    m_renderLayers.clear();
+    m_dirtyRegions.clear();
+    foreach (Layer* l, m_layers) {
+        MPLayerSurface& surface = m_surfaces[l];
+        surface.lastShown = ++m_clock;
+
+        bool reusable = surface.complete && surface.image.size() == area.size();
+        QPoint delta;
+        if (reusable && surface.transform == transform)
+            continue;
+
+        if (reusable && isPixelTranslation(surface.transform, transform, delta)) {
+            // Pan by blit
+            QImage shifted(area.size(), QImage::Format_ARGB32_Premultiplied);
+            shifted.fill(0);
+            QPainter P(&shifted);
+            P.setCompositionMode(QPainter::CompositionMode_Source);
+            P.drawImage(delta, surface.image);
+            P.end();
+            surface.image = shifted;
+            m_dirtyRegions << QRegion(area) - QRegion(area.translated(delta));
+        }
+        else {
+            if (surface.image.size() != area.size() || surface.transform != transform) {
+                surface.image = QImage(area.size(), QImage::Format_ARGB32_Premultiplied);
+                surface.image.fill(0);
+                fresh = true;
+            }
+            m_dirtyRegions << QRegion(area);
+        }
+        surface.transform = transform;
+        surface.complete = false;
+        m_renderLayers << l;
+    }
+
+    // Keep the last complete buffer while fresh surfaces are rendered
+    if (fresh && m_pendingTiles == 0 && !m_buffer.isNull()) {
+        m_previous = m_buffer;
+        m_previousTransform = m_transform;
+    }
+    cancel();
+    m_transform = transform;
+    m_options = options;
+    m_interrupted = false;
+
+    m_state.transform = transform;
+    m_state.screen = area;
+    m_state.viewport = transform.inverted().mapRect(QRectF(area));
+    m_state.pixelPerM = m_view->pixelPerM();
+    m_tiles.clear();
+    foreach (QRegion region, m_dirtyRegions)
+        m_tiles << splitTiles(region);
+
+    m_buffer = QImage(area.size(), QImage::Format_ARGB32_Premultiplied);
+    composite(area);
+    evictSurfaces();
+
+    QElapsedTimer timer;
+    timer.start();
+    CoordBox viewbox(m_view->fromView(area.bottomLeft()), m_view->fromView(area.topRight()));
+    // Minimal extent of coarse features, in map units
+    qreal coarseExtent = COARSE_MIN_EXTENT * qAbs(viewbox.width()) / qMax(1, area.width());
+    m_items.clear();
+    for (int i=0; i<m_renderLayers.size(); ++i)
+        m_items << collectItems(m_renderLayers[i], m_dirtyRegions[i], coarseExtent);
+    m_collectElapsed = timer.nsecsElapsed();
+
+    timer.start();
+    if (m_options.options.testFlag(RendererOptions::NamesVisible))
+        m_labels.update(m_layers);
+    else
+        m_labels.clear();
+    m_labelElapsed = timer.nsecsElapsed();
+
+    if (m_renderLayers.isEmpty()) {
+        m_previous = QImage();
+        emit tileRendered(area);
+        emit finished();
+    }
+    else {
+        startPass(CoarsePass);
+    }
+}
+
+/*! Prevents the current surfaces from being reused by the next render
+  (content changed, not only the viewport).
+  */
+void MPTileRenderer::discard()
+{
+    QMutableHashIterator<Layer*, MPLayerSurface> it(m_surfaces);
+    while (it.hasNext())
+        it.next().value().complete = false;
+    m_labels.refresh();
+}
+
+/*! Drops all surfaces, for instance when the document is replaced.
+  */
+void MPTileRenderer::clear()
+{
+    cancel();
+    m_interrupted = false;
+    m_surfaces.clear();
+    m_layers.clear();
+    m_renderLayers.clear();
+    m_dirtyRegions.clear();
+    m_tiles.clear();
+    m_items.clear();
+    m_buffer = QImage();
+    m_previous = QImage();
+    m_labels.clear();
+}
+
+/*! Stops rendering and forgets the collected features, waiting for the
+  running tiles : features may then be deleted. Surfaces are kept.
+  */
+void MPTileRenderer::release()
+{
+    cancel();
+    m_pool->waitForDone();
+    m_interrupted = false;
+    m_renderLayers.clear();
+    m_dirtyRegions.clear();
+    m_tiles.clear();
+    m_items.clear();
+    m_labels.release();
+}
+
+/*! Visible vectorial layers of the document, in compositing order.
+  */
+QList<Layer*> MPTileRenderer::visibleLayers() const
+{
+    QList<Layer*> layers;
+    Document* doc = m_view->document();
+    if (!doc)
+        return layers;
+
+    // Sort by level, then by document order
+    MPDocument* mpdoc = dynamic_cast<MPDocument*>(doc);
+    QList< QPair<int, int> > order;
+    for (int i=0; i<doc->layerSize(); ++i) {
+        Layer* l = doc->getLayer(i);
+        if (mpdoc && l == mpdoc->lodLayer())
+            continue;   // drawn instead of the ways they simplify
+        if (l->isVisible() && !dynamic_cast<ImageMapLayer*>(l))
+            order << qMakePair(mpdoc ? mpdoc->zOrder(l) : 0, i);
+    }
+    qSort(order);
+    for (int i=0; i<order.size(); ++i)
+        layers << doc->getLayer(order[i].second);
+    return layers;
+}
+
+/*! Dispatches the tiles of the specified pass to the workers.
+  */
+void MPTileRenderer::startPass(Pass aPass)
+{
+    cancel();
+    m_pass = aPass;
+    m_elapsed[0] = m_elapsed[1] = 0;
+
+    // Names are drawn by the label cache
+    RendererOptions options = m_options;
+    options.options &= ~RendererOptions::NamesVisible;
+    if (aPass == CoarsePass)
+        options.options &= ~RendererOptions::TouchupVisible;
+
+    int generation = m_generation;
+    for (int i=0; i<m_renderLayers.size(); ++i) {
+        QVector<MPRenderItem> items;
+        if (aPass == CoarsePass) {
+            for (int j=0; j<m_items[i].size(); ++j) {
+                if (m_items[i].at(j).coarse)
+                    items.append(m_items[i].at(j));
+            }
+        }
+        else {
+            items = m_items[i];
+        }
+
+        m_pendingRegion += m_dirtyRegions[i];
+        foreach (const MPRenderTile& tile, m_tiles[i]) {
+            m_runningJobs.ref();
+            m_pool->start(new MPTileJob(this, generation, i, tile, m_state, items, options));
+            ++m_tileLayers[tileKey(tile.rect)];
+            ++m_pendingTiles;
+        }
+    }
+}
+
+/*! Drops the pass in progress, keeping what is already composited.
+  It will be started again by resume().
+  */
+void MPTileRenderer::interrupt()
+{
+    if (m_pendingTiles == 0)
+        return;
+    cancel();
+    m_interrupted = true;
+}
+
+/*! Restarts the pass dropped by interrupt(), unless the view
+  has moved since (a new render will then be requested).
+  */
+void MPTileRenderer::resume()
+{
+    if (!m_interrupted)
+        return;
+    m_interrupted = false;
+    if (m_view->transform() == m_transform)
+        startPass(m_pass);
+}
+
+/*! Composites the surfaces of the visible layers into the buffer, within \a rect.
+  */
+void MPTileRenderer::composite(const QRect& rect)
+{
+    QPainter P(&m_buffer);
+    P.setCompositionMode(QPainter::CompositionMode_Source);
+    P.fillRect(rect, Qt::transparent);
+    P.setCompositionMode(QPainter::CompositionMode_SourceOver);
+    foreach (Layer* l, m_layers) {
+        const MPLayerSurface& surface = m_surfaces[l];
+        if (surface.transform == m_transform)
+            P.drawImage(rect, surface.image, rect);
+    }
+}
+
+/*! Evicts the least recently shown surfaces of hidden layers,
+  until the surfaces fit in LAYER_SURFACES_BUDGET.
+  */
+void MPTileRenderer::evictSurfaces()
+{
+    qint64 total = 0;
+    QMap<quint64, Layer*> hidden;
+    QHashIterator<Layer*, MPLayerSurface> it(m_surfaces);
+    while (it.hasNext()) {
+        it.next();
+        total += it.value().image.byteCount();
+        if (!m_layers.contains(it.key()))
+            hidden.insert(it.value().lastShown, it.key());
+    }
+
+    QMapIterator<quint64, Layer*> oldest(hidden);
+    while (total > LAYER_SURFACES_BUDGET && oldest.hasNext()) {
+        oldest.next();
+        total -= m_surfaces[oldest.value()].image.byteCount();
+        m_surfaces.remove(oldest.value());
+    }
+}
+
+/*! Collects the visible features of a layer, within the specified screen region.
+  Features larger than \a coarseExtent (map units) are drawn by the coarse pass.
+  When zoomed out, long ways are replaced by their simplified version, if built.
+  Nodes of the collected features are projected here, in the GUI thread.
+  */
+QVector<MPRenderItem> MPTileRenderer::collectItems(Layer* layer, const QRegion& region, qreal coarseExtent) const
+{
+    QList<CoordBox> boxes;
+    foreach (QRect dirty, region.rects()) {
+        dirty.adjust(-RENDER_TILE_MARGIN, -RENDER_TILE_MARGIN, RENDER_TILE_MARGIN, RENDER_TILE_MARGIN);
+        boxes << CoordBox(m_view->fromView(dirty.bottomLeft()), m_view->fromView(dirty.topRight()));
+    }
+
+    // Candidate features, from the spatial index if available
+    QList<Feature*> candidates;
+    MPDocument* doc = dynamic_cast<MPDocument*>(m_view->document());
+    if (doc) {
+        QSet<Feature*> found;
+        foreach (CoordBox box, boxes)
+            found += doc->spatialIndex(layer)->find(box).toSet();
+        candidates = found.toList();
+    }
+    else {
+        for (int j=0; j<layer->size(); ++j)
+            candidates << layer->get(j);
+    }
+
+    // Unstyled features are not drawn, skip them before rendering
+    bool unstyledHidden = doc && m_options.options.testFlag(RendererOptions::UnstyledHidden);
+    qreal pixelPerM = m_view->pixelPerM();
+    // Long ways are drawn simplified when zoomed out
+    int lodLevel = doc ? MPLodCache::level(1 / pixelPerM) : 0;
+
+    QVector<MPRenderItem> items;
+    foreach (Feature* f, candidates) {
+        if (f->isHidden() || f->isDeleted())
+            continue;
+        if (unstyledHidden && !doc->findPainter(f, pixelPerM))
+            continue;
+        MPRenderItem item;
+        item.box = f->boundingBox();
+        bool inside = false;
+        for (int k=0; k<boxes.size() && !inside; ++k)
+            inside = boxesOverlap(item.box, boxes.at(k));
+        if (!inside)
+            continue;
+        item.feature = f;
+        item.priority = f->renderPriority();
+        item.coarse = isMainRoad(f->tagValue("highway", "")) ||
+                      qMax(qAbs(item.box.width()), qAbs(item.box.height())) >= coarseExtent;
+        if (lodLevel) {
+            Way* way = dynamic_cast<Way*>(f);
+            Way* proxy = way ? doc->lod()->proxy(way, lodLevel) : 0;
+            if (proxy)
+                item.feature = proxy;
+        }
+        projectNodes(item.feature, m_view->projection());
+        items.append(item);
+    }
+    return items;
+}
+
+/*! Splits the specified region into tiles, ordered from the center of the view
+  outwards so that the middle of the screen shows up first. Their map areas
+  are computed with the current view transform.
+  */
+QList<MPRenderTile> MPTileRenderer::splitTiles(const QRegion& region) const
+{
+    QMultiMap<int, MPRenderTile> sorted;
+    QPoint center = m_view->rect().center();
+    foreach (QRect area, region.rects()) {
+        for (int y=area.top(); y<=area.bottom(); y+=RENDER_TILE_SIZE) {
+            for (int x=area.left(); x<=area.right(); x+=RENDER_TILE_SIZE) {
+                MPRenderTile tile;
+                tile.rect = QRect(x, y, RENDER_TILE_SIZE, RENDER_TILE_SIZE).intersected(area);
+                QRect margins = tile.rect.adjusted(-RENDER_TILE_MARGIN, -RENDER_TILE_MARGIN,
+                                                   RENDER_TILE_MARGIN, RENDER_TILE_MARGIN);
+                tile.box = CoordBox(m_view->fromView(margins.bottomLeft()), m_view->fromView(margins.topRight()));
+                sorted.insert((tile.rect.center() - center).manhattanLength(), tile);
+            }
+        }
+    }
+    return sorted.values();
+}
+
+/*! When a worker has rendered a tile of a layer. Stores it in the layer
+  surface and composites it, if it is not stale.
+  */
+void MPTileRenderer::onTileRendered(int generation, int layer, const QRect& rect, const QImage& image,
+                                    qlonglong foreground, qlonglong touchup)
+{
+    if (generation != m_generation)
+        return;
+
+    m_elapsed[0] += foreground;
+    m_elapsed[1] += touchup;
+
+    QPainter P(&m_surfaces[m_renderLayers[layer]].image);
+    P.setCompositionMode(QPainter::CompositionMode_Source);
+    P.drawImage(rect.topLeft(), image);
+    P.end();
+    composite(rect);
+
+    // Previous buffer remains visible until all layers of the tile are rendered
+    if (--m_tileLayers[tileKey(rect)] == 0)
+        m_pendingRegion -= rect;
+    emit tileRendered(rect);
+
+    if (--m_pendingTiles == 0) {
+        m_previous = QImage();
+        if (m_pass == CoarsePass) {
+            startPass(RefinePass);
+        }
+        else {
+            foreach (Layer* l, m_renderLayers)
+                m_surfaces[l].complete = true;
+            emit profiled(m_collectElapsed + m_elapsed[0], m_elapsed[1], m_labelElapsed);
+            emit finished();
+        }
+    }
+}
+
+/*! Paints the rendered buffer with the specified (current) view transform.
+
+  Buffers rendered with another transform (pan or zoom in progress) are
+  moved and scaled accordingly. While tiles are rendering, the last complete
+  buffer is painted where the new one is not composited yet. Labels are
+  painted above, unscaled, at their anchors.
+  */
+void MPTileRenderer::paint(QPainter& thePainter, const QTransform& aTransform)
+{
+    thePainter.save();
+    if (!m_previous.isNull()) {
+        thePainter.setTransform(m_transform.inverted() * aTransform);
+        thePainter.setClipRegion(m_pendingRegion);
+        thePainter.setTransform(m_previousTransform.inverted() * aTransform);
+        thePainter.drawImage(0, 0, m_previous);
+    }
+    if (!m_buffer.isNull()) {
+        thePainter.setClipping(false);
+        thePainter.setTransform(m_transform.inverted() * aTransform);
+        thePainter.drawImage(0, 0, m_buffer);
+    }
+    thePainter.restore();
+    m_labels.paint(thePainter, aTransform);
+}
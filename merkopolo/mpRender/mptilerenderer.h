@@ -0,0 +1,213 @@
+#ifndef MPTILERENDERER_H
+#define MPTILERENDERER_H
+
+#include <QObject>
+#include <QHash>
+#include <QImage>
+#include <QRectF>
+#include <QRegion>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QTransform>
+#include <QVector>
+#include <QAtomicInt>
+
+#include "Coord.h"
+#include "Feature.h"
+#include "MapRenderer.h"
+
+#include "mplabelcache.h"
+
+#define RENDER_TILE_SIZE 256
+#define RENDER_TILE_MARGIN 32
+#define COARSE_MIN_EXTENT 64
+#define LAYER_SURFACES_BUDGET (96*1024*1024)
+
+class MapView;
+class Layer;
+
+
+/*! A feature to render, prepared in the GUI thread before tiles are dispatched. */
+struct MPRenderItem
+{
+    /*! Feature to render */
+    Feature* feature;
+    /*! Render priority of the feature, computed once */
+    RenderPriority priority;
+    /*! Bounding box of the feature, computed once */
+    CoordBox box;
+    /*! Whether the feature is drawn by the coarse pass */
+    bool coarse;
+};
+
+
+/*! View parameters of a render generation, copied in the GUI thread:
+  workers never read the MapView, which moves while they render. */
+struct MPRenderState
+{
+    /*! View transform the tiles are rendered with */
+    QTransform transform;
+    /*! Viewport in projected map coordinates */
+    QRectF viewport;
+    /*! Screen area of the view */
+    QRect screen;
+    /*! Scale of the view */
+    qreal pixelPerM;
+};
+
+
+/*! A screen tile to render, with its area in map coordinates. */
+struct MPRenderTile
+{
+    /*! Tile area in screen coordinates */
+    QRect rect;
+    /*! Tile area in map coordinates, with RENDER_TILE_MARGIN */
+    CoordBox box;
+};
+
+
+/*! Cached rendering of a layer. */
+struct MPLayerSurface
+{
+    MPLayerSurface() : complete(false), lastShown(0) {}
+
+    /*! Rendered features of the layer */
+    QImage image;
+    /*! View transform the image is rendered with */
+    QTransform transform;
+    /*! Whether the image is completely rendered (refined) */
+    bool complete;
+    /*! When the surface was shown last (render counter) */
+    quint64 lastShown;
+};
+
+
+class MPTileRenderer;
+
+class MPTileJob : public QRunnable
+{
+public:
+    MPTileJob(MPTileRenderer* renderer, int generation, int layer, const MPRenderTile& tile,
+              const MPRenderState& state, const QVector<MPRenderItem>& items, const RendererOptions& options);
+    void run();
+
+protected:
+    /*! Renderer which receives the tile */
+    MPTileRenderer* m_renderer;
+    /*! Render generation this tile belongs to */
+    int m_generation;
+    /*! Index of the rendered layer in the current render */
+    int m_layer;
+    /*! Tile area in screen coordinates */
+    QRect m_rect;
+    /*! Tile area in map coordinates (with margin) */
+    CoordBox m_box;
+    /*! View parameters of the generation */
+    MPRenderState m_state;
+    /*! Features of the layer in the rendered area (shared) */
+    QVector<MPRenderItem> m_items;
+    /*! Rendering options */
+    RendererOptions m_options;
+};
+
+
+class MPTileRenderer : public QObject
+{
+    Q_OBJECT
+
+public:
+    /*! Rendering passes of a redraw */
+    enum Pass {
+        CoarsePass,  /*!< main roads and big areas, no names */
+        RefinePass   /*!< all features with all options */
+    };
+
+    explicit MPTileRenderer(MapView* aView);
+    ~MPTileRenderer();
+
+    void render(const RendererOptions& options);
+    void cancel();
+    void discard();
+    void clear();
+    void release();
+    void interrupt();
+    void resume();
+    void paint(QPainter& thePainter, const QTransform& aTransform);
+
+    bool isRendering() const;
+    void jobFinished();
+    int generation() const;
+    MapView* view() const;
+
+signals:
+    void tileRendered(const QRect&);
+    void finished();
+    void profiled(qlonglong, qlonglong, qlonglong);
+
+protected slots:
+    void onTileRendered(int generation, int layer, const QRect& rect, const QImage& image,
+                        qlonglong foreground, qlonglong touchup);
+
+protected:
+    QList<Layer*> visibleLayers() const;
+    void startPass(Pass aPass);
+    void composite(const QRect& rect);
+    void evictSurfaces();
+    QVector<MPRenderItem> collectItems(Layer* layer, const QRegion& region, qreal coarseExtent) const;
+    QList<MPRenderTile> splitTiles(const QRegion& region) const;
+
+    /*! Pointer to the rendered map view */
+    MapView* m_view;
+    /*! Worker threads rendering tiles */
+    QThreadPool* m_pool;
+    /*! Current render generation, results of older ones are dropped */
+    QAtomicInt m_generation;
+    /*! Pass being rendered */
+    Pass m_pass;
+    /*! Whether m_pass was interrupted and should be resumed */
+    bool m_interrupted;
+    /*! Rendering options of the current render */
+    RendererOptions m_options;
+    /*! Cached surfaces of the layers, shown or not */
+    QHash<Layer*, MPLayerSurface> m_surfaces;
+    /*! Render counter, to find least recently shown surfaces */
+    quint64 m_clock;
+    /*! Visible layers, in compositing order */
+    QList<Layer*> m_layers;
+    /*! Layers rendered by the current render */
+    QList<Layer*> m_renderLayers;
+    /*! Area rendered for each layer of m_renderLayers */
+    QList<QRegion> m_dirtyRegions;
+    /*! Tiles to render for each layer of m_renderLayers, center first */
+    QList< QList<MPRenderTile> > m_tiles;
+    /*! View parameters of the current render, given to the workers */
+    MPRenderState m_state;
+    /*! Features rendered for each layer of m_renderLayers */
+    QList< QVector<MPRenderItem> > m_items;
+    /*! Number of tiles of the current generation not composited yet */
+    int m_pendingTiles;
+    /*! Number of tile jobs queued or running, of any generation */
+    QAtomicInt m_runningJobs;
+    /*! Number of layers still being rendered, for each pending tile */
+    QHash<quint64, int> m_tileLayers;
+    /*! Duration of the features collection of the current render (nanoseconds) */
+    qlonglong m_collectElapsed;
+    /*! Foreground and touchup durations of the tiles of the current pass, summed (nanoseconds) */
+    qlonglong m_elapsed[2];
+    /*! Duration of the labels placement of the current render (nanoseconds) */
+    qlonglong m_labelElapsed;
+    /*! Names of the features, placed in the GUI thread and kept while panning */
+    MPLabelCache m_labels;
+    /*! Area of the current generation which is not composited yet */
+    QRegion m_pendingRegion;
+    /*! Composited surfaces of the visible layers */
+    QImage m_buffer;
+    /*! View transform of the current render */
+    QTransform m_transform;
+    /*! Last complete buffer, shown where m_buffer is still pending */
+    QImage m_previous;
+    /*! View transform m_previous was rendered with */
+    QTransform m_previousTransform;
+};
+
+#endif // MPTILERENDERER_H
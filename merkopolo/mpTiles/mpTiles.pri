@@ -0,0 +1,14 @@
+INCLUDEPATH += $$MERKOPOLO_SRC_DIR/mpTiles
+DEPENDPATH += $$MERKOPOLO_SRC_DIR/mpTiles
+HEADERS += mptilepack.h \
+    mpimagemanager.h \
+    mptilecache.h \
+    mptilescheduler.h \
+    mptileseeder.h \
+    mpdecodebenchmark.h
+SOURCES += mptilepack.cpp \
+    mpimagemanager.cpp \
+    mptilecache.cpp \
+    mptilescheduler.cpp \
+    mptileseeder.cpp \
+    mpdecodebenchmark.cpp
@@ -0,0 +1,277 @@
+#include "mpdecodebenchmark.h"
+
+#include <QBuffer>
+#include <QCoreApplication>
+#include <QMetaObject>
+#include <QPainter>
+#include <QTextStream>
+#include <QThreadPool>
+
+#include "mpimagemanager.h"
+
+/*!
+  \class MPDecodeBenchmark
+  \brief Measures the input-to-frame latency while a burst of tiles is decoded.
+
+  A thread (MPInputThread) posts a simulated input every
+  BENCH_INPUT_INTERVAL milliseconds to the GUI thread, which composites a
+  frame of BENCH_FRAME_WIDTH x BENCH_FRAME_HEIGHT pixels from the cached
+  tiles when it handles it. The latency of an input is the time from its
+  posting to the end of its frame: it includes the time it waited behind
+  other events in the GUI thread.
+
+  BENCH_IDLE_INPUTS inputs are handled first without decoding, for
+  reference. Then a burst of tiles (BENCH_DECODE_TILES by default) is
+  decoded by MPTileDecodeJob, as downloaded tiles are, and handed to an
+  MPImageManager, until they are all cached. Tiles are decoded by a
+  worker pool, or in the GUI thread one per event (setGuiThreadDecoding()),
+  as before the decoding pool, to compare.
+
+  Tiles are PNG images drawn with a fixed seed, so runs are reproducible.
+*/
+
+/*! Type of the simulated input events, registered on first use.
+  */
+QEvent::Type MPInputEvent::type()
+{
+    static QEvent::Type eventType = QEvent::Type(QEvent::registerEventType());
+    return eventType;
+}
+
+
+/*!
+  \class MPInputThread
+  \brief Posts a simulated user input every BENCH_INPUT_INTERVAL milliseconds (MPInputEvent).
+*/
+
+/*! Constructs an input thread posting to \a aReceiver, with the
+  time of \a aClock.
+  */
+MPInputThread::MPInputThread(QObject* aReceiver, const QElapsedTimer* aClock) :
+    QThread(),
+    m_receiver(aReceiver),
+    m_clock(aClock),
+    m_stopped(0)
+{
+}
+
+/*! Stops posting inputs, and waits for the thread.
+  */
+void MPInputThread::stop()
+{
+    m_stopped.fetchAndStoreOrdered(1);
+    wait();
+}
+
+/*! Posts the inputs until stop() is called.
+  */
+void MPInputThread::run()
+{
+    while (!m_stopped.fetchAndAddOrdered(0)) {
+        msleep(BENCH_INPUT_INTERVAL);
+        QCoreApplication::postEvent(m_receiver, new MPInputEvent(m_clock->nsecsElapsed()));
+    }
+}
+
+
+/*! \fn void MPDecodeBenchmark::finished()
+  This signal is emitted when the results are written.
+  */
+
+/*! Constructs a benchmark writing its results to \a anOutput.
+  */
+MPDecodeBenchmark::MPDecodeBenchmark(QTextStream* anOutput, QObject* parent) :
+    QObject(parent),
+    m_output(anOutput),
+    m_tiles(BENCH_DECODE_TILES),
+    m_guiThread(false),
+    m_phase(IdlePhase),
+    m_inputs(0),
+    m_next(0),
+    m_decoded(0),
+    m_burstElapsed(-1),
+    m_frame(BENCH_FRAME_WIDTH, BENCH_FRAME_HEIGHT, QImage::Format_ARGB32_Premultiplied),
+    m_idleLatencies(BENCH_LATENCY_WINDOW),
+    m_burstLatencies(BENCH_LATENCY_WINDOW)
+{
+    m_manager = new MPImageManager(this);
+    connect(m_manager, SIGNAL(imageDecoded()), this, SLOT(onImageDecoded()));
+    m_decoders = new QThreadPool(this);
+    m_input = new MPInputThread(this, &m_clock);
+}
+
+/*! Destroys the benchmark, after stopping its threads.
+  */
+MPDecodeBenchmark::~MPDecodeBenchmark()
+{
+    m_input->stop();
+    delete m_input;
+    m_decoders->waitForDone();
+}
+
+/*! Sets the number of tiles of the burst.
+  */
+void MPDecodeBenchmark::setTiles(int count)
+{
+    m_tiles = qMax(1, count);
+}
+
+/*! Decodes the tiles in the GUI thread if \a enabled, in a worker pool otherwise.
+  */
+void MPDecodeBenchmark::setGuiThreadDecoding(bool enabled)
+{
+    m_guiThread = enabled;
+}
+
+/*! Draws the tiles of the burst, then starts the inputs.
+  */
+void MPDecodeBenchmark::start()
+{
+    m_data.clear();
+    for (int i=0; i<m_tiles; ++i)
+        m_data << makeTile(i);
+
+    *m_output << QString("Decode benchmark: %1 tiles of %2 pixels decoded %3, input every %4 ms")
+                 .arg(m_tiles).arg(BENCH_DECODE_TILE_SIZE)
+                 .arg(m_guiThread ? "in the GUI thread" : QString("by %1 workers").arg(m_decoders->maxThreadCount()))
+                 .arg(BENCH_INPUT_INTERVAL) << endl;
+
+    m_phase = IdlePhase;
+    m_inputs = 0;
+    m_clock.start();
+    m_input->start();
+}
+
+/*! Handles a simulated input : composites a frame and records the latency.
+  */
+void MPDecodeBenchmark::customEvent(QEvent* event)
+{
+    if (event->type() != MPInputEvent::type() || m_phase == DonePhase)
+        return;
+
+    frame();
+    qreal latency = (m_clock.nsecsElapsed() - static_cast<MPInputEvent*>(event)->sent) / 1e6;
+    MPPaintProfiler& latencies = m_phase == IdlePhase ? m_idleLatencies : m_burstLatencies;
+    latencies.addSample(MPPaintProfiler::InputLatencyPhase, latency);
+    ++m_inputs;
+
+    if (m_phase == IdlePhase && m_inputs >= BENCH_IDLE_INPUTS)
+        startBurst();
+    else if (m_phase == BurstPhase && m_decoded >= m_tiles)
+        finish();
+}
+
+/*! Starts decoding the tiles.
+  */
+void MPDecodeBenchmark::startBurst()
+{
+    m_phase = BurstPhase;
+    m_inputs = 0;
+    m_burst.start();
+    if (m_guiThread) {
+        m_next = 0;
+        QMetaObject::invokeMethod(this, "decodeNext", Qt::QueuedConnection);
+    }
+    else {
+        for (int i=0; i<m_tiles; ++i)
+            m_decoders->start(new MPTileDecodeJob(m_manager, tileId(i), 0, i, 0, BENCH_DECODE_ZOOM, m_data[i]));
+    }
+}
+
+/*! Decodes the next tile in the GUI thread, then posts the following one,
+  as tiles were decoded when their download was received.
+  */
+void MPDecodeBenchmark::decodeNext()
+{
+    MPTileDecodeJob job(m_manager, tileId(m_next), 0, m_next, 0, BENCH_DECODE_ZOOM, m_data[m_next]);
+    job.run();
+    if (++m_next < m_tiles)
+        QMetaObject::invokeMethod(this, "decodeNext", Qt::QueuedConnection);
+}
+
+/*! When decoded tiles are cached: counts them.
+  */
+void MPDecodeBenchmark::onImageDecoded()
+{
+    m_decoded = 0;
+    for (int i=0; i<m_tiles; ++i)
+        if (m_manager->cache()->contains(tileId(i)))
+            ++m_decoded;
+    if (m_decoded >= m_tiles && m_burstElapsed < 0)
+        m_burstElapsed = m_burst.nsecsElapsed();
+}
+
+/*! Composites the cached tiles into the frame, as the background layer does.
+  */
+void MPDecodeBenchmark::frame()
+{
+    m_frame.fill(0);
+    QPainter P(&m_frame);
+    int columns = (BENCH_FRAME_WIDTH + BENCH_DECODE_TILE_SIZE - 1) / BENCH_DECODE_TILE_SIZE;
+    int rows = (BENCH_FRAME_HEIGHT + BENCH_DECODE_TILE_SIZE - 1) / BENCH_DECODE_TILE_SIZE;
+    for (int i=0; i<columns*rows && i<m_tiles; ++i) {
+        QImage tile = m_manager->cache()->peek(tileId(i));
+        if (!tile.isNull())
+            P.drawImage((i % columns) * BENCH_DECODE_TILE_SIZE, (i / columns) * BENCH_DECODE_TILE_SIZE, tile);
+    }
+}
+
+/*! Stops the inputs and writes the results.
+  */
+void MPDecodeBenchmark::finish()
+{
+    m_phase = DonePhase;
+    m_input->stop();
+    report("idle", m_idleLatencies);
+    report("burst", m_burstLatencies);
+    *m_output << QString("  burst decoded in %1 ms").arg(m_burstElapsed / 1e6, 0, 'f', 1) << endl;
+    emit finished();
+}
+
+/*! Writes the percentiles of \a latencies to the output.
+  */
+void MPDecodeBenchmark::report(const QString& name, const MPPaintProfiler& latencies)
+{
+    MPPaintProfiler::Phase phase = MPPaintProfiler::InputLatencyPhase;
+    *m_output << QString("  %1: %2 inputs, input-to-frame latency p50 %3 ms, p95 %4 ms, p99 %5 ms, max %6 ms")
+                 .arg(name, -5).arg(latencies.sampleCount(phase))
+                 .arg(latencies.percentile(phase, 50), 0, 'f', 2)
+                 .arg(latencies.percentile(phase, 95), 0, 'f', 2)
+                 .arg(latencies.percentile(phase, 99), 0, 'f', 2)
+                 .arg(latencies.percentile(phase, 100), 0, 'f', 2) << endl;
+}
+
+/*! Identifier of the tile \a index of the burst in the image cache.
+  */
+QString MPDecodeBenchmark::tileId(int index)
+{
+    return QString("benchmark/%1/%2/0").arg(BENCH_DECODE_ZOOM).arg(index);
+}
+
+/*! PNG data of the tile \a index of the burst : roads and blocks drawn
+  at random, always the same for an index.
+  */
+QByteArray MPDecodeBenchmark::makeTile(int index)
+{
+    qsrand(index + 1);
+    QImage img(BENCH_DECODE_TILE_SIZE, BENCH_DECODE_TILE_SIZE, QImage::Format_RGB32);
+    img.fill(qRgb(242, 239, 233));
+    QPainter P(&img);
+    P.setRenderHint(QPainter::Antialiasing);
+    for (int i=0; i<12; ++i) {
+        P.fillRect(qrand() % BENCH_DECODE_TILE_SIZE, qrand() % BENCH_DECODE_TILE_SIZE,
+                   16 + qrand() % 48, 16 + qrand() % 48, QColor(qrand() % 256, qrand() % 256, qrand() % 256));
+    }
+    for (int i=0; i<24; ++i) {
+        P.setPen(QPen(QColor(qrand() % 256, qrand() % 256, qrand() % 256), 1 + qrand() % 6));
+        P.drawLine(qrand() % BENCH_DECODE_TILE_SIZE, qrand() % BENCH_DECODE_TILE_SIZE,
+                   qrand() % BENCH_DECODE_TILE_SIZE, qrand() % BENCH_DECODE_TILE_SIZE);
+    }
+    P.end();
+
+    QByteArray data;
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::WriteOnly);
+    img.save(&buffer, "PNG");
+    return data;
+}
@@ -0,0 +1,134 @@
+#ifndef MPDECODEBENCHMARK_H
+#define MPDECODEBENCHMARK_H
+
+#include <QObject>
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QEvent>
+#include <QImage>
+#include <QList>
+#include <QString>
+#include <QThread>
+
+#include "mppaintprofiler.h"
+
+#define BENCH_DECODE_TILES 200
+#define BENCH_DECODE_TILE_SIZE 256
+#define BENCH_DECODE_ZOOM 18
+#define BENCH_INPUT_INTERVAL 16
+#define BENCH_IDLE_INPUTS 60
+#define BENCH_FRAME_WIDTH 1024
+#define BENCH_FRAME_HEIGHT 768
+#define BENCH_LATENCY_WINDOW 100000
+
+class QTextStream;
+class QThreadPool;
+class MPImageManager;
+
+
+/*! A simulated user input, posted at \a sent (nanoseconds on the benchmark clock). */
+class MPInputEvent : public QEvent
+{
+public:
+    explicit MPInputEvent(qint64 aSent) : QEvent(type()), sent(aSent) {}
+    static QEvent::Type type();
+
+    /*! When the input was posted */
+    qint64 sent;
+};
+
+
+class MPInputThread : public QThread
+{
+public:
+    MPInputThread(QObject* aReceiver, const QElapsedTimer* aClock);
+
+    void stop();
+
+protected:
+    void run();
+
+    /*! Object the inputs are posted to */
+    QObject* m_receiver;
+    /*! Clock of the benchmark, started before the thread */
+    const QElapsedTimer* m_clock;
+    /*! Set by stop(), read by the thread */
+    QAtomicInt m_stopped;
+};
+
+
+class MPDecodeBenchmark : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit MPDecodeBenchmark(QTextStream* anOutput, QObject* parent = 0);
+    ~MPDecodeBenchmark();
+
+    void setTiles(int count);
+    void setGuiThreadDecoding(bool enabled);
+
+public slots:
+    void start();
+
+signals:
+    void finished();
+
+protected slots:
+    void onImageDecoded();
+    void decodeNext();
+
+protected:
+    /*! Steps of the benchmark */
+    enum Phase {
+        IdlePhase,   /*!< inputs without decoding, for reference */
+        BurstPhase,  /*!< inputs while the tiles are decoded */
+        DonePhase
+    };
+
+    void customEvent(QEvent* event);
+    void startBurst();
+    void frame();
+    void finish();
+    void report(const QString& name, const MPPaintProfiler& latencies);
+    static QString tileId(int index);
+    static QByteArray makeTile(int index);
+
+    /*! Where the results are written */
+    QTextStream* m_output;
+    /*! Manager receiving the decoded tiles, as in the application */
+    MPImageManager* m_manager;
+    /*! Decodes the tiles, like the manager's own pool */
+    QThreadPool* m_decoders;
+    /*! Posts the simulated inputs */
+    MPInputThread* m_input;
+    /*! Encoded tiles of the burst */
+    QList<QByteArray> m_data;
+    /*! Number of tiles of the burst */
+    int m_tiles;
+    /*! Whether tiles are decoded in the GUI thread, as before the decoding pool */
+    bool m_guiThread;
+    /*! Current step */
+    Phase m_phase;
+    /*! Inputs handled in the current step */
+    int m_inputs;
+    /*! Next tile to decode in the GUI thread */
+    int m_next;
+    /*! Number of tiles decoded and cached */
+    int m_decoded;
+    /*! Clock of the inputs, shared with m_input */
+    QElapsedTimer m_clock;
+    /*! Since the burst started */
+    QElapsedTimer m_burst;
+    /*! Duration of the burst, until the last tile is cached (nanoseconds) */
+    qint64 m_burstElapsed;
+    /*! Frame the cached tiles are composited into */
+    QImage m_frame;
+    /*! Input-to-frame latencies without decoding */
+    MPPaintProfiler m_idleLatencies;
+    /*! Input-to-frame latencies during the burst */
+    MPPaintProfiler m_burstLatencies;
+};
+
+#endif // MPDECODEBENCHMARK_H
@@ -0,0 +1,698 @@
+#include "mpimagemanager.h"
+
+#include <qmath.h>
+#include <QDesktopServices>
+#include <QMetaObject>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QPainter>
+#include <QRegExp>
+#include <QStringList>
+#include <QThreadPool>
+#include <QUrl>
+
+#include "IMapAdapter.h"
+#include "MerkaartorPreferences.h"
+
+#include "mpglobal.h"
+#include "mptilepack.h"
+
+
+/*!
+  \class MPImageManager
+  \brief Provides the images of the background layers, from a persistent tile cache.
+
+  Decoded images of all sources are kept in a shared MPTileCache, so
+  showing them again costs nothing. Tiles are stored in one MPTilePack per
+  tile source, in cacheDir(). Pack hits are decoded straight from the pack
+  mapping, so a map shown in a previous session is displayed without
+  network access. Missing tiles are
+  downloaded, stored in the pack, and dataReceived() tells the layers to
+  draw again.
+
+  Downloads are ordered by MPTileScheduler, center of the viewport first
+  (see setViewport()), with a limited number of connections per host. They
+  are dispatched once the current event is processed, so that all the tiles
+  requested by a redraw are ordered together. Tiles which leave the
+  viewport are cancelled, queued or running.
+
+  Tiles of the viewport predicted while panning can be prefetched (see
+  prefetch()). They are downloaded after all others, within PREFETCH_BUDGET
+  bytes in flight, and cancelled as soon as they leave the prediction.
+
+  Images are decoded by a pool of worker threads (MPTileDecodeJob), which
+  also store downloaded tiles in the packs. imageDecoded() is emitted once
+  per batch of decoded images, so that the layers draw again with the
+  cached images: the GUI thread only composites.
+
+  While a tile is missing, a placeholder is returned in its place (see
+  placeholder()), made of cached tiles of other zoom levels. It is built
+  once and cached along with the tiles, until the tile, or a tile it
+  could be made of, is decoded. Tiles without placeholder are remembered
+  until then too. Layers then draw again.
+
+  In offline mode (MerkaartorPreferences::getOfflineMode()), only the
+  stored tiles are shown.
+
+  Images of non tiled sources (WMS) are only kept in the memory cache.
+*/
+
+/*! \fn void MPImageManager::dataRequested()
+    This signal is emitted when an image download starts.
+*/
+/*! \fn void MPImageManager::dataReceived()
+    This signal is emitted when an image is downloaded.
+*/
+/*! \fn void MPImageManager::loadingFinished()
+    This signal is emitted when all image downloads are finished.
+*/
+/*! \fn void MPImageManager::imageDecoded()
+    This signal is emitted when images are decoded and available in cache().
+*/
+
+/*! Constructs a job decoding the tile \a id: from \a data if not empty
+  (and storing it in \a pack), otherwise from \a pack.
+  */
+MPTileDecodeJob::MPTileDecodeJob(MPImageManager* manager, const QString& id, MPTilePack* pack,
+                                 int x, int y, int z, const QByteArray& data) :
+    m_manager(manager),
+    m_id(id),
+    m_pack(pack),
+    m_x(x),
+    m_y(y),
+    m_z(z),
+    m_data(data)
+{
+}
+
+/*! Decodes the tile in a worker thread, and posts it to the manager.
+  */
+void MPTileDecodeJob::run()
+{
+    QImage img;
+    if (!m_data.isEmpty()) {
+        if (m_pack)
+            m_pack->insert(m_z, m_x, m_y, m_data);
+        img.loadFromData(m_data);
+    }
+    else if (m_pack) {
+        img = m_pack->image(m_z, m_x, m_y);
+    }
+    // Blitting premultiplied images requires no conversion
+    if (!img.isNull() && img.format() != QImage::Format_ARGB32_Premultiplied)
+        img = img.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+    QMetaObject::invokeMethod(m_manager, "onTileDecoded", Qt::QueuedConnection,
+                              Q_ARG(QString, m_id), Q_ARG(QImage, img));
+}
+
+/*! Constructs the image manager.
+  */
+MPImageManager::MPImageManager(QObject* parent) :
+    QObject(parent),
+    m_cacheMaxSize(TILE_PACK_MAX_SIZE),
+    m_dispatchPending(false),
+    m_prefetchBytes(0),
+    m_decodedPending(false)
+{
+    m_decoders = new QThreadPool(this);
+    m_network = new QNetworkAccessManager(this);
+    connect(m_network, SIGNAL(finished(QNetworkReply*)), this, SLOT(onReplyFinished(QNetworkReply*)));
+}
+
+/*! Destroys the image manager, closing the tile packs.
+  */
+MPImageManager::~MPImageManager()
+{
+    abortLoading();
+    m_decoders->waitForDone();
+    qDeleteAll(m_packs);
+}
+
+/*! Returns the specified tile if cached. Otherwise decodes the tile if
+  stored, or requests its download, and returns a placeholder meanwhile.
+  */
+QImage MPImageManager::getImage(IMapAdapter* anAdapter, int x, int y, int z)
+{
+    QString id = tileId(anAdapter, x, y, z);
+    QImage img = m_cache.image(id);
+    if (!img.isNull()) {
+        // A prefetched tile is shown : it leaves the budget
+        release(id);
+        return img;
+    }
+
+    if (!m_decoding.contains(id)) {
+        MPTilePack* store = pack(anAdapter);
+        if (store && store->contains(z, x, y))
+            decode(id, store, x, y, z);
+        else if (!isOffline())
+            request(anAdapter, x, y, z);
+    }
+    return placeholder(anAdapter, x, y, z);
+}
+
+/*! Returns the image at \a url if already downloaded, otherwise requests
+  its download and returns a null image. Used by non tiled sources.
+  */
+QImage MPImageManager::getImage(IMapAdapter* anAdapter, QString url)
+{
+    QImage img = m_cache.image(url);
+    if (!img.isNull() || m_decoding.contains(url))
+        return img;
+
+    if (!isOffline()) {
+        MPTileRequest tile;
+        tile.adapter = anAdapter;
+        tile.host = anAdapter->getHost();
+        tile.x = tile.y = 0;
+        tile.z = -1;
+        tile.url = url;
+        schedule(tile);
+    }
+    return img;
+}
+
+/*! Ensures the specified tile is stored, for a later use.
+  */
+QImage MPImageManager::prefetchImage(IMapAdapter* anAdapter, int x, int y, int z)
+{
+    MPTilePack* store = pack(anAdapter);
+    if ((!store || !store->contains(z, x, y)) && !isOffline())
+        request(anAdapter, x, y, z);
+    return QImage();
+}
+
+/*! Ensures the image at \a url is downloaded, for a later use.
+  */
+QImage MPImageManager::prefetchImage(IMapAdapter* anAdapter, QString url)
+{
+    getImage(anAdapter, url);
+    return QImage();
+}
+
+/*! Sets the directory of the tile packs. Opened packs are kept.
+  */
+void MPImageManager::setCacheDir(const QDir& path)
+{
+    m_cacheDir = path;
+    m_cacheDir.mkpath(".");
+}
+
+/*! Sets the maximum size of each tile pack, in megabytes.
+  */
+void MPImageManager::setCacheMaxSize(int max)
+{
+    m_cacheMaxSize = qint64(max) * 1024 * 1024;
+    foreach (MPTilePack* p, m_packs)
+        p->setMaxSize(m_cacheMaxSize);
+}
+
+/*! Aborts the queued and running downloads.
+  */
+void MPImageManager::abortLoading()
+{
+    QList<QNetworkReply*> replies = m_replies.keys();
+    bool loading = !replies.isEmpty() || !m_scheduler.isEmpty();
+    foreach (QString id, m_pending)
+        release(id);
+    m_replies.clear();
+    m_pending.clear();
+    m_running.clear();
+    m_scheduler.clear();
+    foreach (QNetworkReply* reply, replies) {
+        reply->abort();
+        reply->deleteLater();
+    }
+    if (loading)
+        emit loadingFinished();
+}
+
+/*! Tile pack of the specified tile source, opened on first use.
+  Returns 0 if the pack file cannot be opened.
+  */
+MPTilePack* MPImageManager::pack(IMapAdapter* anAdapter)
+{
+    QString name = anAdapter->getName();
+    if (m_packs.contains(name))
+        return m_packs.value(name);
+
+    MPTilePack* p = new MPTilePack();
+    p->setMaxSize(m_cacheMaxSize);
+    QString fileName = packFileName(name);
+    if (!p->open(m_cacheDir.filePath(fileName))) {
+        qWarning("Could not open tile pack %s", qPrintable(m_cacheDir.filePath(fileName)));
+        delete p;
+        p = 0;
+    }
+    m_packs.insert(name, p);
+    return p;
+}
+
+/*! Default directory of the tile packs, in the user cache location.
+  */
+QString MPImageManager::defaultCacheDir()
+{
+    return QDir(QDesktopServices::storageLocation(QDesktopServices::CacheLocation)).filePath("tiles");
+}
+
+/*! File name of the tile pack of the source \a name (see IMapAdapter::getName()).
+  */
+QString MPImageManager::packFileName(const QString& name)
+{
+    return QString(name).replace(QRegExp("[^\\w-]"), "_") + TILE_PACK_EXTENSION;
+}
+
+/*! Cache of the decoded images, shared by all sources.
+  */
+MPTileCache* MPImageManager::cache()
+{
+    return &m_cache;
+}
+
+/*! Checks whether images may not be downloaded.
+  */
+bool MPImageManager::isOffline() const
+{
+    return M_PREFS->getOfflineMode();
+}
+
+/*! Sets the viewport, in longitudes and latitudes, and the zoom level
+  of the displayed tiles. Downloads of tiles which are not wanted anymore
+  are cancelled (see MPTileScheduler::isWanted()).
+  */
+void MPImageManager::setViewport(const CoordBox& box, int zoom)
+{
+    m_scheduler.setViewport(box, zoom);
+    cancelUnwanted();
+}
+
+/*! Prefetches the tiles of \a box, the viewport predicted in a near future.
+
+  Tiles already decoded or being loaded are skipped, stored ones are
+  decoded, and missing ones are downloaded at low priority, as long as
+  the prefetched bytes stay within PREFETCH_BUDGET (see charge()).
+  Prefetches outside of \a box are cancelled.
+  */
+void MPImageManager::prefetch(IMapAdapter* anAdapter, const CoordBox& box)
+{
+    m_scheduler.setPrediction(box);
+    cancelUnwanted();
+
+    QRectF area = m_scheduler.prediction();
+    int z = m_scheduler.zoom();
+    int n = 1 << z;
+    MPTilePack* store = pack(anAdapter);
+    for (int x=qMax(0, qFloor(area.left())); x<qMin(n, qCeil(area.right())); ++x) {
+        for (int y=qMax(0, qFloor(area.top())); y<qMin(n, qCeil(area.bottom())); ++y) {
+            if (m_scheduler.isVisible(x, y, z))
+                continue;
+            QString id = tileId(anAdapter, x, y, z);
+            if (m_cache.contains(id) || m_decoding.contains(id) || m_pending.contains(id))
+                continue;
+            if (store && store->contains(z, x, y)) {
+                decode(id, store, x, y, z);
+            }
+            else if (!isOffline() && m_prefetchBytes + TILE_AVERAGE_BYTES <= PREFETCH_BUDGET) {
+                MPTileRequest tile;
+                tile.adapter = anAdapter;
+                tile.host = anAdapter->getHost();
+                tile.x = x;
+                tile.y = y;
+                tile.z = z;
+                tile.prefetch = true;
+                schedule(tile);
+            }
+        }
+    }
+}
+
+/*! Removes the predicted viewport (panning stopped) : prefetches not
+  started yet, or still downloading, are cancelled.
+  */
+void MPImageManager::clearPrediction()
+{
+    m_scheduler.clearPrediction();
+    cancelUnwanted();
+}
+
+/*! Cancels the queued and running downloads which are not
+  wanted anymore, see MPTileScheduler::isWanted(). Prefetched tiles
+  decoded meanwhile and not wanted anymore (or evicted) leave the budget.
+  */
+void MPImageManager::cancelUnwanted()
+{
+    QList<MPTileRequest> unwanted = m_scheduler.takeUnwanted();
+    foreach (MPTileRequest tile, unwanted) {
+        QString id = requestId(tile);
+        m_pending.remove(id);
+        release(id);
+    }
+
+    QList<QNetworkReply*> replies;
+    QHashIterator<QNetworkReply*, MPTileRequest> it(m_replies);
+    while (it.hasNext()) {
+        it.next();
+        if (!m_scheduler.isWanted(it.value()))
+            replies << it.key();
+    }
+    foreach (QNetworkReply* reply, replies) {
+        // Forget first, abort() emits finished()
+        release(requestId(m_replies.value(reply)));
+        forget(reply);
+        reply->abort();
+    }
+
+    QStringList decoded;
+    QHashIterator<QString, qint64> charged(m_prefetchCharges);
+    while (charged.hasNext()) {
+        QString id = charged.next().key();
+        if (m_pending.contains(id) || m_decoding.contains(id))
+            continue;
+        MPTileRequest tile;
+        QString name;
+        tile.prefetch = true;
+        if (!m_cache.contains(id) || !parseTileId(id, name, tile.x, tile.y, tile.z)
+                || !m_scheduler.isWanted(tile))
+            decoded << id;
+    }
+    foreach (QString id, decoded)
+        release(id);
+
+    if (unwanted.isEmpty() && replies.isEmpty())
+        return;
+    if (m_replies.isEmpty() && m_scheduler.isEmpty())
+        emit loadingFinished();
+    else
+        QMetaObject::invokeMethod(this, "dispatch", Qt::QueuedConnection);
+}
+
+/*! Downloads the specified tile, unless it is already queued.
+  */
+void MPImageManager::request(IMapAdapter* anAdapter, int x, int y, int z)
+{
+    MPTileRequest tile;
+    tile.adapter = anAdapter;
+    tile.host = anAdapter->getHost();
+    tile.x = x;
+    tile.y = y;
+    tile.z = z;
+    schedule(tile);
+}
+
+/*! Queues the download of \a tile, unless it is already queued
+  (prefetched tiles are then promoted), and posts a dispatch().
+  */
+void MPImageManager::schedule(const MPTileRequest& tile)
+{
+    QString id = requestId(tile);
+    if (m_pending.contains(id)) {
+        // A prefetched tile to show now
+        if (!tile.prefetch && m_scheduler.promote(tile)) {
+            release(id);
+            emit dataRequested();
+        }
+        return;
+    }
+    m_pending.insert(id);
+    m_scheduler.enqueue(tile);
+    // Prefetches are not shown in progress
+    if (tile.prefetch)
+        charge(id, TILE_AVERAGE_BYTES);
+    else
+        emit dataRequested();
+
+    if (!m_dispatchPending) {
+        m_dispatchPending = true;
+        QMetaObject::invokeMethod(this, "dispatch", Qt::QueuedConnection);
+    }
+}
+
+/*! Starts the most urgent queued downloads, as long as connections are available.
+  */
+void MPImageManager::dispatch()
+{
+    m_dispatchPending = false;
+    MPTileRequest tile;
+    while (m_scheduler.takeNext(m_running, tile))
+        download(tile);
+}
+
+/*! Starts the download of \a tile. The budget of a prefetch follows
+  its actual size, see onDownloadProgress().
+  */
+void MPImageManager::download(const MPTileRequest& tile)
+{
+    QString path = tile.z == -1 ? tile.url : tile.adapter->getQuery(tile.x, tile.y, tile.z);
+    QNetworkRequest req(QUrl(QString("http://%1%2").arg(tile.host).arg(path)));
+    req.setRawHeader("User-Agent", QString("Merkopolo/%1").arg(VERSION).toAscii());
+    QNetworkReply* reply = m_network->get(req);
+    if (tile.prefetch)
+        connect(reply, SIGNAL(downloadProgress(qint64,qint64)), this, SLOT(onDownloadProgress(qint64,qint64)));
+    m_replies.insert(reply, tile);
+    ++m_running[tile.host];
+}
+
+/*! Removes \a reply from the running downloads, releasing its connection.
+  */
+void MPImageManager::forget(QNetworkReply* reply)
+{
+    MPTileRequest tile = m_replies.take(reply);
+    m_pending.remove(requestId(tile));
+    if (--m_running[tile.host] <= 0)
+        m_running.remove(tile.host);
+    reply->deleteLater();
+}
+
+/*! Sets the budget taken by the prefetched tile \a id to \a bytes.
+  A tile is charged TILE_AVERAGE_BYTES while queued, then the bytes
+  downloaded (or announced), then the size of its decoded image, until it
+  is shown or not wanted anymore (see release()).
+  */
+void MPImageManager::charge(const QString& id, qint64 bytes)
+{
+    m_prefetchBytes += bytes - m_prefetchCharges.value(id);
+    m_prefetchCharges.insert(id, bytes);
+}
+
+/*! Gives back the budget taken by the prefetched tile \a id, if any.
+  */
+void MPImageManager::release(const QString& id)
+{
+    m_prefetchBytes -= m_prefetchCharges.take(id);
+}
+
+/*! Starts decoding the image \a id in a worker thread, see MPTileDecodeJob.
+  */
+void MPImageManager::decode(const QString& id, MPTilePack* store, int x, int y, int z, const QByteArray& data)
+{
+    m_decoding.insert(id);
+    m_decoders->start(new MPTileDecodeJob(this, id, store, x, y, z, data));
+}
+
+/*! A decoded image \a img is posted by a worker: caches it, and
+  posts onDecodedBatch() to tell the layers.
+  */
+void MPImageManager::onTileDecoded(const QString& id, const QImage& img)
+{
+    m_decoding.remove(id);
+    if (img.isNull()) {
+        release(id);
+        return;
+    }
+    if (m_prefetchCharges.contains(id))
+        charge(id, img.byteCount());
+    m_cache.insert(id, img);
+    dropPlaceholders(id);
+    if (!m_decodedPending) {
+        m_decodedPending = true;
+        QMetaObject::invokeMethod(this, "onDecodedBatch", Qt::QueuedConnection);
+    }
+}
+
+/*! Emits imageDecoded() once for the images decoded meanwhile.
+  */
+void MPImageManager::onDecodedBatch()
+{
+    m_decodedPending = false;
+    emit imageDecoded();
+}
+
+/*! Placeholder of the specified tile, see buildPlaceholder(). It is
+  cached under the tile identifier with TILE_PLACEHOLDER_SUFFIX, so that
+  repaints do not build it again, until a tile it depends on is decoded
+  (see dropPlaceholders()). A tile without placeholder is not tried again
+  before then.
+  */
+QImage MPImageManager::placeholder(IMapAdapter* anAdapter, int x, int y, int z)
+{
+    QString tile = tileId(anAdapter, x, y, z);
+    if (m_placeholderMisses.contains(tile))
+        return QImage();
+    QString id = tile + TILE_PLACEHOLDER_SUFFIX;
+    QImage img = m_cache.peek(id);
+    if (img.isNull()) {
+        img = buildPlaceholder(anAdapter, x, y, z);
+        if (img.isNull()) {
+            m_placeholderMisses.insert(tile);
+            return img;
+        }
+        m_cache.insert(id, img);
+        m_placeholders.insert(tile);
+    }
+    return img;
+}
+
+/*! Removes the cached placeholders the decoded image \a id replaces or
+  improves : the one of the tile, the ones of its descendants up to
+  TILE_PLACEHOLDER_LEVELS levels down, which may be made of it, and the
+  one of its parent, which may be made of its children. Tiles without
+  placeholder may now have one.
+  */
+void MPImageManager::dropPlaceholders(const QString& id)
+{
+    m_placeholderMisses.clear();
+
+    QString name;
+    int x, y, z;
+    if (!parseTileId(id, name, x, y, z))
+        return;
+    QMutableSetIterator<QString> it(m_placeholders);
+    while (it.hasNext()) {
+        QString tile = it.next();
+        QString pname;
+        int px, py, pz;
+        bool stale = !parseTileId(tile, pname, px, py, pz);
+        if (!stale && pname == name) {
+            int dz = pz - z;
+            stale = (dz >= 0 && dz <= TILE_PLACEHOLDER_LEVELS && (px >> dz) == x && (py >> dz) == y) ||
+                    (dz == -1 && px == (x >> 1) && py == (y >> 1));
+        }
+        // Placeholders evicted from the cache are forgotten too
+        QString placeholderId = tile + TILE_PLACEHOLDER_SUFFIX;
+        if (stale || !m_cache.contains(placeholderId)) {
+            m_cache.remove(placeholderId);
+            it.remove();
+        }
+    }
+}
+
+/*! Builds a placeholder of the specified tile from the cache : the closest
+  cached ancestor (up to TILE_PLACEHOLDER_LEVELS levels up), upscaled, or
+  else its cached children, downscaled. Returns a null image if none is cached.
+
+  Only decoded tiles are used, so placeholders cost no I/O nor decoding.
+  */
+QImage MPImageManager::buildPlaceholder(IMapAdapter* anAdapter, int x, int y, int z) const
+{
+    // Ancestor, after a zoom in
+    for (int dz=1; dz<=TILE_PLACEHOLDER_LEVELS && dz<=z; ++dz) {
+        QImage parent = m_cache.peek(tileId(anAdapter, x >> dz, y >> dz, z - dz));
+        if (parent.isNull())
+            continue;
+        int size = parent.width() >> dz;
+        if (size < 1)
+            break;
+        int mask = (1 << dz) - 1;
+        QRect part((x & mask) * size, (y & mask) * size, size, size);
+        return parent.copy(part).scaled(parent.size(), Qt::IgnoreAspectRatio, Qt::FastTransformation);
+    }
+
+    // Children, after a zoom out
+    QImage img;
+    QPainter P;
+    for (int i=0; i<4; ++i) {
+        QImage child = m_cache.peek(tileId(anAdapter, 2*x + i%2, 2*y + i/2, z + 1));
+        if (child.isNull())
+            continue;
+        if (img.isNull()) {
+            img = QImage(child.size(), QImage::Format_ARGB32_Premultiplied);
+            img.fill(0);
+            P.begin(&img);
+        }
+        QSize half = img.size() / 2;
+        P.drawImage(QRect(QPoint((i%2) * half.width(), (i/2) * half.height()), half), child);
+    }
+    if (P.isActive())
+        P.end();
+    return img;
+}
+
+/*! Identifier of the specified tile, unique among sources.
+  */
+QString MPImageManager::tileId(IMapAdapter* anAdapter, int x, int y, int z)
+{
+    return QString("%1/%2/%3/%4").arg(anAdapter->getName()).arg(z).arg(x).arg(y);
+}
+
+/*! Reads the source \a name and coordinates of the tile identifier \a id
+  (see tileId()). Returns false if \a id is not a tile identifier.
+  */
+bool MPImageManager::parseTileId(const QString& id, QString& name, int& x, int& y, int& z)
+{
+    // Tile identifiers end with "/z/x/y"
+    QStringList parts = id.split('/');
+    if (parts.size() < 4)
+        return false;
+    bool ok[3];
+    z = parts[parts.size() - 3].toInt(&ok[0]);
+    x = parts[parts.size() - 2].toInt(&ok[1]);
+    y = parts[parts.size() - 1].toInt(&ok[2]);
+    name = QStringList(parts.mid(0, parts.size() - 3)).join("/");
+    return ok[0] && ok[1] && ok[2];
+}
+
+/*! Identifier of the specified request: its URL for non tiled sources,
+  the tile identifier otherwise.
+  */
+QString MPImageManager::requestId(const MPTileRequest& tile)
+{
+    return tile.z == -1 ? tile.url : tileId(tile.adapter, tile.x, tile.y, tile.z);
+}
+
+/*! A prefetch is downloading : charges \a total bytes once announced,
+  the \a received ones otherwise (at least TILE_AVERAGE_BYTES).
+  */
+void MPImageManager::onDownloadProgress(qint64 received, qint64 total)
+{
+    QNetworkReply* reply = qobject_cast<QNetworkReply*>(sender());
+    if (!reply || !m_replies.contains(reply))
+        return;  // cancelled
+    qint64 bytes = total > 0 ? qMax(total, received) : qMax(received, qint64(TILE_AVERAGE_BYTES));
+    charge(requestId(m_replies.value(reply)), bytes);
+}
+
+/*! A download is finished : stores the image and tells the layers.
+  */
+void MPImageManager::onReplyFinished(QNetworkReply* reply)
+{
+    if (!m_replies.contains(reply))
+        return;  // cancelled
+    MPTileRequest tile = m_replies.value(reply);
+    forget(reply);
+
+    QByteArray data;
+    if (reply->error() == QNetworkReply::NoError)
+        data = reply->readAll();
+    else
+        qWarning("Could not download %s: %s", qPrintable(reply->url().toString()), qPrintable(reply->errorString()));
+
+    QString id = requestId(tile);
+    if (data.isEmpty()) {
+        release(id);
+    }
+    else {
+        // A prefetch keeps its budget until shown, see charge()
+        if (tile.prefetch)
+            charge(id, data.size());
+        m_cache.remove(id);
+        decode(id, tile.z == -1 ? 0 : pack(tile.adapter), tile.x, tile.y, tile.z, data);
+    }
+
+    if (!tile.prefetch)
+        emit dataReceived();
+    dispatch();
+    if (m_replies.isEmpty() && m_scheduler.isEmpty())
+        emit loadingFinished();
+}
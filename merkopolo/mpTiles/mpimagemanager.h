@@ -0,0 +1,145 @@
+#ifndef MPIMAGEMANAGER_H
+#define MPIMAGEMANAGER_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QDir>
+#include <QHash>
+#include <QImage>
+#include <QSet>
+#include <QRunnable>
+#include <QString>
+
+#include "IImageManager.h"
+
+#include "mptilecache.h"
+#include "mptilescheduler.h"
+
+#define TILE_PACK_EXTENSION ".mptp"
+#define TILE_PLACEHOLDER_LEVELS 4
+#define TILE_PLACEHOLDER_SUFFIX "#placeholder"
+#define PREFETCH_BUDGET (16*1024*1024)
+#define TILE_AVERAGE_BYTES (16*1024)
+
+class IMapAdapter;
+class QNetworkAccessManager;
+class QNetworkReply;
+class QThreadPool;
+class MPTilePack;
+class MPImageManager;
+
+
+class MPTileDecodeJob : public QRunnable
+{
+public:
+    MPTileDecodeJob(MPImageManager* manager, const QString& id, MPTilePack* pack,
+                    int x, int y, int z, const QByteArray& data = QByteArray());
+    void run();
+
+protected:
+    /*! Manager which receives the image */
+    MPImageManager* m_manager;
+    /*! Identifier of the image (tile identifier or URL) */
+    QString m_id;
+    /*! Pack the tile is read from or stored into, if any */
+    MPTilePack* m_pack;
+    /*! Tile coordinates */
+    int m_x, m_y, m_z;
+    /*! Downloaded data, empty to read the tile from the pack */
+    QByteArray m_data;
+};
+
+
+class MPImageManager : public QObject, public IImageManager
+{
+    Q_OBJECT
+
+public:
+    explicit MPImageManager(QObject* parent = 0);
+    ~MPImageManager();
+
+    QImage getImage(IMapAdapter* anAdapter, int x, int y, int z);
+    QImage getImage(IMapAdapter* anAdapter, QString url);
+    QImage prefetchImage(IMapAdapter* anAdapter, int x, int y, int z);
+    QImage prefetchImage(IMapAdapter* anAdapter, QString url);
+    void setCacheDir(const QDir& path);
+    void setCacheMaxSize(int max);
+    void abortLoading();
+
+    MPTilePack* pack(IMapAdapter* anAdapter);
+    MPTileCache* cache();
+    bool isOffline() const;
+    void setViewport(const CoordBox& box, int zoom);
+    void prefetch(IMapAdapter* anAdapter, const CoordBox& box);
+    void clearPrediction();
+
+    static QString defaultCacheDir();
+    static QString packFileName(const QString& name);
+
+signals:
+    void dataRequested();
+    void dataReceived();
+    void loadingFinished();
+    void imageDecoded();
+
+protected slots:
+    void onReplyFinished(QNetworkReply* reply);
+    void onTileDecoded(const QString& id, const QImage& img);
+    void onDecodedBatch();
+    void onDownloadProgress(qint64 received, qint64 total);
+    void dispatch();
+
+protected:
+    void request(IMapAdapter* anAdapter, int x, int y, int z);
+    void schedule(const MPTileRequest& tile);
+    void cancelUnwanted();
+    void download(const MPTileRequest& tile);
+    void forget(QNetworkReply* reply);
+    void charge(const QString& id, qint64 bytes);
+    void release(const QString& id);
+    void decode(const QString& id, MPTilePack* store, int x, int y, int z, const QByteArray& data = QByteArray());
+    QImage placeholder(IMapAdapter* anAdapter, int x, int y, int z);
+    QImage buildPlaceholder(IMapAdapter* anAdapter, int x, int y, int z) const;
+    void dropPlaceholders(const QString& id);
+    static QString tileId(IMapAdapter* anAdapter, int x, int y, int z);
+    static bool parseTileId(const QString& id, QString& name, int& x, int& y, int& z);
+    static QString requestId(const MPTileRequest& tile);
+
+    /*! Directory of the tile packs */
+    QDir m_cacheDir;
+    /*! Maximum size of each tile pack, in bytes */
+    qint64 m_cacheMaxSize;
+    /*! Tile packs, by tile source name */
+    QHash<QString, MPTilePack*> m_packs;
+    /*! Downloads tiles */
+    QNetworkAccessManager* m_network;
+    /*! Tiles being downloaded, by reply */
+    QHash<QNetworkReply*, MPTileRequest> m_replies;
+    /*! Identifiers of the tiles queued or being downloaded */
+    QSet<QString> m_pending;
+    /*! Orders the queued tiles */
+    MPTileScheduler m_scheduler;
+    /*! Number of downloads, by host */
+    QHash<QString, int> m_running;
+    /*! Whether dispatch() is already posted */
+    bool m_dispatchPending;
+    /*! Bytes of each prefetched tile not shown yet : estimated while
+      queued, then downloaded, then decoded */
+    QHash<QString, qint64> m_prefetchCharges;
+    /*! Sum of m_prefetchCharges, bounded by PREFETCH_BUDGET */
+    qint64 m_prefetchBytes;
+    /*! Decodes images */
+    QThreadPool* m_decoders;
+    /*! Identifiers of the images being decoded */
+    QSet<QString> m_decoding;
+    /*! Whether onDecodedBatch() is already posted */
+    bool m_decodedPending;
+    /*! Decoded images of all sources, by tile identifier or URL */
+    MPTileCache m_cache;
+    /*! Tiles whose placeholder is cached */
+    QSet<QString> m_placeholders;
+    /*! Tiles without placeholder, until another tile is decoded */
+    QSet<QString> m_placeholderMisses;
+};
+
+#endif // MPIMAGEMANAGER_H
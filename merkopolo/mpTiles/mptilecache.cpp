@@ -0,0 +1,118 @@
+#include "mptilecache.h"
+
+
+/*!
+  \class MPTileCache
+  \brief A byte-budgeted cache of decoded tile images.
+
+  Images are kept until their total size exceeds budget(), the least
+  recently used being evicted first. Tiles scrolled off screen are then
+  shown again without decoding nor I/O.
+
+  Lookups and evictions are counted (see stats()), to tune the budget.
+*/
+
+/*! Constructs a cache of \a budget bytes.
+  */
+MPTileCache::MPTileCache(int budget) :
+    m_images(budget),
+    m_hits(0),
+    m_misses(0),
+    m_evictions(0)
+{
+}
+
+/*! Returns the image of the specified tile, or a null image if it is not cached.
+  The lookup is counted as a hit or a miss.
+  */
+QImage MPTileCache::image(const QString& id)
+{
+    QImage* img = m_images.object(id);
+    if (!img) {
+        ++m_misses;
+        return QImage();
+    }
+    ++m_hits;
+    return *img;
+}
+
+/*! Returns the image of the specified tile, or a null image if it is
+  not cached, without counting a lookup.
+  */
+QImage MPTileCache::peek(const QString& id) const
+{
+    QImage* img = m_images.object(id);
+    return img ? *img : QImage();
+}
+
+/*! Checks whether the specified tile is cached, without counting a lookup.
+  */
+bool MPTileCache::contains(const QString& id) const
+{
+    return m_images.contains(id);
+}
+
+/*! Caches the image of the specified tile, evicting the least recently used ones if needed.
+  Images larger than the budget are not cached.
+  */
+void MPTileCache::insert(const QString& id, const QImage& img)
+{
+    if (img.isNull())
+        return;
+    // QCache evicts silently: count what disappeared
+    int before = m_images.count() - (m_images.contains(id) ? 1 : 0);
+    if (m_images.insert(id, new QImage(img), img.byteCount()))
+        m_evictions += before + 1 - m_images.count();
+}
+
+/*! Removes the image of the specified tile.
+  */
+void MPTileCache::remove(const QString& id)
+{
+    m_images.remove(id);
+}
+
+/*! Removes all images. Counters are kept.
+  */
+void MPTileCache::clear()
+{
+    m_images.clear();
+}
+
+/*! Sets the maximum size of the cached images, in bytes.
+  */
+void MPTileCache::setBudget(int bytes)
+{
+    int before = m_images.count();
+    m_images.setMaxCost(bytes);
+    m_evictions += before - m_images.count();
+}
+
+/*! Maximum size of the cached images, in bytes.
+  */
+int MPTileCache::budget() const
+{
+    return m_images.maxCost();
+}
+
+/*! Current counters of the cache.
+  */
+MPTileCacheStats MPTileCache::stats() const
+{
+    MPTileCacheStats s;
+    s.hits = m_hits;
+    s.misses = m_misses;
+    s.evictions = m_evictions;
+    s.bytes = m_images.totalCost();
+    s.count = m_images.count();
+    return s;
+}
+
+/*! Resets the hits, misses and evictions counters.
+  */
+void MPTileCache::resetStats()
+{
+    m_hits = 0;
+    m_misses = 0;
+    m_evictions = 0;
+}
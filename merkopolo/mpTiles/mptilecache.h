@@ -0,0 +1,55 @@
+#ifndef MPTILECACHE_H
+#define MPTILECACHE_H
+
+#include <QCache>
+#include <QImage>
+#include <QString>
+
+#define TILE_CACHE_BUDGET (64*1024*1024)
+
+
+/*! Counters of a tile cache. */
+struct MPTileCacheStats
+{
+    /*! Images found in the cache */
+    quint64 hits;
+    /*! Images not found in the cache */
+    quint64 misses;
+    /*! Images evicted to stay within the budget */
+    quint64 evictions;
+    /*! Bytes used by the cached images */
+    int bytes;
+    /*! Number of cached images */
+    int count;
+};
+
+
+class MPTileCache
+{
+public:
+    explicit MPTileCache(int budget = TILE_CACHE_BUDGET);
+
+    QImage image(const QString& id);
+    QImage peek(const QString& id) const;
+    bool contains(const QString& id) const;
+    void insert(const QString& id, const QImage& img);
+    void remove(const QString& id);
+    void clear();
+
+    void setBudget(int bytes);
+    int budget() const;
+    MPTileCacheStats stats() const;
+    void resetStats();
+
+protected:
+    /*! Decoded images, least recently used evicted first (cost in bytes) */
+    QCache<QString, QImage> m_images;
+    /*! Number of images found */
+    quint64 m_hits;
+    /*! Number of images not found */
+    quint64 m_misses;
+    /*! Number of images evicted */
+    quint64 m_evictions;
+};
+
+#endif // MPTILECACHE_H
@@ -0,0 +1,514 @@
+#include "mptilepack.h"
+
+#include <QList>
+#include <QPair>
+#include <QtAlgorithms>
+
+#include <string.h>
+
+
+/*!
+  \class MPTilePack
+  \brief A persistent tile store in a single memory-mapped file.
+
+  The file starts with a header (MPTilePackHeader) and an index of slots
+  (MPTilePackSlot), an open addressing hash table of z/x/y keys. Tile data
+  is appended after the index.
+
+  The whole file is mapped, so reading a tile is a lookup in the index and
+  decoding straight from the mapping, without copy. The file grows by
+  TILE_PACK_GROW bytes to keep appending into the mapping.
+
+  When the stored tiles exceed maxSize(), the least recently used tiles are
+  evicted. Their space is reclaimed by a compaction once half of the data
+  is dead. The index starts with TILE_PACK_INITIAL_SLOTS slots and, when
+  more than TILE_PACK_MAX_LOAD of them are used, the pack is compacted
+  into an index twice as large : the number of tiles is only bounded by
+  maxSize().
+
+  Reads and writes can come from several threads: readers share a lock
+  that writers take exclusively, since they may remap the file. Writers
+  are also serialized by their own mutex, so that a compaction copies the
+  tiles with only the shared lock, readers going on meanwhile, and takes
+  the exclusive lock only to switch to the compacted file.
+*/
+
+/*! Offset of the tile data in a pack file of \a slots index slots.
+  */
+static qint64 dataStartOf(quint32 slots)
+{
+    return sizeof(MPTilePackHeader) + qint64(slots) * sizeof(MPTilePackSlot);
+}
+
+/*! Constructs a closed tile pack.
+  */
+MPTilePack::MPTilePack() :
+    m_map(0),
+    m_mapSize(0),
+    m_maxSize(TILE_PACK_MAX_SIZE)
+{
+}
+
+/*! Destroys the tile pack, after closing its file.
+  */
+MPTilePack::~MPTilePack()
+{
+    close();
+}
+
+/*! Opens the specified pack file, which is created if it
+  does not exist or is not a valid pack.
+  */
+bool MPTilePack::open(const QString& fileName)
+{
+    QMutexLocker writer(&m_writeLock);
+    QWriteLocker locker(&m_lock);
+    return openFile(fileName);
+}
+
+/*! Closes the pack file. The index is kept on disk as it is.
+  */
+void MPTilePack::close()
+{
+    QMutexLocker writer(&m_writeLock);
+    QWriteLocker locker(&m_lock);
+    closeFile();
+}
+
+/*! Checks whether the pack file is opened.
+  */
+bool MPTilePack::isOpen() const
+{
+    QReadLocker locker(&m_lock);
+    return m_map != 0;
+}
+
+/*! Checks whether the specified tile is stored.
+  */
+bool MPTilePack::contains(int z, int x, int y) const
+{
+    QReadLocker locker(&m_lock);
+    return m_map && findSlot(tileKey(z, x, y)) != -1;
+}
+
+/*! Decodes the specified tile from the mapping, or returns
+  a null image if it is not stored.
+  */
+QImage MPTilePack::image(int z, int x, int y)
+{
+    QReadLocker locker(&m_lock);
+    QImage img;
+    int i = m_map ? findSlot(tileKey(z, x, y)) : -1;
+    if (i != -1) {
+        MPTilePackSlot* slot = slotAt(i);
+        touch(slot);
+        img.loadFromData(m_map + slot->offset, slot->size);
+    }
+    return img;
+}
+
+/*! Copies the encoded data of the specified tile, or returns
+  an empty array if it is not stored.
+  */
+QByteArray MPTilePack::data(int z, int x, int y)
+{
+    QReadLocker locker(&m_lock);
+    int i = m_map ? findSlot(tileKey(z, x, y)) : -1;
+    if (i == -1)
+        return QByteArray();
+    MPTilePackSlot* slot = slotAt(i);
+    touch(slot);
+    return QByteArray(reinterpret_cast<const char*>(m_map + slot->offset), slot->size);
+}
+
+/*! Stores the encoded data of the specified tile, replacing
+  the previous one. Evicts old tiles, and compacts the file, if needed.
+  */
+bool MPTilePack::insert(int z, int x, int y, const QByteArray& data)
+{
+    QMutexLocker writer(&m_writeLock);
+    bool inserted;
+    quint32 slots;
+    {
+        QWriteLocker locker(&m_lock);
+        if (!m_map || data.isEmpty())
+            return false;
+        inserted = insertKey(tileKey(z, x, y), data.constData(), data.size());
+        slots = compactionSlots();
+    }
+    if (slots)
+        compact(slots);
+    return inserted;
+}
+
+/*! Sets the maximum size of the stored tiles, in bytes.
+  */
+void MPTilePack::setMaxSize(qint64 bytes)
+{
+    QMutexLocker writer(&m_writeLock);
+    quint32 slots = 0;
+    {
+        QWriteLocker locker(&m_lock);
+        m_maxSize = bytes;
+        if (m_map && size() > m_maxSize) {
+            evict(0);
+            slots = compactionSlots();
+        }
+    }
+    if (slots)
+        compact(slots);
+}
+
+/*! Maximum size of the stored tiles, in bytes.
+  */
+qint64 MPTilePack::maxSize() const
+{
+    return m_maxSize;
+}
+
+/*! Size of the stored tiles, in bytes.
+  */
+qint64 MPTilePack::size() const
+{
+    if (!m_map)
+        return 0;
+    return header()->end - header()->dead - dataStart();
+}
+
+/*! Number of stored tiles.
+  */
+int MPTilePack::count() const
+{
+    return m_map ? header()->count : 0;
+}
+
+/*! Key of the specified tile in the index (never 0).
+  */
+quint64 MPTilePack::tileKey(int z, int x, int y)
+{
+    return (quint64(z + 1) << 56) | (quint64(x & 0xfffffff) << 28) | quint64(y & 0xfffffff);
+}
+
+/*! Opens and maps the file, see open().
+  */
+bool MPTilePack::openFile(const QString& fileName)
+{
+    closeFile();
+    m_file.setFileName(fileName);
+    if (!m_file.open(QIODevice::ReadWrite))
+        return false;
+
+    if (m_file.size() < dataStartOf(TILE_PACK_INITIAL_SLOTS))
+        return create(TILE_PACK_INITIAL_SLOTS);
+    if (!remap(m_file.size()))
+        return false;
+
+    MPTilePackHeader* h = header();
+    if (h->magic != TILE_PACK_MAGIC || h->version != TILE_PACK_VERSION || h->slots == 0 ||
+        h->end < quint64(dataStartOf(h->slots)) || h->end > quint64(m_mapSize))
+        return create(TILE_PACK_INITIAL_SLOTS);
+    validate();
+    return true;
+}
+
+/*! Drops the slots whose data is not within the written data (truncated
+  or corrupted file), and recounts the stored tiles and dead data.
+  */
+void MPTilePack::validate()
+{
+    MPTilePackHeader* h = header();
+    quint64 start = dataStart();
+    quint32 count = 0;
+    quint64 live = 0;
+    int dropped = 0;
+    for (int i=0; i<slotCount(); ++i) {
+        MPTilePackSlot* slot = slotAt(i);
+        if (slot->key == 0 || slot->key == TILE_PACK_TOMBSTONE)
+            continue;
+        if (slot->offset < start || slot->offset > h->end || slot->size > h->end - slot->offset) {
+            slot->key = TILE_PACK_TOMBSTONE;
+            ++dropped;
+            continue;
+        }
+        ++count;
+        live += slot->size;
+    }
+    if (dropped)
+        qWarning("Dropped %d invalid tiles of tile pack %s", dropped, qPrintable(m_file.fileName()));
+    h->count = count;
+    h->dead = live < h->end - start ? h->end - start - live : 0;
+}
+
+/*! Unmaps and closes the file, see close().
+  */
+void MPTilePack::closeFile()
+{
+    if (m_map)
+        m_file.unmap(m_map);
+    m_map = 0;
+    m_mapSize = 0;
+    m_file.close();
+}
+
+/*! Initializes an empty pack of \a slots index slots in the opened file.
+  */
+bool MPTilePack::create(quint32 slots)
+{
+    if (m_map)
+        m_file.unmap(m_map);
+    m_map = 0;
+    // Truncating first fills the index with zeros (empty slots)
+    if (!m_file.resize(0) || !remap(dataStartOf(slots) + TILE_PACK_GROW))
+        return false;
+
+    MPTilePackHeader* h = header();
+    h->magic = TILE_PACK_MAGIC;
+    h->version = TILE_PACK_VERSION;
+    h->slots = slots;
+    h->count = 0;
+    h->end = dataStartOf(slots);
+    h->dead = 0;
+    h->clock = 0;
+    return true;
+}
+
+/*! Resizes the file and maps it again.
+  */
+bool MPTilePack::remap(qint64 fileSize)
+{
+    if (m_map)
+        m_file.unmap(m_map);
+    m_map = 0;
+    m_mapSize = 0;
+    if (m_file.size() != fileSize && !m_file.resize(fileSize))
+        return false;
+    m_map = m_file.map(0, fileSize);
+    if (!m_map)
+        return false;
+    m_mapSize = fileSize;
+    return true;
+}
+
+/*! Offset of the tile data, after the index.
+  */
+qint64 MPTilePack::dataStart() const
+{
+    return dataStartOf(header()->slots);
+}
+
+/*! Number of index slots.
+  */
+int MPTilePack::slotCount() const
+{
+    return header()->slots;
+}
+
+/*! Header in the mapping.
+  */
+MPTilePackHeader* MPTilePack::header() const
+{
+    return reinterpret_cast<MPTilePackHeader*>(m_map);
+}
+
+/*! Index slot \a i in the mapping.
+  */
+MPTilePackSlot* MPTilePack::slotAt(int i) const
+{
+    return reinterpret_cast<MPTilePackSlot*>(m_map + sizeof(MPTilePackHeader)) + i;
+}
+
+/*! First probed slot of \a key, in an index of \a slots slots.
+  */
+static int probeStart(quint64 key, int slots)
+{
+    return int(((key * Q_UINT64_C(0x9e3779b97f4a7c15)) >> 32) % quint64(slots));
+}
+
+/*! Slot of \a key, or -1 if not stored.
+  */
+int MPTilePack::findSlot(quint64 key) const
+{
+    int slots = slotCount();
+    int start = probeStart(key, slots);
+    for (int n=0; n<slots; ++n) {
+        MPTilePackSlot* slot = slotAt((start + n) % slots);
+        if (slot->key == key)
+            return (start + n) % slots;
+        if (slot->key == 0)
+            break;
+    }
+    return -1;
+}
+
+/*! Slot where \a key is to be stored : its current slot,
+  or the first free one. Returns -1 if the index is full.
+  */
+int MPTilePack::freeSlot(quint64 key) const
+{
+    int existing = findSlot(key);
+    if (existing != -1)
+        return existing;
+
+    int slots = slotCount();
+    int start = probeStart(key, slots);
+    for (int n=0; n<slots; ++n) {
+        MPTilePackSlot* slot = slotAt((start + n) % slots);
+        if (slot->key == 0 || slot->key == TILE_PACK_TOMBSTONE)
+            return (start + n) % slots;
+    }
+    return -1;
+}
+
+/*! Marks \a slot as used now.
+
+  Readers only share the read lock : the clock of the mapping is
+  incremented under its own mutex, so that concurrent reads keep
+  distinct access times and the eviction order.
+  */
+void MPTilePack::touch(MPTilePackSlot* slot)
+{
+    QMutexLocker locker(&m_touchLock);
+    slot->used = ++header()->clock;
+}
+
+/*! Appends the data of \a key and indexes it. The write lock must be held.
+  The index is grown afterwards (see compactionSlots()), unless it is full
+  of tombstones : it is then rebuilt right away.
+  */
+bool MPTilePack::insertKey(quint64 key, const char* data, int length)
+{
+    int existing = findSlot(key);
+    qint64 replaced = existing != -1 ? slotAt(existing)->size : 0;
+    if (size() - replaced + length > m_maxSize)
+        evict(length);
+
+    int i = freeSlot(key);
+    if (i == -1) {
+        // Only tombstones left : rebuild the index
+        MPTilePack packed;
+        if (!writeCompacted(packed, slotCount()) || !switchTo(packed) || (i = freeSlot(key)) == -1)
+            return false;
+    }
+
+    quint64 end = header()->end;
+    if (qint64(end) + length > m_mapSize && !remap(m_mapSize + qMax(length, TILE_PACK_GROW)))
+        return false;
+    memcpy(m_map + end, data, length);
+
+    MPTilePackSlot* slot = slotAt(i);
+    if (slot->key == key)
+        header()->dead += slot->size;
+    else
+        ++header()->count;
+    slot->key = key;
+    slot->offset = end;
+    slot->size = length;
+    touch(slot);
+    header()->end = end + length;
+    return true;
+}
+
+/*! Evicts the least recently used tiles, until \a needed bytes can be
+  stored within 90% of the maximum size. The write lock must be held.
+  */
+void MPTilePack::evict(qint64 needed)
+{
+    QList< QPair<quint64, int> > slots;
+    for (int i=0; i<slotCount(); ++i) {
+        MPTilePackSlot* slot = slotAt(i);
+        if (slot->key != 0 && slot->key != TILE_PACK_TOMBSTONE)
+            slots << qMakePair(slot->used, i);
+    }
+    qSort(slots);
+
+    MPTilePackHeader* h = header();
+    qint64 target = m_maxSize * 9 / 10 - needed;
+    for (int n=0; n<slots.size(); ++n) {
+        if (size() <= target)
+            break;
+        MPTilePackSlot* slot = slotAt(slots[n].second);
+        h->dead += slot->size;
+        --h->count;
+        slot->key = TILE_PACK_TOMBSTONE;
+    }
+}
+
+/*! Number of index slots of the compacted file, if the pack is to be
+  compacted : twice as many when more than TILE_PACK_MAX_LOAD of them are
+  used, as many when half of the data is dead. Returns 0 otherwise.
+  */
+quint32 MPTilePack::compactionSlots() const
+{
+    MPTilePackHeader* h = header();
+    if (h->count > slotCount() * TILE_PACK_MAX_LOAD)
+        return h->slots * 2;
+    if (h->dead > (h->end - dataStart()) / 2)
+        return h->slots;
+    return 0;
+}
+
+/*! Rewrites the live tiles into a new file with an index of \a slots
+  slots, which replaces the pack file. This reclaims dead data, removes
+  tombstones from the index, and grows it.
+
+  The writer mutex must be held, but not the lock : tiles are copied with
+  the shared lock, readers going on, and the exclusive lock is only taken
+  to switch files.
+  */
+bool MPTilePack::compact(quint32 slots)
+{
+    MPTilePack packed;
+    {
+        QReadLocker locker(&m_lock);
+        if (!m_map || !writeCompacted(packed, slots))
+            return false;
+    }
+    QWriteLocker locker(&m_lock);
+    return switchTo(packed);
+}
+
+/*! Copies the live tiles into \a packed, a new file of \a slots slots
+  next to the pack file. The mapping must not change meanwhile.
+  */
+bool MPTilePack::writeCompacted(MPTilePack& packed, quint32 slots)
+{
+    QString packedName = m_file.fileName() + ".tmp";
+    QFile::remove(packedName);
+
+    packed.m_maxSize = m_maxSize;
+    packed.m_file.setFileName(packedName);
+    if (!packed.m_file.open(QIODevice::ReadWrite) || !packed.create(slots))
+        return false;
+    for (int i=0; i<slotCount(); ++i) {
+        MPTilePackSlot* slot = slotAt(i);
+        if (slot->key == 0 || slot->key == TILE_PACK_TOMBSTONE)
+            continue;
+        packed.insertKey(slot->key, reinterpret_cast<const char*>(m_map + slot->offset), slot->size);
+    }
+    return true;
+}
+
+/*! Replaces the pack file by the compacted \a packed one, with the
+  access times of the tiles, which readers may have changed during the
+  copy. The exclusive lock must be held.
+  */
+bool MPTilePack::switchTo(MPTilePack& packed)
+{
+    for (int i=0; i<slotCount(); ++i) {
+        MPTilePackSlot* slot = slotAt(i);
+        if (slot->key == 0 || slot->key == TILE_PACK_TOMBSTONE)
+            continue;
+        int j = packed.findSlot(slot->key);
+        if (j != -1)
+            packed.slotAt(j)->used = slot->used;
+    }
+    packed.header()->clock = header()->clock;
+    QString packedName = packed.m_file.fileName();
+    packed.closeFile();
+
+    QString fileName = m_file.fileName();
+    closeFile();
+    if (!QFile::remove(fileName) || !QFile::rename(packedName, fileName))
+        qWarning("Could not replace tile pack %s", qPrintable(fileName));
+    return openFile(fileName);
+}
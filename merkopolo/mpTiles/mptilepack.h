@@ -0,0 +1,114 @@
+#ifndef MPTILEPACK_H
+#define MPTILEPACK_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QImage>
+#include <QMutex>
+#include <QReadWriteLock>
+#include <QString>
+
+#define TILE_PACK_MAGIC 0x5054504d  // "MPTP"
+#define TILE_PACK_VERSION 2
+#define TILE_PACK_INITIAL_SLOTS 16384
+#define TILE_PACK_MAX_LOAD 0.75
+#define TILE_PACK_TOMBSTONE Q_UINT64_C(0xffffffffffffffff)
+#define TILE_PACK_GROW (8*1024*1024)
+#define TILE_PACK_MAX_SIZE (Q_INT64_C(512)*1024*1024)
+
+
+/*! Header of a tile pack file. */
+struct MPTilePackHeader
+{
+    /*! TILE_PACK_MAGIC */
+    quint32 magic;
+    /*! TILE_PACK_VERSION */
+    quint32 version;
+    /*! Number of index slots (grows with the stored tiles) */
+    quint32 slots;
+    /*! Number of stored tiles */
+    quint32 count;
+    /*! End of the written data, from the file start */
+    quint64 end;
+    /*! Bytes of data no longer indexed (replaced or evicted tiles) */
+    quint64 dead;
+    /*! Access counter, for least recently used eviction */
+    quint64 clock;
+    quint64 reserved[3];
+};
+
+
+/*! Index slot of a tile pack file. */
+struct MPTilePackSlot
+{
+    /*! Tile key (0 if empty, TILE_PACK_TOMBSTONE if removed) */
+    quint64 key;
+    /*! Offset of the tile data, from the file start */
+    quint64 offset;
+    /*! Size of the tile data */
+    quint32 size;
+    quint32 reserved;
+    /*! Last access (header clock) */
+    quint64 used;
+};
+
+
+class MPTilePack
+{
+public:
+    MPTilePack();
+    ~MPTilePack();
+
+    bool open(const QString& fileName);
+    void close();
+    bool isOpen() const;
+
+    bool contains(int z, int x, int y) const;
+    QImage image(int z, int x, int y);
+    QByteArray data(int z, int x, int y);
+    bool insert(int z, int x, int y, const QByteArray& data);
+
+    void setMaxSize(qint64 bytes);
+    qint64 maxSize() const;
+    qint64 size() const;
+    int count() const;
+
+    static quint64 tileKey(int z, int x, int y);
+
+protected:
+    bool openFile(const QString& fileName);
+    void closeFile();
+    bool create(quint32 slots);
+    void validate();
+    qint64 dataStart() const;
+    int slotCount() const;
+    bool remap(qint64 fileSize);
+    MPTilePackHeader* header() const;
+    MPTilePackSlot* slotAt(int i) const;
+    int findSlot(quint64 key) const;
+    int freeSlot(quint64 key) const;
+    void touch(MPTilePackSlot* slot);
+    bool insertKey(quint64 key, const char* data, int length);
+    void evict(qint64 needed);
+    quint32 compactionSlots() const;
+    bool compact(quint32 slots);
+    bool writeCompacted(MPTilePack& packed, quint32 slots);
+    bool switchTo(MPTilePack& packed);
+
+    /*! Pack file, opened read-write */
+    QFile m_file;
+    /*! Whole file mapping */
+    uchar* m_map;
+    /*! Size of m_map */
+    qint64 m_mapSize;
+    /*! Maximum size of the stored tiles */
+    qint64 m_maxSize;
+    /*! Readers decode from the mapping, writers may remap it */
+    mutable QReadWriteLock m_lock;
+    /*! Serializes the writers, so the mapping only changes under one of them */
+    QMutex m_writeLock;
+    /*! Serializes the access clock updates of concurrent readers */
+    QMutex m_touchLock;
+};
+
+#endif // MPTILEPACK_H
@@ -0,0 +1,235 @@
+#include "mptilescheduler.h"
+
+#include <qmath.h>
+
+
+/*!
+  \class MPTileScheduler
+  \brief Orders the tile downloads according to the viewport.
+
+  Tiles wait in a queue until a connection to their host is available,
+  at most TILE_HOST_CONNECTIONS per host. The next one is the closest to the
+  viewport center, tiles of other zoom levels coming after those of the
+  viewport zoom (TILE_ZOOM_PENALTY tiles away per level).
+
+  Tiles outside of the viewport (plus TILE_KEEP_MARGIN tiles), or more than
+  one zoom level away, are not wanted anymore: they are removed from the
+  queue when the viewport changes, see takeUnwanted().
+
+  Prefetched tiles are wanted within the predicted viewport (see
+  setPrediction()), and come after all others (TILE_PREFETCH_PENALTY).
+
+  Requests of non tiled sources are always wanted, and come first.
+*/
+
+/*! Constructs an empty scheduler, without viewport.
+  */
+MPTileScheduler::MPTileScheduler() :
+    m_zoom(0),
+    m_hasViewport(false)
+{
+}
+
+/*! Sets the viewport the tiles are ordered for. The predicted viewport
+  is removed if the zoom changes, since it was expressed at the previous one.
+  */
+void MPTileScheduler::setViewport(const CoordBox& box, int zoom)
+{
+    if (zoom != m_zoom)
+        clearPrediction();
+    m_area = tileArea(box, zoom);
+    m_zoom = zoom;
+    m_hasViewport = true;
+}
+
+/*! Sets the viewport predicted in a near future, where prefetched tiles are wanted.
+  It is expressed at the zoom of the viewport.
+  */
+void MPTileScheduler::setPrediction(const CoordBox& box)
+{
+    m_prediction = tileArea(box, m_zoom);
+}
+
+/*! Removes the predicted viewport: prefetched tiles are not wanted anymore.
+  */
+void MPTileScheduler::clearPrediction()
+{
+    m_prediction = QRectF();
+}
+
+/*! Adds a tile to download.
+  */
+void MPTileScheduler::enqueue(const MPTileRequest& tile)
+{
+    m_queue << tile;
+}
+
+/*! The queued tile matching \a tile is not prefetched anymore, it has
+  to be shown. Returns false if it was not queued as prefetched.
+  */
+bool MPTileScheduler::promote(const MPTileRequest& tile)
+{
+    for (int i=0; i<m_queue.size(); ++i) {
+        MPTileRequest& queued = m_queue[i];
+        if (queued.prefetch && queued.adapter == tile.adapter && queued.z == tile.z &&
+            queued.x == tile.x && queued.y == tile.y) {
+            queued.prefetch = false;
+            return true;
+        }
+    }
+    return false;
+}
+
+/*! Takes the most urgent tile of a host with less than TILE_HOST_CONNECTIONS
+  \a running downloads. Returns false if there is none.
+  */
+bool MPTileScheduler::takeNext(const QHash<QString, int>& running, MPTileRequest& tile)
+{
+    int best = -1;
+    qreal bestPriority = 0;
+    for (int i=0; i<m_queue.size(); ++i) {
+        if (running.value(m_queue[i].host) >= TILE_HOST_CONNECTIONS)
+            continue;
+        qreal p = priority(m_queue[i]);
+        if (best == -1 || p < bestPriority) {
+            best = i;
+            bestPriority = p;
+        }
+    }
+    if (best == -1)
+        return false;
+    tile = m_queue.takeAt(best);
+    return true;
+}
+
+/*! Removes and returns the queued tiles not wanted anymore.
+  */
+QList<MPTileRequest> MPTileScheduler::takeUnwanted()
+{
+    QList<MPTileRequest> unwanted;
+    QMutableListIterator<MPTileRequest> it(m_queue);
+    while (it.hasNext()) {
+        if (!isWanted(it.next())) {
+            unwanted << it.value();
+            it.remove();
+        }
+    }
+    return unwanted;
+}
+
+/*! Removes all queued tiles.
+  */
+void MPTileScheduler::clear()
+{
+    m_queue.clear();
+}
+
+/*! Checks whether \a tile intersects the viewport at a close zoom level,
+  or the predicted viewport if it is prefetched.
+  */
+bool MPTileScheduler::isWanted(const MPTileRequest& tile) const
+{
+    if (tile.z == -1 || !m_hasViewport)
+        return true;
+    if (isVisible(tile.x, tile.y, tile.z))
+        return true;
+    return tile.prefetch && isPredicted(tile.x, tile.y, tile.z);
+}
+
+/*! Checks whether the specified tile intersects the viewport (plus
+  TILE_KEEP_MARGIN tiles), at most one zoom level away.
+  */
+bool MPTileScheduler::isVisible(int x, int y, int z) const
+{
+    return m_hasViewport && intersects(m_area, m_zoom, x, y, z);
+}
+
+/*! Checks whether the specified tile intersects the predicted viewport.
+  */
+bool MPTileScheduler::isPredicted(int x, int y, int z) const
+{
+    return !m_prediction.isNull() && intersects(m_prediction, m_zoom, x, y, z);
+}
+
+/*! Zoom level of the viewport.
+  */
+int MPTileScheduler::zoom() const
+{
+    return m_zoom;
+}
+
+/*! Viewport in tile coordinates, at the viewport zoom.
+  */
+QRectF MPTileScheduler::area() const
+{
+    return m_area;
+}
+
+/*! Predicted viewport in tile coordinates, at the viewport zoom.
+  */
+QRectF MPTileScheduler::prediction() const
+{
+    return m_prediction;
+}
+
+/*! Checks whether the specified tile intersects \a area (tile
+  coordinates at \a zoom, plus TILE_KEEP_MARGIN tiles), at most one
+  zoom level away.
+  */
+bool MPTileScheduler::intersects(const QRectF& area, int zoom, int x, int y, int z)
+{
+    if (qAbs(z - zoom) > 1)
+        return false;
+    qreal scale = qPow(2, z - zoom);
+    QRectF scaled(area.topLeft() * scale, area.size() * scale);
+    scaled.adjust(-TILE_KEEP_MARGIN, -TILE_KEEP_MARGIN, TILE_KEEP_MARGIN, TILE_KEEP_MARGIN);
+    return scaled.intersects(QRectF(x, y, 1, 1));
+}
+
+/*! Checks whether no tile is waiting.
+  */
+bool MPTileScheduler::isEmpty() const
+{
+    return m_queue.isEmpty();
+}
+
+/*! Number of tiles waiting.
+  */
+int MPTileScheduler::size() const
+{
+    return m_queue.size();
+}
+
+/*! Area of \a box (longitudes and latitudes) in tile coordinates
+  at \a zoom, for the spherical mercator tiling scheme.
+  */
+QRectF MPTileScheduler::tileArea(const CoordBox& box, int zoom)
+{
+    QRectF r = QRectF(box.topLeft(), box.bottomRight()).normalized();
+    qreal n = qPow(2, zoom);
+    qreal top = qMin(qreal(85.0511), r.bottom()) * M_PI / 180;
+    qreal bottom = qMax(qreal(-85.0511), r.top()) * M_PI / 180;
+    qreal x0 = (r.left() + 180) / 360 * n;
+    qreal x1 = (r.right() + 180) / 360 * n;
+    qreal y0 = (1 - log(tan(top) + 1 / cos(top)) / M_PI) / 2 * n;
+    qreal y1 = (1 - log(tan(bottom) + 1 / cos(bottom)) / M_PI) / 2 * n;
+    return QRectF(QPointF(x0, y0), QPointF(x1, y1));
+}
+
+/*! Priority of \a tile, the lowest first : its distance (in tiles of the
+  viewport zoom) to the viewport center, plus TILE_ZOOM_PENALTY per zoom
+  level, plus TILE_PREFETCH_PENALTY if it is prefetched.
+  */
+qreal MPTileScheduler::priority(const MPTileRequest& tile) const
+{
+    if (tile.z == -1)
+        return -1;
+    if (!m_hasViewport)
+        return 0;
+
+    qreal scale = qPow(2, m_zoom - tile.z);
+    QPointF center((tile.x + 0.5) * scale, (tile.y + 0.5) * scale);
+    QPointF d = center - m_area.center();
+    return qSqrt(d.x()*d.x() + d.y()*d.y()) + qAbs(tile.z - m_zoom) * TILE_ZOOM_PENALTY +
+           (tile.prefetch ? TILE_PREFETCH_PENALTY : 0);
+}
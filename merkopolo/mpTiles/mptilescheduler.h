@@ -0,0 +1,78 @@
+#ifndef MPTILESCHEDULER_H
+#define MPTILESCHEDULER_H
+
+#include <QHash>
+#include <QList>
+#include <QRectF>
+#include <QString>
+
+#include "Coord.h"
+
+#define TILE_HOST_CONNECTIONS 4
+#define TILE_ZOOM_PENALTY 8
+#define TILE_KEEP_MARGIN 1
+#define TILE_PREFETCH_PENALTY 1000
+
+class IMapAdapter;
+
+
+/*! A tile to download. */
+struct MPTileRequest
+{
+    MPTileRequest() : adapter(0), x(0), y(0), z(0), prefetch(false) {}
+
+    /*! Adapter of the tile source */
+    IMapAdapter* adapter;
+    /*! Host serving the tile */
+    QString host;
+    /*! Tile coordinates (z is -1 for non tiled sources) */
+    int x, y, z;
+    /*! Image URL, for non tiled sources */
+    QString url;
+    /*! Whether the tile is prefetched (not shown yet) */
+    bool prefetch;
+};
+
+
+class MPTileScheduler
+{
+public:
+    MPTileScheduler();
+
+    void setViewport(const CoordBox& box, int zoom);
+    void setPrediction(const CoordBox& box);
+    void clearPrediction();
+    void enqueue(const MPTileRequest& tile);
+    bool promote(const MPTileRequest& tile);
+    bool takeNext(const QHash<QString, int>& running, MPTileRequest& tile);
+    QList<MPTileRequest> takeUnwanted();
+    void clear();
+
+    bool isWanted(const MPTileRequest& tile) const;
+    bool isVisible(int x, int y, int z) const;
+    bool isPredicted(int x, int y, int z) const;
+    int zoom() const;
+    QRectF area() const;
+    QRectF prediction() const;
+    bool isEmpty() const;
+    int size() const;
+
+    static QRectF tileArea(const CoordBox& box, int zoom);
+
+protected:
+    qreal priority(const MPTileRequest& tile) const;
+    static bool intersects(const QRectF& area, int zoom, int x, int y, int z);
+
+    /*! Tiles waiting for a connection */
+    QList<MPTileRequest> m_queue;
+    /*! Viewport in tile coordinates at m_zoom */
+    QRectF m_area;
+    /*! Predicted viewport in tile coordinates at m_zoom, null if none */
+    QRectF m_prediction;
+    /*! Zoom level of the viewport */
+    int m_zoom;
+    /*! Whether a viewport was set */
+    bool m_hasViewport;
+};
+
+#endif // MPTILESCHEDULER_H
@@ -0,0 +1,355 @@
+#include "mptileseeder.h"
+
+#include <qmath.h>
+#include <QBuffer>
+#include <QFile>
+#include <QImageReader>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QTextStream>
+#include <QTimer>
+#include <QUrl>
+
+#include "mpglobal.h"
+#include "mptilepack.h"
+#include "mptilescheduler.h"
+
+/*!
+  \class MPTileSeeder
+  \brief Downloads all the tiles of an area into a tile pack, without user interface.
+
+  Tiles are enumerated by zoom level, then row and column, and downloaded
+  with at most connections() parallel requests. Tiles already stored in
+  the pack are skipped, so seeding an area again only fetches the missing
+  ones.
+
+  The source is an URL with {z}, {x} and {y} placeholders. Since the
+  \c file scheme is supported, it can be a local directory of tiles.
+
+  The index of the first tile not done yet is saved every
+  SEED_REPORT_INTERVAL in the progress file, along with the progress
+  report. Seeding the same area again resumes from there, the file is
+  removed once the area is done.
+
+  The pack evicts its least recently used tiles beyond its maximum size,
+  which may be tiles of the area itself when the area does not fit: see
+  estimatedSize(). Once the area is done, the tiles are looked up in the
+  pack again, and the ones evicted meanwhile are reported as evicted()
+  instead of stored().
+*/
+
+/*! \fn void MPTileSeeder::finished()
+  This signal is emitted when all tiles of the area are done.
+  */
+
+
+/*! Constructs a seeder storing tiles into \a aPack, which must be opened.
+  */
+MPTileSeeder::MPTileSeeder(MPTilePack* aPack, QObject* parent) :
+    QObject(parent),
+    m_pack(aPack),
+    m_source(SEED_DEFAULT_SOURCE),
+    m_minZoom(0),
+    m_maxZoom(-1),
+    m_connections(SEED_CONNECTIONS),
+    m_next(0),
+    m_resume(0),
+    m_first(0),
+    m_stored(0),
+    m_skipped(0),
+    m_failed(0),
+    m_evicted(0),
+    m_bytes(0)
+{
+    m_network = new QNetworkAccessManager(this);
+    connect(m_network, SIGNAL(finished(QNetworkReply*)), this, SLOT(onReplyFinished(QNetworkReply*)));
+    m_reportTimer = new QTimer(this);
+    m_reportTimer->setInterval(SEED_REPORT_INTERVAL);
+    connect(m_reportTimer, SIGNAL(timeout()), this, SLOT(report()));
+}
+
+/*! Sets the URL of the tiles, with {z}, {x} and {y} placeholders.
+  A path without scheme is a local directory.
+  */
+void MPTileSeeder::setSource(const QString& urlTemplate)
+{
+    m_source = urlTemplate;
+}
+
+/*! Sets the seeded area : \a box (longitudes and latitudes), from
+  \a minZoom to \a maxZoom levels included.
+  */
+void MPTileSeeder::setArea(const CoordBox& box, int minZoom, int maxZoom)
+{
+    m_box = box;
+    m_minZoom = qBound(0, minZoom, SEED_MAX_ZOOM);
+    m_maxZoom = qBound(0, maxZoom, SEED_MAX_ZOOM);
+    m_tiles.clear();
+    for (int z=m_minZoom; z<=m_maxZoom; ++z) {
+        QRectF area = MPTileScheduler::tileArea(box, z);
+        int n = 1 << z;
+        int x0 = qBound(0, qFloor(area.left()), n - 1);
+        int y0 = qBound(0, qFloor(area.top()), n - 1);
+        int x1 = qBound(0, qCeil(area.right()) - 1, n - 1);
+        int y1 = qBound(0, qCeil(area.bottom()) - 1, n - 1);
+        m_tiles << QRect(QPoint(x0, y0), QPoint(qMax(x0, x1), qMax(y0, y1)));
+    }
+}
+
+/*! Sets the maximum number of parallel downloads, up to SEED_MAX_CONNECTIONS.
+  */
+void MPTileSeeder::setConnections(int connections)
+{
+    m_connections = qBound(1, connections, SEED_MAX_CONNECTIONS);
+}
+
+/*! Sets the file where the progress is saved, to resume seeding later.
+  */
+void MPTileSeeder::setProgressFile(const QString& fileName)
+{
+    m_progressFile = fileName;
+}
+
+/*! Number of tiles of the area.
+  */
+qint64 MPTileSeeder::total() const
+{
+    qint64 count = 0;
+    foreach (QRect r, m_tiles)
+        count += qint64(r.width()) * r.height();
+    return count;
+}
+
+/*! Number of tiles downloaded and still stored once the area is done.
+  */
+qint64 MPTileSeeder::stored() const
+{
+    return m_stored;
+}
+
+/*! Number of tiles skipped, since they were already stored.
+  */
+qint64 MPTileSeeder::skipped() const
+{
+    return m_skipped;
+}
+
+/*! Number of tiles which could not be downloaded.
+  */
+qint64 MPTileSeeder::failed() const
+{
+    return m_failed;
+}
+
+/*! Number of tiles downloaded, then evicted from the pack before the
+  area was done since it does not fit.
+  */
+qint64 MPTileSeeder::evicted() const
+{
+    return m_evicted;
+}
+
+/*! Approximate size of the tiles of the area, in bytes: the average size
+  of the tiles already in the pack (SEED_TILE_SIZE_ESTIMATE for an empty
+  pack) times the number of tiles.
+  */
+qint64 MPTileSeeder::estimatedSize() const
+{
+    qint64 average = m_pack->count() ? m_pack->size() / m_pack->count() : SEED_TILE_SIZE_ESTIMATE;
+    return total() * qMax(qint64(1), average);
+}
+
+/*! URL of the specified tile.
+  */
+QString MPTileSeeder::tileUrl(int x, int y, int z) const
+{
+    return QString(m_source).replace("{z}", QString::number(z))
+                            .replace("{x}", QString::number(x))
+                            .replace("{y}", QString::number(y));
+}
+
+/*! Starts seeding, from the saved progress if any.
+  */
+void MPTileSeeder::start()
+{
+    loadProgress();
+    m_first = m_resume;
+    m_next = m_resume;
+    m_elapsed.start();
+    m_reportTimer->start();
+    QTextStream(stderr) << tr("Seeding %1 tiles, zoom %2 to %3, from %4")
+                           .arg(total()).arg(m_minZoom).arg(m_maxZoom).arg(m_source) << endl;
+    if (m_resume > 0)
+        QTextStream(stderr) << tr("Resuming at tile %1").arg(m_resume) << endl;
+    if (estimatedSize() > m_pack->maxSize())
+        QTextStream(stderr) << tr("Warning: the area needs about %1 MB, more than the %2 MB of the pack: "
+                                  "tiles will be evicted")
+                               .arg(estimatedSize() / (1024*1024)).arg(m_pack->maxSize() / (1024*1024)) << endl;
+    fill();
+}
+
+/*! Coordinates of the tile at \a index, in zoom, row and column order.
+  Returns false if the index is out of the area.
+  */
+bool MPTileSeeder::tileAt(qint64 index, int& x, int& y, int& z) const
+{
+    for (int i=0; i<m_tiles.size(); ++i) {
+        const QRect& r = m_tiles[i];
+        qint64 count = qint64(r.width()) * r.height();
+        if (index < count) {
+            z = m_minZoom + i;
+            y = r.top() + int(index / r.width());
+            x = r.left() + int(index % r.width());
+            return true;
+        }
+        index -= count;
+    }
+    return false;
+}
+
+/*! Starts downloads until all connections are busy. Tiles already
+  stored are skipped. Emits finished() when the area is done.
+  */
+void MPTileSeeder::fill()
+{
+    int x, y, z;
+    while (m_replies.size() < m_connections && tileAt(m_next, x, y, z)) {
+        if (m_pack->contains(z, x, y)) {
+            ++m_skipped;
+            complete(m_next);
+        }
+        else {
+            download(m_next, x, y, z);
+        }
+        ++m_next;
+    }
+
+    if (m_replies.isEmpty() && m_next >= total()) {
+        m_reportTimer->stop();
+        verify();
+        report();
+        // Seeding again retries the failed tiles
+        if (!m_progressFile.isEmpty())
+            QFile::remove(m_progressFile);
+        emit finished();
+    }
+}
+
+/*! Starts the download of the tile at \a index.
+  */
+void MPTileSeeder::download(qint64 index, int x, int y, int z)
+{
+    QString url = tileUrl(x, y, z);
+    QNetworkRequest req(url.contains("://") ? QUrl(url) : QUrl::fromLocalFile(url));
+    req.setRawHeader("User-Agent", QString("Merkopolo/%1").arg(VERSION).toAscii());
+    m_replies.insert(m_network->get(req), index);
+}
+
+/*! Marks the tile at \a index as done, and moves the resume index
+  past the tiles done in a row.
+  */
+void MPTileSeeder::complete(qint64 index)
+{
+    m_completed.insert(index);
+    while (m_completed.remove(m_resume))
+        ++m_resume;
+}
+
+/*! Looks the tiles of the area up in the pack again, and counts the
+  ones missing as evicted rather than stored.
+  */
+void MPTileSeeder::verify()
+{
+    qint64 present = 0;
+    int x, y, z;
+    for (qint64 i=m_first; tileAt(i, x, y, z); ++i) {
+        if (m_pack->contains(z, x, y))
+            ++present;
+    }
+    qint64 lost = qBound(qint64(0), m_stored + m_skipped - present, m_stored);
+    m_stored -= lost;
+    m_evicted += lost;
+    if (lost)
+        QTextStream(stderr) << tr("Warning: %1 tiles were evicted, the area does not fit in %2 MB (see --max-size)")
+                               .arg(lost).arg(m_pack->maxSize() / (1024*1024)) << endl;
+}
+
+/*! A download is finished : stores the tile if it is an image.
+  */
+void MPTileSeeder::onReplyFinished(QNetworkReply* reply)
+{
+    reply->deleteLater();
+    if (!m_replies.contains(reply))
+        return;
+    qint64 index = m_replies.take(reply);
+    int x, y, z;
+    tileAt(index, x, y, z);
+
+    QByteArray data;
+    if (reply->error() == QNetworkReply::NoError)
+        data = reply->readAll();
+    QBuffer buffer(&data);
+    if (!data.isEmpty() && QImageReader(&buffer).canRead() && m_pack->insert(z, x, y, data)) {
+        ++m_stored;
+        m_bytes += data.size();
+    }
+    else {
+        ++m_failed;
+        qWarning("Could not seed %s: %s", qPrintable(reply->url().toString()),
+                 qPrintable(reply->error() != QNetworkReply::NoError ? reply->errorString() : tr("not an image")));
+    }
+    complete(index);
+    fill();
+}
+
+/*! Prints the progress and the throughput, and saves the progress.
+  */
+void MPTileSeeder::report()
+{
+    qreal seconds = qMax(qint64(1), m_elapsed.elapsed()) / 1000.0;
+    qint64 count = total();
+    qint64 done = m_stored + m_skipped + m_failed + m_evicted;
+    QTextStream(stderr) << tr("%1/%2 tiles (%3%) : %4 stored, %5 present, %6 failed, %7 evicted - %8 tiles/s, %9 KB/s")
+                           .arg(m_resume).arg(count)
+                           .arg(count ? 100.0 * m_resume / count : 100.0, 0, 'f', 1)
+                           .arg(m_stored).arg(m_skipped).arg(m_failed).arg(m_evicted)
+                           .arg(done / seconds, 0, 'f', 1)
+                           .arg(m_bytes / 1024.0 / seconds, 0, 'f', 1) << endl;
+    saveProgress();
+}
+
+/*! Reads the resume index from the progress file, if it was
+  saved for the same area and source.
+  */
+void MPTileSeeder::loadProgress()
+{
+    m_resume = 0;
+    QFile file(m_progressFile);
+    if (m_progressFile.isEmpty() || !file.open(QIODevice::ReadOnly | QIODevice::Text))
+        return;
+    QTextStream in(&file);
+    if (in.readLine() == areaKey())
+        m_resume = qBound(qint64(0), in.readLine().toLongLong(), total());
+}
+
+/*! Writes the resume index in the progress file.
+  */
+void MPTileSeeder::saveProgress() const
+{
+    QFile file(m_progressFile);
+    if (m_progressFile.isEmpty() || !file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+        return;
+    QTextStream out(&file);
+    out << areaKey() << endl << m_resume << endl;
+}
+
+/*! Identifies the seeded area and source in the progress file.
+  */
+QString MPTileSeeder::areaKey() const
+{
+    return QString("%1,%2,%3,%4 %5-%6 %7")
+            .arg(m_box.left(), 0, 'f', 6).arg(m_box.bottom(), 0, 'f', 6)
+            .arg(m_box.right(), 0, 'f', 6).arg(m_box.top(), 0, 'f', 6)
+            .arg(m_minZoom).arg(m_maxZoom).arg(m_source);
+}
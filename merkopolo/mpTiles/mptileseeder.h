@@ -0,0 +1,104 @@
+#ifndef MPTILESEEDER_H
+#define MPTILESEEDER_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QRect>
+#include <QSet>
+#include <QString>
+#include <QVector>
+
+#include "Coord.h"
+
+#define SEED_DEFAULT_SOURCE "http://tile.openstreetmap.org/{z}/{x}/{y}.png"
+#define SEED_DEFAULT_NAME "OSM Mapnik"
+#define SEED_CONNECTIONS 4
+#define SEED_MAX_CONNECTIONS 16
+#define SEED_MAX_ZOOM 19
+#define SEED_REPORT_INTERVAL 1000
+#define SEED_PROGRESS_EXTENSION ".seed"
+#define SEED_TILE_SIZE_ESTIMATE (16*1024)
+
+class QNetworkAccessManager;
+class QNetworkReply;
+class QTimer;
+class MPTilePack;
+
+
+class MPTileSeeder : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit MPTileSeeder(MPTilePack* aPack, QObject* parent = 0);
+
+    void setSource(const QString& urlTemplate);
+    void setArea(const CoordBox& box, int minZoom, int maxZoom);
+    void setConnections(int connections);
+    void setProgressFile(const QString& fileName);
+
+    qint64 total() const;
+    qint64 stored() const;
+    qint64 skipped() const;
+    qint64 failed() const;
+    qint64 evicted() const;
+    qint64 estimatedSize() const;
+
+    QString tileUrl(int x, int y, int z) const;
+
+public slots:
+    void start();
+
+signals:
+    void finished();
+
+protected slots:
+    void onReplyFinished(QNetworkReply* reply);
+    void report();
+
+protected:
+    bool tileAt(qint64 index, int& x, int& y, int& z) const;
+    void fill();
+    void download(qint64 index, int x, int y, int z);
+    void complete(qint64 index);
+    void verify();
+    void loadProgress();
+    void saveProgress() const;
+    QString areaKey() const;
+
+    /*! Pack the tiles are stored into */
+    MPTilePack* m_pack;
+    /*! Downloads the tiles */
+    QNetworkAccessManager* m_network;
+    /*! Prints the progress every SEED_REPORT_INTERVAL */
+    QTimer* m_reportTimer;
+    /*! URL of the tiles, with {z}, {x} and {y} placeholders */
+    QString m_source;
+    /*! Seeded area */
+    CoordBox m_box;
+    /*! Seeded zoom levels */
+    int m_minZoom, m_maxZoom;
+    /*! Tiles of the area at each seeded zoom level, in tile coordinates */
+    QVector<QRect> m_tiles;
+    /*! Maximum number of parallel downloads */
+    int m_connections;
+    /*! File where the resume index is saved, none if empty */
+    QString m_progressFile;
+    /*! Index of the next tile to seed, in zoom, row and column order */
+    qint64 m_next;
+    /*! Indexes of the tiles being downloaded */
+    QHash<QNetworkReply*, qint64> m_replies;
+    /*! Indexes of the tiles done after m_resume, while earlier ones are running */
+    QSet<qint64> m_completed;
+    /*! All tiles before this index are done (resume index) */
+    qint64 m_resume;
+    /*! Resume index at the start, tiles before it are not counted */
+    qint64 m_first;
+    /*! Counters */
+    qint64 m_stored, m_skipped, m_failed, m_evicted, m_bytes;
+    /*! Since the start */
+    QElapsedTimer m_elapsed;
+};
+
+#endif // MPTILESEEDER_H
@@ -10,7 +10,8 @@
   */
 InfosDock::InfosDock(QWidget *parent) :
     BaseDock(parent),
-    m_text(new QTextBrowser(this))
+    m_text(new QTextBrowser(this)),
+    m_document(0)
 {
     setMinimumSize(220,100);
     setWindowTitle(tr("Info"));
@@ -18,6 +19,9 @@ InfosDock::InfosDock(QWidget *parent) :
 
     m_text->setReadOnly(true);
     m_text->setOpenLinks(false);
+    // Own document, not deleted by the browser when swapped with hover ones
+    m_document = new QTextDocument(this);
+    m_text->setDocument(m_document);
     setWidget(m_text);
 }
 
@@ -33,6 +37,7 @@ InfosDock::~InfosDock(void)
 void InfosDock::setHtml(QString html)
 {
     m_currentHtml = html;
+    showDocument(QSharedPointer<QTextDocument>());
     m_text->setHtml(html);
 }
 
@@ -40,16 +45,37 @@ void InfosDock::setHtml(QString html)
   */
 void InfosDock::setHoverHtml(QString html)
 {
+    showDocument(QSharedPointer<QTextDocument>());
     m_text->setHtml(html);
 }
 
+/*! Temporary content, already parsed (will not override current content).
+  The document is shown as is, which avoids parsing HTML again.
+  */
+void InfosDock::setHoverDocument(QSharedPointer<QTextDocument> document)
+{
+    showDocument(document);
+}
+
 /*! Remove hover content and show current content.
   */
 void InfosDock::unsetHoverHtml()
 {
+    showDocument(QSharedPointer<QTextDocument>());
     m_text->setHtml(m_currentHtml);
 }
 
+/*! Shows \a document, or the dock's own document if null.
+  */
+void InfosDock::showDocument(QSharedPointer<QTextDocument> document)
+{
+    if (document == m_hoverDocument)
+        return;
+    // Swap documents before releasing the previous one
+    m_text->setDocument(document ? document.data() : m_document);
+    m_hoverDocument = document;
+}
+
 /*! Return the current HTML content.
   */
 QString InfosDock::getHtml()
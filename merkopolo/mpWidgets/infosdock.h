@@ -2,7 +2,9 @@
 #define INFOSDOCK_H
 
 #include <QString>
+#include <QSharedPointer>
 #include <QTextBrowser>
+#include <QTextDocument>
 
 #include "basedock.h"
 
@@ -16,13 +18,20 @@ public:
     void setHtml(QString html);
     QString getHtml();
     void setHoverHtml(QString html);
+    void setHoverDocument(QSharedPointer<QTextDocument> document);
     void unsetHoverHtml();
 
 private:
+    void showDocument(QSharedPointer<QTextDocument> document);
+
     /*! A widget to display HTML content. */
     QTextBrowser* m_text;
     /*! Current HTML content. */
     QString m_currentHtml;
+    /*! Document of the current content, owned by the dock. */
+    QTextDocument* m_document;
+    /*! Shown hover document, kept alive while displayed. */
+    QSharedPointer<QTextDocument> m_hoverDocument;
 };
 
 #endif // INFOSDOCK_H
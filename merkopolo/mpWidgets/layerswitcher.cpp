@@ -111,20 +111,31 @@ LayerSwitcher::~LayerSwitcher()
 
 /*! Associate a \a Document to this layer switcher.
 
-  A SwitchButton will be added for each layer of the Document (layers with no name will be ignored).
+  The buttons of the previous document are removed, and a SwitchButton
+  will be added for each layer of the Document (layers with no name will be ignored).
   */
 void LayerSwitcher::setDocument(Document* doc)
 {
-    SwitchButton* btn = NULL;
-    for (int i=0; i < doc->layerSize(); i++) {
-        Layer* l = doc->getLayer(i);
-        if (l->name().isEmpty())
-            continue;   // Do not show buttons for unnamed layers
-        btn = new SwitchButton(l, this);
-        connect(btn, SIGNAL(toggled(bool, Layer*)), this, SLOT(switchToggled(bool, Layer*)));
-        connect(btn, SIGNAL(checked(bool, Layer*)), this, SLOT(switchChecked(bool, Layer*)));
-        layout()->addWidget(btn);
+    QLayoutItem* item;
+    while ((item = layout()->takeAt(0))) {
+        delete item->widget();
+        delete item;
     }
+    for (int i=0; i < doc->layerSize(); i++)
+        addLayer(doc->getLayer(i));
+}
+
+/*! Adds a SwitchButton for a layer \a l added to the document after
+  setDocument() (layers with no name will be ignored).
+  */
+void LayerSwitcher::addLayer(Layer* l)
+{
+    if (l->name().isEmpty())
+        return;   // Do not show buttons for unnamed layers
+    SwitchButton* btn = new SwitchButton(l, this);
+    connect(btn, SIGNAL(toggled(bool, Layer*)), this, SLOT(switchToggled(bool, Layer*)));
+    connect(btn, SIGNAL(checked(bool, Layer*)), this, SLOT(switchChecked(bool, Layer*)));
+    layout()->addWidget(btn);
     this->adjustSize();
 }
 
@@ -56,6 +56,7 @@ signals:
 public slots:
     void refreshButtons();
     void setDocument(Document*);
+    void addLayer(Layer*);
     void switchToggled(bool, Layer*);
     void switchChecked(bool, Layer*);
 
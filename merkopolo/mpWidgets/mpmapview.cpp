@@ -1,13 +1,20 @@
 #include "mpmapview.h"
 
 #include <QPainter>
+#include <QElapsedTimer>
 #include "Document.h"
 #include "LayerIterator.h"
 #include "ImageMapLayer.h"
+#include "Node.h"
+#include "Way.h"
 
 #include "mpwindow.h"
+#include "mpdocument.h"
 #include "baseinteraction.h"
 #include "layerswitcher.h"
+#include "mptilerenderer.h"
+#include "mpreprojector.h"
+#include "mplodcache.h"
 
 /*!
   \class MPMapView
@@ -29,6 +36,9 @@
 /*! \fn void MPMapView::painted(qlonglong)
   This signal is emitted when the map view is painted.
   */
+/*! \fn void MPMapView::profiled()
+  This signal is emitted when new paint phases durations are available in profiler().
+  */
 /*! \fn void MPMapView::imageRequested(int)
   This signal is emitted when a image (tile) download is requested.
   */
@@ -38,6 +48,14 @@
 /*! \fn void MPMapView::imageFinished()
   This signal is emitted when all images (tiles) downloads are finished.
   */
+/*! \fn void MPMapView::panPredicted(const CoordBox&)
+  This signal is emitted while panning, with the viewport expected
+  PREFETCH_HORIZON milliseconds ahead at the current pan velocity.
+  */
+/*! \fn void MPMapView::panPredictionCleared()
+  This signal is emitted when the last viewport of panPredicted() is not
+  expected anymore : panning stopped, or the map was zoomed.
+  */
 
 
 /*! Constructs the map widget.
@@ -46,10 +64,21 @@ MPMapView::MPMapView(MPWindow *parent) :
     MapView(parent),
     m_window(parent),
     m_layerswitcher(0),
-    m_numImages(0)
+    m_tilerenderer(0),
+    m_reprojector(0),
+    m_featureInfos(FEATURE_INFO_CACHE_SIZE),
+    m_numImages(0),
+    m_predictionScale(0)
 {
     m_layerswitcher = new LayerSwitcher(this);
-    connect(m_layerswitcher, SIGNAL(layerSwitched()), this, SLOT(invalidateAll()));
+    connect(m_layerswitcher, SIGNAL(layerSwitched()), this, SLOT(on_layerSwitched()));
+
+    m_tilerenderer = new MPTileRenderer(this);
+    connect(m_tilerenderer, SIGNAL(tileRendered(QRect)), this, SLOT(update()));
+    connect(m_tilerenderer, SIGNAL(profiled(qlonglong,qlonglong,qlonglong)),
+            this, SLOT(on_renderProfiled(qlonglong,qlonglong,qlonglong)));
+    m_reprojector = new MPReprojector(this);
+    connect(m_reprojector, SIGNAL(finished()), this, SLOT(on_reprojected()));
 
     // Hide intermediary points on ways
     M_PREFS->setTrackPointsVisible(false);
@@ -87,18 +116,68 @@ void MPMapView::updateDefaultCursor()
 }
 
 /*! A basic slot to force repaint() of background and foreground.
+  The static buffer is rendered again completely (no pan by blit).
   */
 void MPMapView::invalidateAll()
 {
+    m_tilerenderer->discard();
     invalidate(true, true);
 }
 
+/*! When a layer is shown or hidden from the layer switcher.
+
+  Layers keep their rendered surfaces, so this only composites them again
+  (layers shown without an up to date surface are rendered).
+  */
+void MPMapView::on_layerSwitched()
+{
+    m_tilerenderer->render(renderOptions());
+    update();
+}
+
 /*! Load the document content into the view and populate the layer switcher.
+  The view is redrawn when simplified ways of the document are built.
   */
 void MPMapView::setDocument(Document* aDoc)
 {
+    m_reprojector->cancel();
+    m_tilerenderer->clear();
+    // Simplified ways of a previous document no longer redraw
+    if (m_lod)
+        disconnect(m_lod, SIGNAL(built()), this, SLOT(invalidateAll()));
     MapView::setDocument(aDoc);
     m_layerswitcher->setDocument(aDoc);
+    MPDocument* doc = dynamic_cast<MPDocument*>(aDoc);
+    m_lod = doc ? doc->lod() : 0;
+    if (m_lod)
+        connect(m_lod, SIGNAL(built()), this, SLOT(invalidateAll()), Qt::UniqueConnection);
+}
+
+/*! Shows the layer \a aLayer, added to the document after setDocument(),
+  in the layer switcher, and redraws.
+  */
+void MPMapView::addLayer(Layer* aLayer)
+{
+    m_layerswitcher->addLayer(aLayer);
+    invalidateAll();
+}
+
+/*! Projects all the nodes of the document with the current projection,
+  in the background. To be called when the projection changes, or when
+  many features were added : redraws then do no projection math.
+  \see MPReprojector
+  */
+void MPMapView::reproject()
+{
+    m_reprojector->reproject();
+}
+
+/*! Stops the background projection of the nodes, before features
+  (or the whole document) are deleted.
+  */
+void MPMapView::cancelReprojection()
+{
+    m_reprojector->cancel();
 }
 
 /*! When mouse moves.
@@ -110,20 +189,80 @@ void MPMapView::mouseMoveEvent(QMouseEvent* event)
 }
 
 /*! When widget is painted.
+
+  Replaces MapView::paintEvent() so that features are never rendered in the
+  GUI thread: when the static buffer is outdated, a tiled render is started
+  on MPTileRenderer and the tiles already available are painted.
+
+  Each phase is timed in profiler(), with a nanosecond resolution since
+  most take less than a millisecond.
   */
 void MPMapView::paintEvent(QPaintEvent* event)
 {
     QTime Start(QTime::currentTime());
 
+    if (!document())
+        return;
+
     if (!StaticBufferUpToDate) {
-        setCursor(Qt::WaitCursor);  // show only Wait on features paint.
+        m_tilerenderer->render(renderOptions());
+        StaticBufferUpToDate = true;
+    }
+
+    QElapsedTimer phase;
+    phase.start();
+
+    QPainter P(this);
+    P.fillRect(rect(), palette().background());
+
+    // Background images (tiles)
+    for (LayerIterator<ImageMapLayer*> it(document()); !it.isEnd(); ++it) {
+        if (it.get()->isVisible())
+            it.get()->drawImage(&P);
+    }
+    m_profiler.addSample(MPPaintProfiler::BackgroundPhase, phase.nsecsElapsed() / 1e6);
+    phase.restart();
+
+    // Static foreground, moved along with pending pans and zooms
+    m_tilerenderer->paint(P, transform());
+    m_profiler.addSample(MPPaintProfiler::BlitPhase, phase.nsecsElapsed() / 1e6);
+    phase.restart();
+
+    if (renderOptions().options & RendererOptions::LatLonGridVisible)
+        drawLatLonGrid(P);
+    m_profiler.addSample(MPPaintProfiler::GridPhase, phase.nsecsElapsed() / 1e6);
+    phase.restart();
+
+    if (renderOptions().options & RendererOptions::ScaleVisible)
+        drawScale(P);
+    m_profiler.addSample(MPPaintProfiler::ScalePhase, phase.nsecsElapsed() / 1e6);
+    phase.restart();
+
+    if (interaction()) {
+        P.setRenderHint(QPainter::Antialiasing);
+        interaction()->paintEvent(event, P);
     }
-    MapView::paintEvent(event);
+    P.end();
+    m_profiler.addSample(MPPaintProfiler::InteractionPhase, phase.nsecsElapsed() / 1e6);
+
+    if (m_inputLatency.isValid()) {
+        m_profiler.addSample(MPPaintProfiler::InputLatencyPhase, m_inputLatency.nsecsElapsed() / 1e6);
+        m_inputLatency.invalidate();
+    }
+
     QTime Stop(QTime::currentTime());
     emit painted(Start.msecsTo(Stop));
+    emit profiled();
     updateDefaultCursor();
 }
 
+/*! Paint phases durations over the last frames.
+  */
+const MPPaintProfiler& MPMapView::profiler() const
+{
+    return m_profiler;
+}
+
 /*! Overriden resizeEvent() in order to place the layer switcher in
   top right corner of the map.
   */
@@ -134,6 +273,15 @@ void MPMapView::resizeEvent(QResizeEvent* event)
     MapView::resizeEvent(event);
 }
 
+/*! When background images are decoded : redraws the image layers
+  from the decoded images cache.
+  \see signal MPImageManager::imageDecoded()
+  */
+void MPMapView::on_imageDecoded()
+{
+    invalidate(false, true);
+}
+
 /*! When a layer requests an image.
   */
 void MPMapView::on_imageRequested(ImageMapLayer* aLayer)
@@ -179,10 +327,58 @@ void MPMapView::launch(Interaction* anInteraction)
 
     if (interaction) {
         connect(interaction, SIGNAL(idle()), this, SLOT(on_userIdle()));
+        connect(interaction, SIGNAL(activity()), this, SLOT(on_userActivity()));
+        connect(interaction, SIGNAL(panned(QPointF)), this, SLOT(on_panned(QPointF)));
         connect(interaction, SIGNAL(featureSnap(Feature*)), this, SLOT(on_featureSnap(Feature*)));
     }
 }
 
+/*! Returns the description of \a feature, built on first request.
+
+  Descriptions are cached by feature kind and id, so that hovering a
+  feature again, or showing it in several widgets, is free. A cached
+  description is built again if the tags or the geometry of the feature
+  changed since (see isFeatureInfoOf()).
+  */
+MPFeatureInfo MPMapView::featureInfo(Feature* feature)
+{
+    QChar kind = dynamic_cast<Node*>(feature) ? 'n' : dynamic_cast<Way*>(feature) ? 'w' : 'r';
+    QString key = QString("%1:%2").arg(kind).arg(feature->xmlId());
+
+    MPFeatureInfo* info = m_featureInfos.object(key);
+    if (!info || !isFeatureInfoOf(*info, feature)) {
+        info = new MPFeatureInfo;
+        info->html = feature->toHtml();
+        info->document = QSharedPointer<QTextDocument>(new QTextDocument);
+        info->document->setHtml(info->html);
+        for (int i=0; i<feature->tagSize(); ++i)
+            info->tags << qMakePair(feature->tagKey(i), feature->tagValue(i));
+        CoordBox box = feature->boundingBox();
+        info->box = QRectF(box.topLeft(), box.bottomRight());
+        Way* way = dynamic_cast<Way*>(feature);
+        info->nodes = way ? way->size() : 0;
+        m_featureInfos.insert(key, info);
+    }
+    return *info;
+}
+
+/*! Checks whether \a info describes \a feature as it is : with the same
+  tags, bounding box and number of nodes. Pooled tags share their strings,
+  which then compare without reading them.
+  */
+bool MPMapView::isFeatureInfoOf(const MPFeatureInfo& info, Feature* feature)
+{
+    if (info.tags.size() != feature->tagSize())
+        return false;
+    for (int i=0; i<info.tags.size(); ++i) {
+        if (info.tags[i].first != feature->tagKey(i) || info.tags[i].second != feature->tagValue(i))
+            return false;
+    }
+    Way* way = dynamic_cast<Way*>(feature);
+    CoordBox box = feature->boundingBox();
+    return info.nodes == (way ? way->size() : 0) && info.box == QRectF(box.topLeft(), box.bottomRight());
+}
+
 /*! When a feature is snapped (hovered)
   \see signal Interaction::featureSnap(Feature* feature)
  */
@@ -193,7 +389,7 @@ void MPMapView::on_featureSnap(Feature* feature)
         if (i->isSnapEnabled()) {
             setCursor(Qt::ArrowCursor);
         }
-        setToolTip(feature->toHtml());
+        setToolTip(featureInfo(feature).html);
     }
     else {
         updateDefaultCursor();
@@ -204,12 +400,14 @@ void MPMapView::on_featureSnap(Feature* feature)
 
 /*! When the user is idle (inactive)
 
-  Detects if the previous viewport is very different, and if so
-  emits viewportShift().
+  Resumes the rendering interrupted by user activity, detects if the previous
+  viewport is very different, and if so emits viewportShift().
   \see signal BaseInteraction::idle()
  */
 void MPMapView::on_userIdle()
 {
+    m_tilerenderer->resume();
+
     // Detect big moves in viewport
     if (!m_previousviewport.isNull()) {
         QRectF intersect = viewport().intersected(m_previousviewport);
@@ -224,3 +422,78 @@ void MPMapView::on_userIdle()
     }
     m_previousviewport = viewport();
 }
+
+/*! When the user moves the map.
+
+  Drops the rendering in progress, it is either outdated or will be resumed when idle.
+  The delay until the next frame is profiled as input latency. A predicted
+  viewport is cleared if the map was zoomed.
+  \see signal BaseInteraction::activity()
+ */
+void MPMapView::on_userActivity()
+{
+    m_tilerenderer->interrupt();
+    if (!m_inputLatency.isValid())
+        m_inputLatency.start();
+    if (m_predictionScale && !qFuzzyCompare(m_predictionScale, pixelPerM())) {
+        m_predictionScale = 0;
+        emit panPredictionCleared();
+    }
+}
+
+/*! When the user pans the map at \a velocity (pixels per millisecond).
+
+  The map follows the mouse, so the viewport moves the opposite way :
+  emits panPredicted() with the viewport expected PREFETCH_HORIZON
+  milliseconds ahead, so that its contents can be fetched before it is shown.
+  A null velocity ends the panning : emits panPredictionCleared().
+  \see signal BaseInteraction::panned()
+ */
+void MPMapView::on_panned(const QPointF& velocity)
+{
+    if (velocity.isNull()) {
+        if (m_predictionScale) {
+            m_predictionScale = 0;
+            emit panPredictionCleared();
+        }
+        return;
+    }
+    QRect predicted = rect().translated((-velocity * PREFETCH_HORIZON).toPoint());
+    m_predictionScale = pixelPerM();
+    emit panPredicted(CoordBox(fromView(predicted.bottomLeft()), fromView(predicted.topRight())));
+}
+
+/*! When the nodes of the document are projected in the background :
+  stores their points once the render workers, which read them, are
+  stopped, then renders again.
+  \see MPReprojector::apply()
+ */
+void MPMapView::on_reprojected()
+{
+    m_tilerenderer->release();
+    m_reprojector->apply();
+    invalidateAll();
+}
+
+/*! When features of the document are about to be deleted.
+  Stops the rendering, reprojection and snapping threads which may use them.
+ */
+void MPMapView::on_featuresRemoving()
+{
+    m_reprojector->cancel();
+    m_tilerenderer->release();
+    BaseInteraction* i = dynamic_cast<BaseInteraction*>(interaction());
+    if (i)
+        i->reinitialize();
+}
+
+/*! When the static buffer render is complete, with its phases durations.
+  \see signal MPTileRenderer::profiled()
+ */
+void MPMapView::on_renderProfiled(qlonglong foreground, qlonglong touchup, qlonglong names)
+{
+    m_profiler.addSample(MPPaintProfiler::ForegroundPhase, foreground / 1e6);
+    m_profiler.addSample(MPPaintProfiler::TouchupPhase, touchup / 1e6);
+    m_profiler.addSample(MPPaintProfiler::NamesPhase, names / 1e6);
+    emit profiled();
+}
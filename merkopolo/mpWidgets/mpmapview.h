@@ -2,14 +2,48 @@
 #define MPMAPVIEW_H
 
 #include <QMutex>
+#include <QElapsedTimer>
+#include <QCache>
+#include <QList>
+#include <QPair>
+#include <QPointer>
+#include <QRectF>
+#include <QSharedPointer>
+#include <QTextDocument>
 
 #include "MapView.h"
 
+#include "mppaintprofiler.h"
+
 #define VIEWPORT_SHIFT_PERCENT 0.75
+#define FEATURE_INFO_CACHE_SIZE 256
+#define PREFETCH_HORIZON 500
 
 class MPWindow;
 class LayerSwitcher;
+class Layer;
 class Interaction;
+class MPTileRenderer;
+class MPReprojector;
+class MPLodCache;
+
+
+/*! Description of a feature, built once and shared by its consumers. */
+struct MPFeatureInfo
+{
+    MPFeatureInfo() : nodes(0) {}
+
+    /*! HTML description (Feature::toHtml()) */
+    QString html;
+    /*! Parsed HTML description */
+    QSharedPointer<QTextDocument> document;
+    /*! Tags the description was built with, as key and value pairs */
+    QList< QPair<QString, QString> > tags;
+    /*! Bounding box the description was built with */
+    QRectF box;
+    /*! Number of nodes of the way the description was built with, 0 for other features */
+    int nodes;
+};
 
 
 class MPMapView : public MapView
@@ -21,6 +55,9 @@ public:
 
     void updateDefaultCursor();
     void setDocument(Document*);
+    void addLayer(Layer*);
+    void reproject();
+    void cancelReprojection();
     virtual Interaction * defaultInteraction();
     virtual void launch(Interaction *anInteraction);
 
@@ -28,19 +65,33 @@ public:
     virtual void paintEvent(QPaintEvent*);
     virtual void resizeEvent(QResizeEvent*);
 
+    const MPPaintProfiler& profiler() const;
+    MPFeatureInfo featureInfo(Feature*);
+    static bool isFeatureInfoOf(const MPFeatureInfo& info, Feature* feature);
+
 signals:
     void viewportShift();
     void mouseMove(QMouseEvent*);
     void featureSnap(Feature*);
     void painted(qlonglong);
+    void profiled();
     void imageRequested(int);
     void imageReceived();
     void imageFinished();
+    void panPredicted(const CoordBox&);
+    void panPredictionCleared();
 
 protected slots:
     void invalidateAll();
+    void on_layerSwitched();
     void on_userIdle();
+    void on_userActivity();
+    void on_panned(const QPointF&);
+    void on_featuresRemoving();
+    void on_reprojected();
+    void on_renderProfiled(qlonglong, qlonglong, qlonglong);
     void on_featureSnap(Feature*);
+    void on_imageDecoded();
     void on_imageRequested(ImageMapLayer*);
     void on_imageReceived(ImageMapLayer*);
     void on_loadingFinished(ImageMapLayer*);
@@ -50,11 +101,25 @@ protected:
     MPWindow* m_window;
     /*! Pointer to layer switcher */
     LayerSwitcher* m_layerswitcher;
+    /*! Renders the static (vectorial) buffer in worker threads */
+    MPTileRenderer* m_tilerenderer;
+    /*! Projects the document nodes in the background after projection changes */
+    MPReprojector* m_reprojector;
+    /*! Simplified ways of the document, redrawing the view when built */
+    QPointer<MPLodCache> m_lod;
+    /*! Durations of the paint phases over the last frames */
+    MPPaintProfiler m_profiler;
+    /*! Started at the first user input not shown yet, invalid otherwise */
+    QElapsedTimer m_inputLatency;
+    /*! Descriptions of the last hovered features, by kind and id */
+    QCache<QString, MPFeatureInfo> m_featureInfos;
 
     /*! Number of images currently downloading */
     int m_numImages;
     /*! Previous viewport, last time the user was idle */
     CoordBox m_previousviewport;
+    /*! Scale of the last panPredicted(), 0 if the prediction was cleared */
+    qreal m_predictionScale;
 };
 
 #endif // MPMAPVIEW_H
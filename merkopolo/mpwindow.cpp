@@ -2,8 +2,13 @@
 #include <QLineEdit>
 #include <QProgressBar>
 #include <QMessageBox>
+#include <QFileDialog>
+#include <QFileInfo>
+#include <QtConcurrentRun>
 
 #include "ImageMapLayer.h"
+#include "DrawingLayer.h"
+#include "IMapAdapter.h"
 #include "Layer.h"
 #include "MasPaintStyle.h"
 #include "Interaction.h"
@@ -17,6 +22,10 @@
 #include "infosdock.h"
 #include "zoomregioninteraction.h"
 #include "coordfield.h"
+#include "mpimagemanager.h"
+#include "mpfeaturesource.h"
+#include "mpimporter.h"
+#include "mpsnapshot.h"
 
 
 /*!
@@ -40,11 +49,16 @@ MPWindow::MPWindow(QWidget *parent) :
     m_view(0),
     m_document(0),
     m_streetlayer(0),
+    m_imagemanager(0),
+    m_importer(0),
+    m_importLayer(0),
+    m_snapshotWriter(0),
     m_infosdock(0),
     m_coordsLabel(0),
     m_paintTimeLabel(0),
     m_meterPerPixelLabel(0),
     m_imagesProgress(0),
+    m_tileCacheLabel(0),
     m_dataProgress(0),
     m_wsProgress(0),
     ui(new Ui::MPWindow)
@@ -56,7 +70,18 @@ MPWindow::MPWindow(QWidget *parent) :
     m_streetlayer->setMapAdapter(TMS_ADAPTER_UUID, "OSM Mapnik");
     m_streetlayer->setVisible(true);
 
+    // Tiles come from a persistent cache, downloaded if missing
+    m_imagemanager = new MPImageManager(this);
+    m_imagemanager->setCacheDir(MPImageManager::defaultCacheDir());
+    m_streetlayer->getMapAdapter()->setImageManager(m_imagemanager);
+    connect(m_imagemanager, SIGNAL(dataRequested()), m_streetlayer, SLOT(on_imageRequested()), Qt::QueuedConnection);
+    connect(m_imagemanager, SIGNAL(dataReceived()), m_streetlayer, SLOT(on_imageReceived()), Qt::QueuedConnection);
+    connect(m_imagemanager, SIGNAL(loadingFinished()), m_streetlayer, SLOT(on_loadingFinished()), Qt::QueuedConnection);
+
+    m_snapshotWriter = new QFutureWatcher<bool>(this);
+
     initUIComponents();
+    connect(m_imagemanager, SIGNAL(imageDecoded()), m_view, SLOT(on_imageDecoded()));
 
     // Allow slots connecting between threads with type CoordBox
     qRegisterMetaType<CoordBox>();
@@ -78,6 +103,11 @@ MPWindow::~MPWindow()
 {
     delete ui;
 
+    // Stop loading features before the document is deleted
+    delete m_importer;
+    qDeleteAll(m_featureSources);
+    m_snapshotWriter->waitForFinished();
+    m_view->cancelReprojection();
     delete m_document;  // will delete layers
     delete m_view;
     delete m_infosdock;
@@ -86,6 +116,7 @@ MPWindow::~MPWindow()
     delete m_zoomlevelLabel;
     delete m_paintTimeLabel;
     delete m_imagesProgress;
+    delete m_tileCacheLabel;
     delete m_dataProgress;
     delete m_wsProgress;
     delete m_sepCoordZoom;
@@ -111,6 +142,9 @@ void MPWindow::initUIComponents()
     connect(m_view, SIGNAL(interactionChanged(Interaction*)), this, SLOT(onInteractionChanged(Interaction*)));
     connect(m_view, SIGNAL(viewportShift()), this, SLOT(onViewShift()));
     connect(m_view, SIGNAL(painted(qlonglong)), this, SLOT(onViewPainted(qlonglong)));
+    connect(m_view, SIGNAL(panPredicted(CoordBox)), this, SLOT(onViewPanPredicted(CoordBox)));
+    connect(m_view, SIGNAL(panPredictionCleared()), this, SLOT(onViewPanPredictionCleared()));
+    connect(m_view, SIGNAL(profiled()), this, SLOT(onViewProfiled()));
     connect(m_view, SIGNAL(imageRequested(int)), this, SLOT(onViewImageRequested(int)));
     connect(m_view, SIGNAL(imageReceived()), this, SLOT(onViewImageReceived()));
     connect(m_view, SIGNAL(imageFinished()), this, SLOT(onViewImageFinished()));
@@ -142,6 +176,8 @@ void MPWindow::initUIComponents()
     m_imagesProgress->setMaximumWidth(200);
     m_imagesProgress->setFormat(tr("tile %v / %m"));
 
+    m_tileCacheLabel = new QLabel(this);
+
     m_wsProgress = new QProgressBar(this);
     m_wsProgress->setMaximumWidth(200);
     m_wsProgress->setTextVisible(true);
@@ -158,6 +194,7 @@ void MPWindow::initUIComponents()
     m_sepScaleTime->setFrameStyle(QFrame::VLine);
 
     statusBar()->addPermanentWidget(m_imagesProgress);
+    statusBar()->addPermanentWidget(m_tileCacheLabel);
     statusBar()->addPermanentWidget(m_dataProgress);
     statusBar()->addPermanentWidget(m_wsProgress);
     statusBar()->addPermanentWidget(m_coordsLabel);
@@ -211,12 +248,55 @@ void MPWindow::onInteractionChanged(Interaction* interaction)
     connect(this, SIGNAL(interactionReinitialize()), baseinteraction, SLOT(reinitialize()));
 }
 
+/*! When a batch of imported features is added : \a bytes of
+  \a total bytes of the file are processed.
+  \see MPImporter::progress()
+  */
+void MPWindow::onImportProgress(qint64 bytes, qint64 total)
+{
+    m_dataProgress->setFormat(tr("import %p%"));
+    m_dataProgress->setVisible(bytes < total);
+    m_dataProgress->setRange(0, int(total / 1024));
+    m_dataProgress->setValue(int(bytes / 1024));
+}
+
+/*! When the import is done, with an \a error message if it failed.
+  \see MPImporter::finished()
+  */
+void MPWindow::onImportFinished(const QString& error)
+{
+    m_dataProgress->setVisible(false);
+    if (!error.isEmpty()) {
+        showWarningError(error);
+        return;
+    }
+    m_view->reproject();
+
+    // The next import of this file opens the snapshot instead
+    m_snapshotWriter->waitForFinished();
+    m_snapshotWriter->setFuture(QtConcurrent::run(&MPSnapshot::write, MPSnapshot::fileNameFor(m_importFile),
+                                                  QList<Layer*>() << m_importLayer));
+}
+
 /*! When the map view was moved sufficiently to require data reload.
+  Loads the features around the new viewport, and evicts the far ones.
   \see MPMapView::viewportShift()
   */
 void MPWindow::onViewShift()
 {
-    qDebug() << tr("View shift");
+    foreach (MPFeatureSource* source, m_featureSources)
+        source->setViewport(m_view->viewport());
+}
+
+/*! When features are loaded : \a done of \a total cells.
+  \see MPFeatureSource::progress()
+  */
+void MPWindow::onDataProgress(int done, int total)
+{
+    m_dataProgress->setFormat(tr("cell %v / %m"));
+    m_dataProgress->setVisible(done < total);
+    m_dataProgress->setRange(0, total);
+    m_dataProgress->setValue(done);
 }
 
 /*! When mouse is moved on map view
@@ -232,7 +312,7 @@ void MPWindow::onViewMouseMove(QMouseEvent* event)
 void MPWindow::onViewFeatureSnap(Feature* feature)
 {
     if (feature) {
-        m_infosdock->setHoverHtml(feature->toHtml());
+        m_infosdock->setHoverDocument(m_view->featureInfo(feature).document);
     }
 }
 
@@ -243,6 +323,48 @@ void MPWindow::onViewPainted(qlonglong elapsed)
     m_meterPerPixelLabel->setText(tr("%1m/pixel").arg(1/m_view->pixelPerM(), 0, 'f', 2));
     m_zoomlevelLabel->setText(tr("zoom %1").arg(m_streetlayer->getCurrentZoom()));
     m_paintTimeLabel->setText(tr("%1ms").arg(elapsed));
+    updateTileCacheStats();
+    // Order tile downloads for what is shown now
+    m_imagemanager->setViewport(m_view->viewport(), m_streetlayer->getCurrentZoom());
+}
+
+/*! When the viewport is expected to reach \a box soon (panning).
+  Prefetches the street tiles and the features it shows.
+  */
+void MPWindow::onViewPanPredicted(const CoordBox& box)
+{
+    m_imagemanager->prefetch(m_streetlayer->getMapAdapter(), box);
+    foreach (MPFeatureSource* source, m_featureSources)
+        source->prefetch(box);
+}
+
+/*! When the viewport of the last onViewPanPredicted() is not expected
+  anymore. Stops prefetching.
+  */
+void MPWindow::onViewPanPredictionCleared()
+{
+    m_imagemanager->clearPrediction();
+    foreach (MPFeatureSource* source, m_featureSources)
+        source->clearPrediction();
+}
+
+/*! When new paint phases durations are available.
+  Shows their percentiles in the paint time tooltip.
+  */
+void MPWindow::onViewProfiled()
+{
+    const MPPaintProfiler& profiler = m_view->profiler();
+    QString rows;
+    for (int i=0; i<MPPaintProfiler::PhaseCount; ++i) {
+        MPPaintProfiler::Phase phase = MPPaintProfiler::Phase(i);
+        rows += QString("<tr><td>%1</td><td>%2</td><td>%3</td><td>%4</td></tr>")
+                .arg(MPPaintProfiler::phaseName(phase))
+                .arg(profiler.percentile(phase, 50), 0, 'f', 2)
+                .arg(profiler.percentile(phase, 95), 0, 'f', 2)
+                .arg(profiler.percentile(phase, 99), 0, 'f', 2);
+    }
+    m_paintTimeLabel->setToolTip(tr("<table><tr><th></th><th>p50</th><th>p95</th><th>p99</th></tr>%1</table>"
+                                    "(milliseconds)").arg(rows));
 }
 
 /*! When the \a InfosDock is hidden/shown.
@@ -252,6 +374,42 @@ void MPWindow::onDisplayInfosDock(bool state)
     ui->displayInfosDockAction->setChecked(state);
 }
 
+/*! When the import action is triggered (menu).
+  Opens the snapshot of an OpenStreetMap or GeoJSON file if it is up to date.
+  Otherwise imports the file in a new layer, in the background, and
+  writes its snapshot when done.
+  */
+void MPWindow::importData()
+{
+    if (m_importer && m_importer->isRunning()) {
+        showWarningError(tr("An import is already running"));
+        return;
+    }
+    QString fileName = QFileDialog::getOpenFileName(this, tr("Import"), QString(),
+                                                    tr("Map data (*.osm *.json *.geojson)"));
+    if (fileName.isEmpty())
+        return;
+    if (MPSnapshot::isUpToDate(fileName) && openSnapshot(MPSnapshot::fileNameFor(fileName)))
+        return;
+
+    // Layers being written must not change
+    m_snapshotWriter->waitForFinished();
+
+    DrawingLayer* layer = new DrawingLayer(QFileInfo(fileName).fileName());
+    m_document->add(layer);
+    m_view->addLayer(layer);
+
+    delete m_importer;
+    m_importFile = fileName;
+    m_importLayer = layer;
+    m_importer = new MPImporter(m_document, layer, this);
+    connect(m_importer, SIGNAL(progress(qint64,qint64)), this, SLOT(onImportProgress(qint64,qint64)));
+    connect(m_importer, SIGNAL(imported()), m_view, SLOT(invalidateAll()));
+    connect(m_importer, SIGNAL(finished(QString)), this, SLOT(onImportFinished(QString)));
+    if (!m_importer->start(fileName))
+        showWarningError(tr("Could not open %1").arg(fileName));
+}
+
 /*! When the zoom in action is triggered (button)
   \see QMetaObject::connectSlotsByName()
   */
@@ -276,6 +434,23 @@ void MPWindow::viewZoomWindow()
     m_view->launch(new ZoomRegionInteraction(m_view));
 }
 
+/*! Shows the counters of the decoded tiles cache.
+  */
+void MPWindow::updateTileCacheStats()
+{
+    MPTileCacheStats stats = m_imagemanager->cache()->stats();
+    quint64 lookups = stats.hits + stats.misses;
+    int ratio = lookups ? int(100 * stats.hits / lookups) : 0;
+    m_tileCacheLabel->setText(tr("cache %1%").arg(ratio));
+    m_tileCacheLabel->setToolTip(tr("Decoded tiles: %1 (%2 / %3 MB)<br/>Hits: %4<br/>Misses: %5<br/>Evictions: %6")
+                                 .arg(stats.count)
+                                 .arg(stats.bytes / (1024*1024))
+                                 .arg(m_imagemanager->cache()->budget() / (1024*1024))
+                                 .arg(stats.hits)
+                                 .arg(stats.misses)
+                                 .arg(stats.evictions));
+}
+
 /*! When the map view requests an image (tile) download.
   */
 void MPWindow::onViewImageRequested(int nbrequested)
@@ -312,17 +487,88 @@ void MPWindow::onViewImageFinished()
   */
 void MPWindow::loadDocument(MPDocument *aDoc)
 {
+    delete m_importer;
+    m_importer = 0;
+    m_importLayer = 0;
+    qDeleteAll(m_featureSources);
+    m_featureSources.clear();
+    m_snapshotWriter->waitForFinished();
+    m_view->cancelReprojection();
     delete m_document;
     m_document = aDoc;
 
+    // Features of the local store, if any, are loaded around the viewport
+    MPFeatureSource* source = new MPFeatureSource(m_document, this);
+    QString store = QSettings().value("data/store", MPFeatureSource::defaultStorePath()).toString();
+    if (source->open(store))
+        addFeatureSource(source);
+    else
+        delete source;
+
     m_document->addImageLayer(m_streetlayer);
     m_view->setDocument(m_document);
     m_view->projection().setProjectionType(m_streetlayer->projection());
+    m_view->reproject();
 
     // Default map position
     Coord toulouse(1.39,43.63);
     m_view->setViewport(CoordBox(toulouse, toulouse), m_view->rect());
     m_coordsLabel->setCoord(toulouse);
+    onViewShift();
+}
+
+/*! Loads the features of \a source around the viewport, from now on.
+  */
+void MPWindow::addFeatureSource(MPFeatureSource* source)
+{
+    connect(source, SIGNAL(progress(int,int)), this, SLOT(onDataProgress(int,int)));
+    connect(source, SIGNAL(aboutToRemoveFeatures()), m_view, SLOT(on_featuresRemoving()));
+    connect(source, SIGNAL(loaded()), m_view, SLOT(invalidateAll()));
+    m_featureSources << source;
+}
+
+/*! Opens the snapshot \a fileName in new layers. The viewport is kept if
+  it shows features of the snapshot, otherwise the view is centered on
+  them, zoomed in enough for their cells to be loaded (see
+  MPFeatureSource::maxViewportSize()).
+  Returns false if it is not a valid snapshot (of another version, for
+  instance) : its source must be imported again.
+  */
+bool MPWindow::openSnapshot(const QString& fileName)
+{
+    MPFeatureSource* source = new MPFeatureSource(m_document, this);
+    if (!source->open(fileName)) {
+        qWarning("Could not open snapshot %s", qPrintable(fileName));
+        delete source;
+        return false;
+    }
+    addFeatureSource(source);
+    foreach (Layer* layer, source->layers())
+        m_view->addLayer(layer);
+
+    QRectF extent = source->extent();
+    qreal maxSize = MPFeatureSource::maxViewportSize();
+    CoordBox viewport = m_view->viewport();
+    QRectF current = QRectF(viewport.topLeft(), viewport.bottomRight()).normalized();
+    if (!extent.isNull() &&
+        !(current.intersects(extent) && current.width() <= maxSize && current.height() <= maxSize)) {
+        QRectF box(0, 0, qMin(extent.width(), maxSize), qMin(extent.height(), maxSize));
+        box.moveCenter(extent.center());
+        m_view->setViewport(CoordBox(Coord(box.left(), box.top()), Coord(box.right(), box.bottom())), m_view->rect());
+
+        // The view keeps its aspect ratio, which may widen the box
+        viewport = m_view->viewport();
+        QRectF shown = QRectF(viewport.topLeft(), viewport.bottomRight()).normalized();
+        qreal excess = qMax(shown.width(), shown.height()) / maxSize;
+        if (excess > 1) {
+            box.setSize(box.size() / excess);
+            box.moveCenter(extent.center());
+            m_view->setViewport(CoordBox(Coord(box.left(), box.top()), Coord(box.right(), box.bottom())), m_view->rect());
+        }
+    }
+    source->setViewport(m_view->viewport());
+    m_view->invalidate(true, true);
+    return true;
 }
 
 /*! Show a message popup for critical errors.
@@ -5,6 +5,7 @@
 #include <QtToolBarDialog>
 #include <QProgressBar>
 #include <QLabel>
+#include <QFutureWatcher>
 
 #include "Coord.h"
 
@@ -21,6 +22,10 @@ class MPMapView;
 class InfosDock;
 class BaseLayer;
 class CoordField;
+class MPImageManager;
+class MPFeatureSource;
+class MPImporter;
+class Layer;
 
 class MPWindow : public QMainWindow
 {
@@ -40,6 +45,7 @@ public slots:
     void onCenterView(qreal,qreal);
 
     // Actions slots from UI
+    void importData();
     void displayInfosDock();
     void onDisplayInfosDock(bool);
     void viewZoomIn();
@@ -48,12 +54,19 @@ public slots:
 
     // Application slots
     void onViewShift();
+    void onDataProgress(int done, int total);
+    void onImportProgress(qint64 bytes, qint64 total);
+    void onImportFinished(const QString& error);
     void onViewMouseMove(QMouseEvent *event);
     void onViewFeatureSnap(Feature *feature);
     void onViewPainted(qlonglong);
+    void onViewPanPredicted(const CoordBox&);
+    void onViewPanPredictionCleared();
+    void onViewProfiled();
     void onViewImageRequested(int nbrequested);
     void onViewImageReceived();
     void onViewImageFinished();
+    void updateTileCacheStats();
     void onInteractionChanged(Interaction *interaction);
 
 protected slots:
@@ -66,6 +79,8 @@ protected:
     void closeEvent(QCloseEvent* event);
     void initUIComponents();
     void setMapViewport(const CoordBox&, bool wider = true, bool force = false, bool invalidate = true);
+    void addFeatureSource(MPFeatureSource* source);
+    bool openSnapshot(const QString& fileName);
 
     /*! Pointer to main map view */
     MPMapView* m_view;
@@ -73,6 +88,17 @@ protected:
     MPDocument* m_document;
     /*! Pointer to street background layer */
     ImageMapLayer* m_streetlayer;
+    /*! Provides background tiles, from a persistent cache */
+    MPImageManager* m_imagemanager;
+    /*! Load the features of the local store and of the opened snapshots around the viewport */
+    QList<MPFeatureSource*> m_featureSources;
+    /*! Imports a file in the document, if one is being imported */
+    MPImporter* m_importer;
+    /*! File being imported, and the layer it is imported in */
+    QString m_importFile;
+    Layer* m_importLayer;
+    /*! Writes the snapshot of the last import in a worker thread */
+    QFutureWatcher<bool>* m_snapshotWriter;
 
     /*! A dock to display hovered features informations */
     InfosDock* m_infosdock;
@@ -86,6 +112,8 @@ protected:
     QLabel* m_zoomlevelLabel;
     /*! Status progressbar for images (tiles) loading  */
     QProgressBar* m_imagesProgress;
+    /*! Status text for decoded tiles cache usage */
+    QLabel* m_tileCacheLabel;
     /*! Status progressbar for data loading */
     QProgressBar* m_dataProgress;
     /*! Status progressbar for webservice requests */